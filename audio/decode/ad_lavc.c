@@ -316,7 +316,7 @@ static int decode_new_packet(struct dec_audio *da)
 
     struct demux_packet *mpkt = priv->packet;
     if (!mpkt)
-        mpkt = demux_read_packet(da->header);
+        mpkt = audio_read_packet(da);
 
     priv->packet = talloc_steal(priv, mpkt);
 
@@ -171,7 +171,7 @@ static int feed_new_packet(struct dec_audio *da)
     struct ad_mpg123_context *con = da->priv;
     int ret;
 
-    struct demux_packet *pkt = demux_read_packet(da->header);
+    struct demux_packet *pkt = audio_read_packet(da);
     if (!pkt)
         return -1; /* EOF. */
 
@@ -198,7 +198,7 @@ static int decode_audio(struct dec_audio *da, struct mp_audio *buffer, int maxle
     spdif_ctx->out_buffer_size = maxlen * sstride;
     spdif_ctx->out_buffer      = buffer->planes[0];
 
-    struct demux_packet *mpkt = demux_read_packet(da->header);
+    struct demux_packet *mpkt = audio_read_packet(da);
     if (!mpkt)
         return -1;
 
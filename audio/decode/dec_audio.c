@@ -187,6 +187,7 @@ void audio_uninit(struct dec_audio *d_audio)
         d_audio->afilter = NULL;
     }
     uninit_decoder(d_audio);
+    audio_reset_decoding(d_audio);
     talloc_free(d_audio->decode_buffer);
     talloc_free(d_audio);
 }
@@ -247,6 +248,10 @@ static int filter_n_bytes(struct dec_audio *da, struct mp_audio_buffer *outbuf,
         int maxlen = mp_audio_buffer_get_write_available(da->decode_buffer);
         if (maxlen < DECODE_MAX_UNIT)
             break;
+        // Decoders read at most 1 packet per call. Pretend nothing happened
+        // if the queue is exhausted; the caller will refill it later.
+        if (da->queue_only && !da->num_packets)
+            break;
         struct mp_audio buffer;
         mp_audio_buffer_get_write_buffer(da->decode_buffer, maxlen, &buffer);
         buffer.samples = 0;
@@ -348,8 +353,60 @@ int audio_decode(struct dec_audio *d_audio, struct mp_audio_buffer *outbuf,
     return res;
 }
 
+// Return the next packet for the decoder. Decoders must use this instead of
+// calling demux_read_packet() directly.
+struct demux_packet *audio_read_packet(struct dec_audio *d_audio)
+{
+    if (d_audio->num_packets) {
+        struct demux_packet *pkt = d_audio->packets[0];
+        MP_TARRAY_REMOVE_AT(d_audio->packets, d_audio->num_packets, 0);
+        return pkt;
+    }
+    if (d_audio->queue_only)
+        return NULL;
+    return demux_read_packet(d_audio->header);
+}
+
+// Read packets from the demuxer until about duration seconds of audio are
+// queued, so that decoding can continue with queue_only set.
+void audio_prefetch_packets(struct dec_audio *d_audio, double duration)
+{
+    double start = MP_NOPTS_VALUE, end = MP_NOPTS_VALUE;
+    for (int n = 0; n < d_audio->num_packets; n++) {
+        double pts = d_audio->packets[n]->pts;
+        if (pts != MP_NOPTS_VALUE) {
+            if (start == MP_NOPTS_VALUE)
+                start = pts;
+            end = pts;
+        }
+    }
+    // Cap the queue, in case the packets have no timestamps.
+    while (d_audio->num_packets < 256) {
+        if (start != MP_NOPTS_VALUE && end - start >= duration)
+            break;
+        struct demux_packet *pkt = demux_read_packet(d_audio->header);
+        if (!pkt)
+            break;
+        if (pkt->pts != MP_NOPTS_VALUE) {
+            if (start == MP_NOPTS_VALUE)
+                start = pkt->pts;
+            end = pkt->pts;
+        }
+        MP_TARRAY_APPEND(d_audio, d_audio->packets, d_audio->num_packets, pkt);
+    }
+}
+
+// Whether all packets were read from the demuxer and passed to the decoder.
+bool audio_stream_eof(struct dec_audio *d_audio)
+{
+    return !d_audio->num_packets && demux_stream_eof(d_audio->header);
+}
+
 void audio_reset_decoding(struct dec_audio *d_audio)
 {
+    for (int n = 0; n < d_audio->num_packets; n++)
+        talloc_free(d_audio->packets[n]);
+    d_audio->num_packets = 0;
     if (d_audio->ad_driver)
         d_audio->ad_driver->control(d_audio, ADCTRL_RESET, NULL);
     if (d_audio->afilter)
@@ -47,6 +47,12 @@ struct dec_audio {
     double pts;
     // number of samples output by decoder after last known pts
     int pts_offset;
+    // Packets read ahead from the demuxer (see audio_prefetch_packets())
+    struct demux_packet **packets;
+    int num_packets;
+    // If set, decoding stops when the packet queue runs empty, instead of
+    // reading from the demuxer (which is not thread-safe).
+    bool queue_only;
     // For free use by the ad_driver
     void *priv;
 };
@@ -56,6 +62,9 @@ int audio_init_best_codec(struct dec_audio *d_audio, char *audio_decoders);
 int audio_decode(struct dec_audio *d_audio, struct mp_audio_buffer *outbuf,
                  int minsamples);
 void audio_reset_decoding(struct dec_audio *d_audio);
+struct demux_packet *audio_read_packet(struct dec_audio *d_audio);
+void audio_prefetch_packets(struct dec_audio *d_audio, double duration);
+bool audio_stream_eof(struct dec_audio *d_audio);
 void audio_uninit(struct dec_audio *d_audio);
 
 int audio_init_filters(struct dec_audio *d_audio, int in_samplerate,
@@ -32,6 +32,7 @@
 #include "options/options.h"
 #include "options/m_config.h"
 #include "osdep/timer.h"
+#include "compat/atomics.h"
 #include "common/msg.h"
 #include "common/common.h"
 #include "common/global.h"
@@ -284,6 +285,13 @@ int ao_get_space(struct ao *ao)
     return ao->api->get_space(ao);
 }
 
+// Return how often the device ran dry while playing (since ao init).
+int ao_get_underruns(struct ao *ao)
+{
+    mp_memory_barrier();
+    return ao->underruns;
+}
+
 // Stop playback and empty buffers. Essentially go back to the state after
 // ao->init().
 void ao_reset(struct ao *ao)
@@ -56,6 +56,10 @@ struct ao {
 
     int buffer;
     void *api_priv;
+
+    // Number of times the device ran out of data while playing. Updated by
+    // the push/pull wrappers with mp_atomic_add_and_fetch().
+    int underruns;
 };
 
 extern const struct ao_driver ao_api_push;
@@ -52,6 +52,12 @@ struct ao_pull_state {
 
     // Device delay of the last written sample, in realtime.
     int64_t end_time_us;
+
+    // Whether the last written data was flagged with AOPLAY_FINAL_CHUNK.
+    int final_chunk;
+
+    // Set while the callback is starved (so each underrun is counted once).
+    int underrun;
 };
 
 static int get_space(struct ao *ao)
@@ -77,6 +83,7 @@ static int play(struct ao *ao, void **data, int samples, int flags)
         int r = mp_ring_write(p->buffers[n], data[n], write_bytes);
         assert(r == write_bytes);
     }
+    p->final_chunk = !!(flags & AOPLAY_FINAL_CHUNK);
     if (p->state != AO_STATE_PLAY) {
         p->end_time_us = 0;
         p->state = AO_STATE_PLAY;
@@ -122,6 +129,14 @@ int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_us)
     if (p->state == AO_STATE_PAUSE)
         bytes = 0;
 
+    if (p->state == AO_STATE_PLAY && bytes < full_bytes && !p->final_chunk) {
+        if (!p->underrun)
+            mp_atomic_add_and_fetch(&ao->underruns, 1);
+        p->underrun = 1;
+    } else if (bytes > 0) {
+        p->underrun = 0;
+    }
+
     for (int n = 0; n < ao->num_planes; n++) {
         int r = mp_ring_read(p->buffers[n], data[n], bytes);
         assert(r == bytes);
@@ -56,6 +56,9 @@ struct ao_push_state {
     bool final_chunk;
     double expected_end_time;
 
+    // Set while the device is known to have run dry (counted once).
+    bool underrun;
+
     // -- protected by wakeup_lock
     bool need_wakeup;
 };
@@ -108,6 +111,7 @@ static void reset(struct ao *ao)
         ao->driver->reset(ao);
     mp_audio_buffer_clear(p->buffer);
     p->playing = false;
+    p->underrun = false;
     wakeup_playthread(ao);
     pthread_mutex_unlock(&p->lock);
 }
@@ -210,10 +214,17 @@ static int ao_play_data(struct ao *ao)
     mp_audio_buffer_peek(p->buffer, &data);
     int max = data.samples;
     int space = ao->driver->get_space ? ao->driver->get_space(ao) : INT_MAX;
+    if (max == 0 && !p->final_chunk && space >= ao->device_buffer) {
+        // Nothing queued, and the device buffer is empty as well.
+        if (!p->underrun)
+            mp_atomic_add_and_fetch(&ao->underruns, 1);
+        p->underrun = true;
+    }
     if (data.samples > space)
         data.samples = space;
     if (data.samples <= 0)
         return 0;
+    p->underrun = false;
     MP_STATS(ao, "start ao fill");
     int flags = 0;
     if (p->final_chunk && data.samples == max)
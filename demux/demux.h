@@ -289,6 +289,9 @@ struct demux_packet *demux_packet_list_fill(struct demux_packet **pkts,
 
 bool demux_matroska_uid_cmp(struct matroska_segment_uid *a,
                             struct matroska_segment_uid *b);
+int demux_matroska_read_segment_uids(struct stream *s, struct mp_log *log,
+                                     void *ta_parent,
+                                     struct matroska_segment_uid **uids);
 
 const char *stream_type_name(enum stream_type type);
 
@@ -2817,3 +2817,95 @@ bool demux_matroska_uid_cmp(struct matroska_segment_uid *a,
     return (!memcmp(a->segment, b->segment, 16) &&
             a->edition == b->edition);
 }
+
+static void read_segment_uid(struct stream *s, struct mp_log *log,
+                             struct matroska_segment_uid *uid)
+{
+    struct ebml_info info = {0};
+    struct ebml_parse_ctx parse_ctx = {log, .no_error_messages = true};
+    if (ebml_read_element(s, &parse_ctx, &info, &ebml_info_desc) >= 0
+        && info.n_segment_uid && info.segment_uid.len == 16)
+        memcpy(uid->segment, info.segment_uid.start, 16);
+    talloc_free(parse_ctx.talloc_ctx);
+}
+
+// Return the position of the SegmentInfo element listed in the SeekHead
+// element at the current stream position, or -1.
+static int64_t read_seekhead_info_pos(struct stream *s, struct mp_log *log,
+                                      int64_t segment_start)
+{
+    int64_t pos = -1;
+    struct ebml_seek_head seekhead = {0};
+    struct ebml_parse_ctx parse_ctx = {log, .no_error_messages = true};
+    if (ebml_read_element(s, &parse_ctx, &seekhead, &ebml_seek_head_desc) >= 0) {
+        for (int i = 0; i < seekhead.n_seek; i++) {
+            struct ebml_seek *seek = &seekhead.seek[i];
+            if (seek->n_seek_id == 1 && seek->n_seek_position == 1 &&
+                seek->seek_id == MATROSKA_ID_INFO)
+            {
+                pos = seek->seek_position + segment_start;
+                break;
+            }
+        }
+    }
+    talloc_free(parse_ctx.talloc_ctx);
+    return pos;
+}
+
+// Read the SegmentUID of each segment in a Matroska file, without opening a
+// demuxer. Only the EBML headers and the top level elements up to the
+// SegmentInfo element of each segment are read. If SegmentInfo comes after
+// the first Cluster, it is found through the SeekHead. The array of uids (all
+// zero for segments without uid) is allocated under ta_parent. Returns the
+// number of segments, or 0 if this doesn't look like a Matroska file.
+int demux_matroska_read_segment_uids(struct stream *s, struct mp_log *log,
+                                     void *ta_parent,
+                                     struct matroska_segment_uid **uids)
+{
+    int num_uids = 0;
+    *uids = NULL;
+    while (1) {
+        // Segments are like concatenated Matroska files.
+        if (ebml_read_id(s) != EBML_ID_EBML)
+            break;
+        uint64_t len = ebml_read_length(s);
+        if (len == EBML_UINT_INVALID || !stream_skip(s, len))
+            break;
+        if (ebml_read_id(s) != MATROSKA_ID_SEGMENT)
+            break;
+        len = ebml_read_length(s);
+        int64_t segment_start = stream_tell(s);
+        int64_t segment_end = len == EBML_UINT_INVALID ? 0 : segment_start + len;
+
+        struct matroska_segment_uid uid = {{0}};
+        int64_t info_pos = -1;
+        bool have_info = false;
+        while (1) {
+            uint32_t id = ebml_read_id(s);
+            if (s->eof || id == EBML_ID_INVALID || id == MATROSKA_ID_CLUSTER)
+                break;
+            if (id == MATROSKA_ID_INFO) {
+                read_segment_uid(s, log, &uid);
+                have_info = true;
+                break;
+            }
+            if (id == MATROSKA_ID_SEEKHEAD) {
+                int64_t pos = read_seekhead_info_pos(s, log, segment_start);
+                if (pos >= 0 && info_pos < 0)
+                    info_pos = pos;
+                continue;
+            }
+            len = ebml_read_length(s);
+            if (len == EBML_UINT_INVALID || !stream_skip(s, len))
+                break;
+        }
+        if (!have_info && info_pos >= 0 && stream_seek(s, info_pos) &&
+            ebml_read_id(s) == MATROSKA_ID_INFO)
+            read_segment_uid(s, log, &uid);
+        MP_TARRAY_APPEND(ta_parent, *uids, num_uids, uid);
+
+        if (segment_end <= 0 || !stream_seek(s, segment_end))
+            break;
+    }
+    return num_uids;
+}
@@ -32,6 +32,11 @@
 #include <pthread.h>
 #include <assert.h>
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #include <libavutil/avstring.h>
 #include <libavutil/common.h>
 
@@ -86,7 +91,8 @@ struct cmd_bind_section {
     struct cmd_bind_section *next;
 };
 
-#define MP_MAX_FDS 10
+// Maximum number of events fetched with a single epoll_wait() call
+#define MP_MAX_EPOLL_EVENTS 16
 
 struct input_fd {
     struct mp_log *log;
@@ -100,6 +106,10 @@ struct input_fd {
     unsigned dead : 1;
     unsigned got_cmd : 1;
     unsigned select : 1;
+    unsigned polled : 1;    // registered with the epoll set
+    unsigned edge : 1;      // edge-triggered, must be read until EAGAIN
+    unsigned pending : 1;   // edge-triggered and not drained yet
+    unsigned removed : 1;   // removed, but epoll might still reference it
     // These fields are for the cmd fds.
     char *buffer;
     int pos, size;
@@ -175,13 +185,24 @@ struct input_ctx {
 
     unsigned int mouse_event_counter;
 
-    struct input_fd fds[MP_MAX_FDS];
-    unsigned int num_fds;
+    struct input_fd **fds;
+    int num_fds;
 
     struct cmd_queue cmd_queue;
 
     bool in_select;
     int wakeup_pipe[2];
+
+    // Persistent interest set (-1 if select() or polling is used instead).
+    int epoll_fd;
+    // Number of edge-triggered fds which still have unread data.
+    int num_pending;
+    // Removed while another thread was waiting; freed after the wait.
+    struct input_fd **removed_fds;
+    int num_removed_fds;
+    // timerfd for key autorepeat, part of the epoll set (or -1).
+    int ar_timer_fd;
+    int64_t ar_timer_deadline;
 };
 
 int async_quit_request;
@@ -211,6 +232,9 @@ const m_option_t mp_input_opts[] = {
     OPT_FLAG("input-joystick", input.use_joystick, CONF_GLOBAL),
     OPT_FLAG("input-lirc", input.use_lirc, CONF_GLOBAL),
     OPT_FLAG("input-right-alt-gr", input.use_alt_gr, CONF_GLOBAL),
+#if HAVE_UNIX_SOCKETS
+    OPT_STRING("input-unix-socket", input.ipc_path, CONF_GLOBAL),
+#endif
 #if HAVE_LIRC
     OPT_STRING("input-lirc-conf", input.lirc_configfile, CONF_GLOBAL),
 #endif
@@ -774,6 +798,56 @@ int input_default_read_cmd(void *ctx, int fd, char *buf, int l)
     }
 }
 
+#if HAVE_EPOLL
+
+static void epoll_add_fd(struct input_ctx *ictx, struct input_fd *fd)
+{
+    if (ictx->epoll_fd < 0 || !fd->select)
+        return;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = fd };
+    // Command fds are buffered by read_cmd(), so they can be drained fully
+    // on each notification. This is safe only if reading can't block.
+    if (fd->read_cmd) {
+        int flags = fcntl(fd->fd, F_GETFL);
+        if (flags >= 0 && (flags & O_NONBLOCK))
+            ev.events |= EPOLLET;
+    }
+    if (epoll_ctl(ictx->epoll_fd, EPOLL_CTL_ADD, fd->fd, &ev) < 0) {
+        // E.g. regular files can't be used with epoll. They're always
+        // readable anyway, so poll them on every iteration instead.
+        MP_VERBOSE(ictx, "Can't poll file descriptor %d: %s\n", fd->fd,
+                   strerror(errno));
+        fd->select = 0;
+        return;
+    }
+    fd->polled = 1;
+    if (ev.events & EPOLLET) {
+        // There might be data that arrived before the fd was added.
+        fd->edge = 1;
+        fd->pending = 1;
+        ictx->num_pending++;
+    }
+}
+
+static void epoll_rm_fd(struct input_ctx *ictx, struct input_fd *fd)
+{
+    if (fd->polled)
+        epoll_ctl(ictx->epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL);
+    fd->polled = 0;
+}
+
+#else
+
+static void epoll_add_fd(struct input_ctx *ictx, struct input_fd *fd)
+{
+}
+
+static void epoll_rm_fd(struct input_ctx *ictx, struct input_fd *fd)
+{
+}
+
+#endif
+
 int mp_input_add_fd(struct input_ctx *ictx, int unix_fd, int select,
                     int read_cmd_func(void *ctx, int fd, char *dest, int size),
                     int read_key_func(void *ctx, int fd),
@@ -785,12 +859,7 @@ int mp_input_add_fd(struct input_ctx *ictx, int unix_fd, int select,
     }
 
     input_lock(ictx);
-    struct input_fd *fd = NULL;
-    if (ictx->num_fds == MP_MAX_FDS) {
-        MP_ERR(ictx, "Too many file descriptors.\n");
-    } else {
-        fd = &ictx->fds[ictx->num_fds];
-    }
+    struct input_fd *fd = talloc_ptrtype(ictx, fd);
     *fd = (struct input_fd){
         .log = ictx->log,
         .fd = unix_fd,
@@ -800,30 +869,39 @@ int mp_input_add_fd(struct input_ctx *ictx, int unix_fd, int select,
         .close_func = close_func,
         .ctx = ctx,
     };
-    ictx->num_fds++;
+    epoll_add_fd(ictx, fd);
+    MP_TARRAY_APPEND(ictx, ictx->fds, ictx->num_fds, fd);
     input_unlock(ictx);
-    return !!fd;
+    return 1;
 }
 
 static void mp_input_rm_fd(struct input_ctx *ictx, int fd)
 {
-    struct input_fd *fds = ictx->fds;
-    unsigned int i;
+    struct input_fd **fds = ictx->fds;
+    int i;
 
     for (i = 0; i < ictx->num_fds; i++) {
-        if (fds[i].fd == fd)
+        if (fds[i]->fd == fd)
             break;
     }
     if (i == ictx->num_fds)
         return;
-    if (fds[i].close_func)
-        fds[i].close_func(fds[i].ctx, fds[i].fd);
-    talloc_free(fds[i].buffer);
-
-    if (i + 1 < ictx->num_fds)
-        memmove(&fds[i], &fds[i + 1],
-                (ictx->num_fds - i - 1) * sizeof(struct input_fd));
-    ictx->num_fds--;
+    struct input_fd *entry = fds[i];
+    MP_TARRAY_REMOVE_AT(fds, ictx->num_fds, i);
+
+    epoll_rm_fd(ictx, entry);
+    if (entry->close_func)
+        entry->close_func(entry->ctx, entry->fd);
+    talloc_free(entry->buffer);
+    entry->buffer = NULL;
+    entry->removed = 1;
+
+    // A concurrent epoll_wait() might have returned events pointing to it.
+    if (ictx->in_select) {
+        MP_TARRAY_APPEND(ictx, ictx->removed_fds, ictx->num_removed_fds, entry);
+    } else {
+        talloc_free(entry);
+    }
 }
 
 void mp_input_rm_key_fd(struct input_ctx *ictx, int fd)
@@ -851,6 +929,9 @@ static int read_cmd(struct input_fd *mp_fd, char **ret)
     while (!mp_fd->got_cmd && !mp_fd->eof && (mp_fd->size - mp_fd->pos > 1)) {
         int r = mp_fd->read_cmd(mp_fd->ctx, mp_fd->fd, mp_fd->buffer + mp_fd->pos,
                                 mp_fd->size - 1 - mp_fd->pos);
+        // Anything but a successful read means the fd is drained.
+        if (r != MP_INPUT_RETRY && r <= 0)
+            mp_fd->pending = 0;
         // Error ?
         if (r < 0) {
             switch (r) {
@@ -871,6 +952,8 @@ static int read_cmd(struct input_fd *mp_fd, char **ret)
         mp_fd->pos += r;
         break;
     }
+    if (mp_fd->eof)
+        mp_fd->pending = 0;
 
     mp_fd->got_cmd = 0;
 
@@ -963,26 +1046,138 @@ static void read_fd(struct input_ctx *ictx, struct input_fd *fd)
 static void remove_dead_fds(struct input_ctx *ictx)
 {
     for (int i = 0; i < ictx->num_fds; i++) {
-        if (ictx->fds[i].dead) {
-            mp_input_rm_fd(ictx, ictx->fds[i].fd);
+        if (ictx->fds[i]->dead) {
+            mp_input_rm_fd(ictx, ictx->fds[i]->fd);
             i--;
         }
     }
 }
 
+#if HAVE_EPOLL
+
+static void epoll_wait_read(struct input_ctx *ictx, int time)
+{
+    if (ictx->num_pending)
+        time = 0;
+    struct epoll_event events[MP_MAX_EPOLL_EVENTS];
+    ictx->in_select = true;
+    input_unlock(ictx);
+    int num_events = epoll_wait(ictx->epoll_fd, events, MP_MAX_EPOLL_EVENTS,
+                                time);
+    if (num_events < 0) {
+        if (errno != EINTR)
+            MP_ERR(ictx, "epoll error: %s\n", strerror(errno));
+        num_events = 0;
+    }
+    input_lock(ictx);
+    ictx->in_select = false;
+    for (int i = 0; i < num_events; i++) {
+        struct input_fd *fd = events[i].data.ptr;
+        if (fd->removed)
+            continue;
+        if (fd->edge) {
+            if (!fd->pending)
+                ictx->num_pending++;
+            fd->pending = 1;
+        } else {
+            read_fd(ictx, fd);
+        }
+    }
+    for (int i = 0; i < ictx->num_removed_fds; i++)
+        talloc_free(ictx->removed_fds[i]);
+    ictx->num_removed_fds = 0;
+
+    if (ictx->num_pending) {
+        ictx->num_pending = 0;
+        for (int i = 0; i < ictx->num_fds; i++) {
+            struct input_fd *fd = ictx->fds[i];
+            if (!fd->pending)
+                continue;
+            read_fd(ictx, fd);
+            if (fd->pending)
+                ictx->num_pending++;
+        }
+        // Come back until everything is drained.
+        if (ictx->num_pending)
+            ictx->got_new_events = true;
+    }
+}
+
+static int read_ar_timer(void *ctx, int fd)
+{
+    struct input_ctx *ictx = ctx;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        ictx->got_new_events = true;
+    return MP_INPUT_NOTHING;
+}
+
+static void init_epoll(struct input_ctx *ictx)
+{
+    ictx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ictx->epoll_fd < 0) {
+        MP_VERBOSE(ictx, "epoll not available, using select().\n");
+        return;
+    }
+    ictx->ar_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ictx->ar_timer_fd >= 0) {
+        mp_input_add_fd(ictx, ictx->ar_timer_fd, true, NULL, read_ar_timer,
+                        NULL, ictx);
+    }
+}
+
+// Let the autorepeat timerfd wake up the wait instead of limiting the wait
+// time. Returns false if the caller has to limit the wait time.
+static bool arm_ar_timer(struct input_ctx *ictx)
+{
+    if (ictx->ar_timer_fd < 0)
+        return false;
+    int64_t deadline = ictx->ar_state == 0
+        ? ictx->last_key_down_time + ictx->ar_delay * 1000LL
+        : ictx->last_ar + 1000000 / ictx->ar_rate;
+    if (deadline == ictx->ar_timer_deadline)
+        return true;
+    int64_t wait = deadline - mp_time_us();
+    if (wait <= 0)
+        return false;
+    struct itimerspec ts = {
+        .it_value = { .tv_sec = wait / 1000000,
+                      .tv_nsec = (wait % 1000000) * 1000 },
+    };
+    if (timerfd_settime(ictx->ar_timer_fd, 0, &ts, NULL) < 0)
+        return false;
+    ictx->ar_timer_deadline = deadline;
+    return true;
+}
+
+#else
+
+static void init_epoll(struct input_ctx *ictx)
+{
+}
+
+static bool arm_ar_timer(struct input_ctx *ictx)
+{
+    return false;
+}
+
+#endif
+
 #if HAVE_POSIX_SELECT
 
-static void input_wait_read(struct input_ctx *ictx, int time)
+static void select_wait_read(struct input_ctx *ictx, int time)
 {
     fd_set fds;
     FD_ZERO(&fds);
     int max_fd = 0;
     for (int i = 0; i < ictx->num_fds; i++) {
-        if (!ictx->fds[i].select)
+        struct input_fd *fd = ictx->fds[i];
+        if (!fd->select || fd->fd >= FD_SETSIZE)
             continue;
-        if (ictx->fds[i].fd > max_fd)
-            max_fd = ictx->fds[i].fd;
-        FD_SET(ictx->fds[i].fd, &fds);
+        if (fd->fd > max_fd)
+            max_fd = fd->fd;
+        FD_SET(fd->fd, &fds);
     }
     struct timeval tv, *time_val;
     tv.tv_sec = time / 1000;
@@ -997,16 +1192,20 @@ static void input_wait_read(struct input_ctx *ictx, int time)
     }
     input_lock(ictx);
     ictx->in_select = false;
+    for (int i = 0; i < ictx->num_removed_fds; i++)
+        talloc_free(ictx->removed_fds[i]);
+    ictx->num_removed_fds = 0;
     for (int i = 0; i < ictx->num_fds; i++) {
-        if (ictx->fds[i].select && !FD_ISSET(ictx->fds[i].fd, &fds))
+        struct input_fd *fd = ictx->fds[i];
+        if (fd->select && (fd->fd >= FD_SETSIZE || !FD_ISSET(fd->fd, &fds)))
             continue;
-        read_fd(ictx, &ictx->fds[i]);
+        read_fd(ictx, fd);
     }
 }
 
 #else
 
-static void input_wait_read(struct input_ctx *ictx, int time)
+static void cond_wait_read(struct input_ctx *ictx, int time)
 {
     if (time > 0) {
         struct timespec deadline = mpthread_get_deadline(time / 1000.0);
@@ -1014,17 +1213,34 @@ static void input_wait_read(struct input_ctx *ictx, int time)
     }
 
     for (int i = 0; i < ictx->num_fds; i++)
-        read_fd(ictx, &ictx->fds[i]);
+        read_fd(ictx, ictx->fds[i]);
 }
 
 #endif
 
+static void input_wait_read(struct input_ctx *ictx, int time)
+{
+#if HAVE_EPOLL
+    if (ictx->epoll_fd >= 0) {
+        epoll_wait_read(ictx, time);
+        return;
+    }
+#endif
+#if HAVE_POSIX_SELECT
+    select_wait_read(ictx, time);
+#else
+    cond_wait_read(ictx, time);
+#endif
+}
+
 /**
  * \param time time to wait at most for an event in milliseconds
  */
 static void read_events(struct input_ctx *ictx, int time)
 {
-    if (ictx->last_key_down && ictx->ar_rate > 0 && ictx->ar_state >= 0) {
+    if (ictx->last_key_down && ictx->ar_rate > 0 && ictx->ar_state >= 0 &&
+        !arm_ar_timer(ictx))
+    {
         time = FFMIN(time, 1000 / ictx->ar_rate);
         time = FFMIN(time, ictx->ar_delay);
     }
@@ -1039,8 +1255,8 @@ static void read_events(struct input_ctx *ictx, int time)
 
         if (time) {
             for (int i = 0; i < ictx->num_fds; i++) {
-                if (!ictx->fds[i].select)
-                    read_fd(ictx, &ictx->fds[i]);
+                if (!ictx->fds[i]->select)
+                    read_fd(ictx, ictx->fds[i]);
             }
         }
 
@@ -1469,6 +1685,8 @@ struct input_ctx *mp_input_init(struct mpv_global *global)
         .mouse_section = "default",
         .test = input_conf->test,
         .wakeup_pipe = {-1, -1},
+        .epoll_fd = -1,
+        .ar_timer_fd = -1,
     };
 
     mpthread_mutex_init_recursive(&ictx->mutex);
@@ -1489,6 +1707,8 @@ struct input_ctx *mp_input_init(struct mpv_global *global)
             parse_config(ictx, true, line, "<builtin>", NULL);
     }
 
+    init_epoll(ictx);
+
 #ifndef __MINGW32__
     int ret = pipe(ictx->wakeup_pipe);
     if (ret == 0) {
@@ -1595,13 +1815,18 @@ void mp_input_uninit(struct input_ctx *ictx)
 #endif
 
     for (int i = 0; i < ictx->num_fds; i++) {
-        if (ictx->fds[i].close_func)
-            ictx->fds[i].close_func(ictx->fds[i].ctx, ictx->fds[i].fd);
+        if (ictx->fds[i]->close_func)
+            ictx->fds[i]->close_func(ictx->fds[i]->ctx, ictx->fds[i]->fd);
+        talloc_free(ictx->fds[i]->buffer);
     }
     for (int i = 0; i < 2; i++) {
         if (ictx->wakeup_pipe[i] != -1)
             close(ictx->wakeup_pipe[i]);
     }
+    if (ictx->ar_timer_fd >= 0)
+        close(ictx->ar_timer_fd);
+    if (ictx->epoll_fd >= 0)
+        close(ictx->epoll_fd);
     clear_queue(&ictx->cmd_queue);
     talloc_free(ictx->current_down_cmd);
     pthread_mutex_destroy(&ictx->mutex);
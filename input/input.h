@@ -96,8 +96,10 @@ typedef struct mp_cmd {
 
 /* Add a new command input source.
  * "fd" is a file descriptor (use -1 if you don't use any fd)
- * "select" tells whether to use select() on the fd to determine when to
- * try reading.
+ * "select" tells whether to use select() (or epoll) on the fd to determine
+ * when to try reading. Non-blocking fds with a read_cmd_func are polled
+ * edge-triggered when epoll is available, and are read until they return
+ * MP_INPUT_NOTHING.
  * "read_cmd_func" is optional. It must return either text data or one of the
  * MP_INPUT error codes above. For return values >= 0, it behaves like UNIX
  * read() and returns the number of bytes copied to the dest buffer.
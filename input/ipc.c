@@ -0,0 +1,660 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* JSON IPC over a UNIX domain socket.
+ *
+ * Every connection gets its own thread and its own mpv_handle, so it behaves
+ * exactly like a libmpv client. Requests are single-line JSON objects:
+ *
+ *   { "command": ["get_property", "volume"], "request_id": 1 }
+ *
+ * Requests are issued with the asynchronous client API and keyed by their
+ * request_id, so a client can pipeline any number of them without waiting
+ * for replies. Replies and events are written as single-line JSON objects.
+ * All output generated while handling one wakeup is batched into a single
+ * write() call.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+
+#include "osdep/io.h"
+
+#include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "misc/json.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "player/client.h"
+#include "talloc.h"
+
+#include "ipc.h"
+
+// Stop reading requests while this much output is pending.
+#define MAX_OUTPUT_BACKLOG (4 * 1024 * 1024)
+// Maximum size of a single request line.
+#define MAX_REQUEST_SIZE (1024 * 1024)
+
+struct mp_ipc_ctx {
+    struct mp_log *log;
+    struct mp_client_api *client_api;
+    const char *path;
+
+    pthread_t thread;
+    int death_pipe[2];
+};
+
+struct client_arg {
+    struct mp_log *log;
+    struct mpv_handle *client;
+
+    int client_fd;
+
+    bstr in;            // partial request data
+    bstr out;           // pending output
+    size_t out_pos;     // already written part of out
+
+    bool suspended;
+};
+
+static void append_reply(struct client_arg *arg, int64_t request_id, int err,
+                         mpv_node *data)
+{
+    void *tmp = talloc_new(NULL);
+    mpv_node reply = { .format = MPV_FORMAT_NODE_MAP,
+                       .u.list = talloc_zero(tmp, struct mpv_node_list) };
+    struct mpv_node_list *list = reply.u.list;
+
+    MP_TARRAY_GROW(tmp, list->keys, 2);
+    MP_TARRAY_GROW(tmp, list->values, 2);
+    list->keys[list->num] = "request_id";
+    list->values[list->num++] = (mpv_node){ .format = MPV_FORMAT_INT64,
+                                            .u.int64 = request_id };
+    list->keys[list->num] = "error";
+    list->values[list->num++] = (mpv_node){ .format = MPV_FORMAT_STRING,
+                                            .u.string = (char *)
+                                                mpv_error_string(err) };
+    if (data) {
+        list->keys[list->num] = "data";
+        list->values[list->num++] = *data;
+    }
+
+    if (json_write(arg, &arg->out, &reply) < 0)
+        MP_ERR(arg, "Could not serialize reply.\n");
+    bstr_xappend(arg, &arg->out, bstr0("\n"));
+    talloc_free(tmp);
+}
+
+static void map_add(void *tmp, mpv_node *map, const char *key, mpv_node val)
+{
+    struct mpv_node_list *list = map->u.list;
+    MP_TARRAY_GROW(tmp, list->keys, list->num);
+    MP_TARRAY_GROW(tmp, list->values, list->num);
+    list->keys[list->num] = (char *)key;
+    list->values[list->num] = val;
+    list->num++;
+}
+
+static mpv_node node_str(const char *s)
+{
+    return (mpv_node){ .format = MPV_FORMAT_STRING, .u.string = (char *)s };
+}
+
+static mpv_node node_int(int64_t v)
+{
+    return (mpv_node){ .format = MPV_FORMAT_INT64, .u.int64 = v };
+}
+
+static void append_event(struct client_arg *arg, mpv_event *event)
+{
+    void *tmp = talloc_new(NULL);
+    mpv_node msg = { .format = MPV_FORMAT_NODE_MAP,
+                     .u.list = talloc_zero(tmp, struct mpv_node_list) };
+    map_add(tmp, &msg, "event", node_str(mpv_event_name(event->event_id)));
+
+    switch (event->event_id) {
+    case MPV_EVENT_LOG_MESSAGE: {
+        mpv_event_log_message *m = event->data;
+        map_add(tmp, &msg, "prefix", node_str(m->prefix));
+        map_add(tmp, &msg, "level", node_str(m->level));
+        map_add(tmp, &msg, "text", node_str(m->text));
+        break;
+    }
+    case MPV_EVENT_CLIENT_MESSAGE: {
+        mpv_event_client_message *m = event->data;
+        mpv_node args = { .format = MPV_FORMAT_NODE_ARRAY,
+                          .u.list = talloc_zero(tmp, struct mpv_node_list) };
+        struct mpv_node_list *list = args.u.list;
+        for (int n = 0; n < m->num_args; n++)
+            MP_TARRAY_APPEND(tmp, list->values, list->num, node_str(m->args[n]));
+        map_add(tmp, &msg, "args", args);
+        break;
+    }
+    case MPV_EVENT_SCRIPT_INPUT_DISPATCH: {
+        mpv_event_script_input_dispatch *m = event->data;
+        map_add(tmp, &msg, "arg0", node_int(m->arg0));
+        map_add(tmp, &msg, "type", node_str(m->type));
+        break;
+    }
+    case MPV_EVENT_END_FILE: {
+        mpv_event_end_file *m = event->data;
+        if (m)
+            map_add(tmp, &msg, "reason", node_int(m->reason));
+        break;
+    }
+    case MPV_EVENT_PROPERTY_CHANGE: {
+        mpv_event_property *prop = event->data;
+        map_add(tmp, &msg, "id", node_int(event->reply_userdata));
+        map_add(tmp, &msg, "name", node_str(prop->name));
+        switch (prop->format) {
+        case MPV_FORMAT_NODE:
+            map_add(tmp, &msg, "data", *(mpv_node *)prop->data);
+            break;
+        case MPV_FORMAT_STRING:
+            map_add(tmp, &msg, "data", node_str(*(char **)prop->data));
+            break;
+        default:
+            map_add(tmp, &msg, "data", (mpv_node){ .format = MPV_FORMAT_NONE });
+        }
+        break;
+    }
+    default: ;
+    }
+
+    if (json_write(arg, &arg->out, &msg) < 0)
+        MP_ERR(arg, "Could not serialize event.\n");
+    bstr_xappend(arg, &arg->out, bstr0("\n"));
+    talloc_free(tmp);
+}
+
+static void handle_event(struct client_arg *arg, mpv_event *event)
+{
+    switch (event->event_id) {
+    case MPV_EVENT_GET_PROPERTY_REPLY: {
+        mpv_event_property *prop = event->data;
+        mpv_node data = { .format = MPV_FORMAT_NONE };
+        if (event->error >= 0 && prop->format == MPV_FORMAT_NODE) {
+            data = *(mpv_node *)prop->data;
+        } else if (event->error >= 0 && prop->format == MPV_FORMAT_STRING) {
+            data = node_str(*(char **)prop->data);
+        }
+        append_reply(arg, event->reply_userdata, event->error,
+                     event->error >= 0 ? &data : NULL);
+        break;
+    }
+    case MPV_EVENT_SET_PROPERTY_REPLY:
+    case MPV_EVENT_COMMAND_REPLY:
+        append_reply(arg, event->reply_userdata, event->error, NULL);
+        break;
+    default:
+        append_event(arg, event);
+    }
+}
+
+static mpv_event_id find_event(const char *name)
+{
+    for (int n = 0; n < 64; n++) {
+        const char *ev = mpv_event_name(n);
+        if (ev && strcmp(ev, name) == 0)
+            return n;
+    }
+    return -1;
+}
+
+static int enable_event(struct mpv_handle *client, const char *name, int enable)
+{
+    if (strcmp(name, "all") == 0) {
+        for (int n = 0; n < 64; n++) {
+            if (mpv_event_name(n))
+                mpv_request_event(client, n, enable);
+        }
+        return 0;
+    }
+    mpv_event_id ev = find_event(name);
+    if (ev < 0)
+        return MPV_ERROR_INVALID_PARAMETER;
+    return mpv_request_event(client, ev, enable);
+}
+
+static bool is_str(struct mpv_node_list *args, int n)
+{
+    return n < args->num && args->values[n].format == MPV_FORMAT_STRING;
+}
+
+static bool is_int(struct mpv_node_list *args, int n)
+{
+    return n < args->num && args->values[n].format == MPV_FORMAT_INT64;
+}
+
+#define ARG_STR(n) (args->values[n].u.string)
+#define ARG_INT(n) (args->values[n].u.int64)
+
+// Run a single request. Asynchronous requests reply via events later; for
+// everything else, a reply is appended directly.
+static void handle_request(struct client_arg *arg, bstr line)
+{
+    struct mpv_handle *client = arg->client;
+    void *tmp = talloc_new(NULL);
+    char *src = bstrdup0(tmp, line);
+    int64_t request_id = 0;
+    int err = MPV_ERROR_INVALID_PARAMETER;
+    bool async = false; // reply is sent by handle_event()
+    mpv_node *reply_data = NULL;
+
+    mpv_node msg;
+    if (json_parse(tmp, &msg, &src, MP_JSON_DEFAULT_MAX_DEPTH) < 0 || *src) {
+        MP_ERR(arg, "Malformed JSON received.\n");
+        goto reply;
+    }
+    if (msg.format != MPV_FORMAT_NODE_MAP) {
+        MP_ERR(arg, "Request is not a JSON object.\n");
+        goto reply;
+    }
+
+    struct mpv_node_list *args = NULL;
+    struct mpv_node_list *map = msg.u.list;
+    for (int n = 0; n < map->num; n++) {
+        mpv_node *val = &map->values[n];
+        if (strcmp(map->keys[n], "request_id") == 0 &&
+            val->format == MPV_FORMAT_INT64)
+            request_id = val->u.int64;
+        if (strcmp(map->keys[n], "command") == 0 &&
+            val->format == MPV_FORMAT_NODE_ARRAY)
+            args = val->u.list;
+    }
+    if (!args || !is_str(args, 0)) {
+        MP_ERR(arg, "Request has no valid command array.\n");
+        goto reply;
+    }
+
+    const char *cmd = ARG_STR(0);
+    if (strcmp(cmd, "client_name") == 0) {
+        reply_data = talloc_ptrtype(tmp, reply_data);
+        *reply_data = node_str(mpv_client_name(client));
+        err = 0;
+    } else if (strcmp(cmd, "get_time_us") == 0) {
+        reply_data = talloc_ptrtype(tmp, reply_data);
+        *reply_data = node_int(mpv_get_time_us(client));
+        err = 0;
+    } else if (strcmp(cmd, "get_property") == 0 && is_str(args, 1)) {
+        async = true;
+        err = mpv_get_property_async(client, request_id, ARG_STR(1),
+                                     MPV_FORMAT_NODE);
+    } else if (strcmp(cmd, "get_property_string") == 0 && is_str(args, 1)) {
+        async = true;
+        err = mpv_get_property_async(client, request_id, ARG_STR(1),
+                                     MPV_FORMAT_STRING);
+    } else if (strcmp(cmd, "set_property") == 0 && is_str(args, 1) &&
+               args->num == 3)
+    {
+        async = true;
+        err = mpv_set_property_async(client, request_id, ARG_STR(1),
+                                     MPV_FORMAT_NODE, &args->values[2]);
+    } else if (strcmp(cmd, "set_property_string") == 0 && is_str(args, 1) &&
+               is_str(args, 2))
+    {
+        async = true;
+        err = mpv_set_property_async(client, request_id, ARG_STR(1),
+                                     MPV_FORMAT_STRING, &ARG_STR(2));
+    } else if (strcmp(cmd, "observe_property") == 0 && is_int(args, 1) &&
+               is_str(args, 2))
+    {
+        err = mpv_observe_property(client, ARG_INT(1), ARG_STR(2),
+                                   MPV_FORMAT_NODE);
+    } else if (strcmp(cmd, "observe_property_string") == 0 &&
+               is_int(args, 1) && is_str(args, 2))
+    {
+        err = mpv_observe_property(client, ARG_INT(1), ARG_STR(2),
+                                   MPV_FORMAT_STRING);
+    } else if (strcmp(cmd, "unobserve_property") == 0 && is_int(args, 1)) {
+        err = mpv_unobserve_property(client, ARG_INT(1));
+        err = err < 0 ? err : 0;
+    } else if (strcmp(cmd, "request_log_messages") == 0 && is_str(args, 1)) {
+        err = mpv_request_log_messages(client, ARG_STR(1));
+    } else if (strcmp(cmd, "enable_event") == 0 && is_str(args, 1)) {
+        err = enable_event(client, ARG_STR(1), 1);
+    } else if (strcmp(cmd, "disable_event") == 0 && is_str(args, 1)) {
+        err = enable_event(client, ARG_STR(1), 0);
+    } else if (strcmp(cmd, "suspend") == 0) {
+        if (!arg->suspended)
+            mpv_suspend(client);
+        arg->suspended = true;
+        err = 0;
+    } else if (strcmp(cmd, "resume") == 0) {
+        if (arg->suspended)
+            mpv_resume(client);
+        arg->suspended = false;
+        err = 0;
+    } else {
+        // Normal input command. All arguments must be strings.
+        const char **cmd_args = talloc_zero_array(tmp, const char *,
+                                                  args->num + 1);
+        for (int n = 0; n < args->num; n++) {
+            if (!is_str(args, n))
+                goto reply;
+            cmd_args[n] = ARG_STR(n);
+        }
+        async = true;
+        err = mpv_command_async(client, request_id, cmd_args);
+    }
+
+    if (async && err >= 0)
+        goto done;
+
+reply:
+    append_reply(arg, request_id, err, reply_data);
+done:
+    talloc_free(tmp);
+}
+
+static void handle_input(struct client_arg *arg)
+{
+    bstr rest = arg->in;
+    while (1) {
+        int nl = bstrchr(rest, '\n');
+        if (nl < 0)
+            break;
+        bstr line = bstr_strip(bstr_splice(rest, 0, nl));
+        rest = bstr_cut(rest, nl + 1);
+        if (line.len)
+            handle_request(arg, line);
+    }
+    // Move the incomplete tail to the front.
+    memmove(arg->in.start, rest.start, rest.len);
+    arg->in.len = rest.len;
+    if (arg->in.len >= MAX_REQUEST_SIZE) {
+        MP_ERR(arg, "Request too large, dropping data.\n");
+        arg->in.len = 0;
+    }
+}
+
+// Returns false if the connection broke.
+static bool flush_output(struct client_arg *arg)
+{
+    while (arg->out_pos < arg->out.len) {
+        ssize_t r = write(arg->client_fd, arg->out.start + arg->out_pos,
+                          arg->out.len - arg->out_pos);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return true;
+            return false;
+        }
+        arg->out_pos += r;
+    }
+    arg->out.len = arg->out_pos = 0;
+    return true;
+}
+
+static void *client_thread(void *p)
+{
+    pthread_detach(pthread_self());
+
+    struct client_arg *arg = p;
+    bool shutdown = false;
+
+    MP_VERBOSE(arg, "Client connected.\n");
+
+    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
+    if (pipe_fd < 0) {
+        MP_ERR(arg, "Could not get wakeup pipe.\n");
+        goto done;
+    }
+
+    struct pollfd fds[2] = {
+        { .fd = pipe_fd, .events = POLLIN },
+        { .fd = arg->client_fd, .events = POLLIN },
+    };
+
+    while (!shutdown) {
+        fds[1].events = 0;
+        if (arg->out.len - arg->out_pos < MAX_OUTPUT_BACKLOG)
+            fds[1].events |= POLLIN;
+        if (arg->out_pos < arg->out.len)
+            fds[1].events |= POLLOUT;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            MP_ERR(arg, "Poll error: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char discard[100];
+            (void)read(pipe_fd, discard, sizeof(discard));
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char buf[4096];
+            ssize_t r = read(arg->client_fd, buf, sizeof(buf));
+            if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+                break;
+            if (r > 0) {
+                bstr_xappend(arg, &arg->in, (bstr){(unsigned char *)buf, r});
+                handle_input(arg);
+            }
+        } else if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            break;
+        }
+
+        // Collect all pending events and replies, then write them at once.
+        // A client which doesn't read its socket would make this grow
+        // without bound, so drop it once the backlog can't be written.
+        while (1) {
+            if (arg->out.len - arg->out_pos >= MAX_OUTPUT_BACKLOG) {
+                if (!flush_output(arg))
+                    goto done;
+                if (arg->out.len - arg->out_pos >= MAX_OUTPUT_BACKLOG) {
+                    MP_ERR(arg, "Client is not reading its output, "
+                           "disconnecting.\n");
+                    goto done;
+                }
+            }
+            mpv_event *event = mpv_wait_event(arg->client, 0);
+            if (event->event_id == MPV_EVENT_NONE)
+                break;
+            if (event->event_id == MPV_EVENT_SHUTDOWN)
+                shutdown = true;
+            handle_event(arg, event);
+        }
+
+        if (!flush_output(arg))
+            break;
+    }
+
+done:
+    MP_VERBOSE(arg, "Client disconnected.\n");
+    if (arg->suspended)
+        mpv_resume(arg->client);
+    close(arg->client_fd);
+    mpv_destroy(arg->client);
+    talloc_free(arg);
+    return NULL;
+}
+
+static void ipc_start_client(struct mp_ipc_ctx *ctx, int id, int fd)
+{
+    struct client_arg *arg = talloc_ptrtype(NULL, arg);
+    *arg = (struct client_arg){
+        .client_fd = fd,
+    };
+
+    char *name = talloc_asprintf(arg, "ipc-%d", id);
+    arg->client = mp_new_client(ctx->client_api, name);
+    if (!arg->client)
+        goto err;
+    arg->log = mp_client_get_log(arg->client);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        goto err;
+
+    pthread_t client_thr;
+    if (pthread_create(&client_thr, NULL, client_thread, arg))
+        goto err;
+
+    return;
+
+err:
+    if (arg->client)
+        mpv_destroy(arg->client);
+    close(fd);
+    talloc_free(arg);
+}
+
+static void *ipc_thread(void *p)
+{
+    int rc;
+
+    int ipc_fd;
+    struct sockaddr_un ipc_un = {0};
+
+    struct mp_ipc_ctx *arg = p;
+
+    MP_VERBOSE(arg, "Starting IPC master\n");
+
+    ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ipc_fd < 0) {
+        MP_ERR(arg, "Could not create IPC socket\n");
+        goto done;
+    }
+    mp_set_cloexec(ipc_fd);
+
+    size_t path_len = strlen(arg->path);
+    if (path_len >= sizeof(ipc_un.sun_path) - 1) {
+        MP_ERR(arg, "Could not create IPC socket: path too long\n");
+        goto done;
+    }
+
+    ipc_un.sun_family = AF_UNIX;
+    strncpy(ipc_un.sun_path, arg->path, sizeof(ipc_un.sun_path) - 1);
+
+    unlink(ipc_un.sun_path);
+
+    rc = bind(ipc_fd, (struct sockaddr *)&ipc_un, sizeof(ipc_un));
+    if (rc < 0) {
+        MP_ERR(arg, "Could not bind IPC socket: %s\n", strerror(errno));
+        goto done;
+    }
+
+    rc = listen(ipc_fd, 10);
+    if (rc < 0) {
+        MP_ERR(arg, "Could not listen on IPC socket: %s\n", strerror(errno));
+        goto done;
+    }
+
+    int client_num = 0;
+
+    struct pollfd fds[2] = {
+        { .events = POLLIN, .fd = arg->death_pipe[0] },
+        { .events = POLLIN, .fd = ipc_fd },
+    };
+
+    while (1) {
+        rc = poll(fds, 2, -1);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            MP_ERR(arg, "Poll error\n");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            break;
+
+        if (fds[1].revents & POLLIN) {
+            int client_fd = accept(ipc_fd, NULL, NULL);
+            if (client_fd < 0) {
+                MP_ERR(arg, "Could not accept IPC client\n");
+                continue;
+            }
+            mp_set_cloexec(client_fd);
+
+            ipc_start_client(arg, client_num++, client_fd);
+        }
+    }
+
+done:
+    if (ipc_fd >= 0) {
+        close(ipc_fd);
+        unlink(arg->path);
+    }
+
+    return NULL;
+}
+
+struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
+                               struct mpv_global *global)
+{
+    struct MPOpts *opts = global->opts;
+
+    if (!opts->input.ipc_path || !*opts->input.ipc_path)
+        return NULL;
+
+    struct mp_ipc_ctx *arg = talloc_ptrtype(NULL, arg);
+    *arg = (struct mp_ipc_ctx){
+        .log        = mp_log_new(arg, global->log, "ipc"),
+        .client_api = client_api,
+        .path       = mp_get_user_path(arg, global, opts->input.ipc_path),
+        .death_pipe = {-1, -1},
+    };
+
+    if (pipe(arg->death_pipe) < 0)
+        goto out;
+    for (int n = 0; n < 2; n++)
+        mp_set_cloexec(arg->death_pipe[n]);
+
+    if (pthread_create(&arg->thread, NULL, ipc_thread, arg))
+        goto out;
+
+    return arg;
+
+out:
+    MP_ERR(arg, "Could not start IPC server.\n");
+    if (arg->death_pipe[0] >= 0) {
+        close(arg->death_pipe[0]);
+        close(arg->death_pipe[1]);
+    }
+    talloc_free(arg);
+    return NULL;
+}
+
+void mp_uninit_ipc(struct mp_ipc_ctx *arg)
+{
+    if (!arg)
+        return;
+
+    write(arg->death_pipe[1], &(char){0}, 1);
+    pthread_join(arg->thread, NULL);
+
+    close(arg->death_pipe[0]);
+    close(arg->death_pipe[1]);
+    talloc_free(arg);
+}
@@ -0,0 +1,16 @@
+#ifndef MP_INPUT_IPC_H
+#define MP_INPUT_IPC_H
+
+struct mp_ipc_ctx;
+struct mp_client_api;
+struct mpv_global;
+
+// Start the JSON IPC server if --input-unix-socket is set. Returns NULL if
+// it's disabled or could not be started.
+struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
+                               struct mpv_global *global);
+// Stop accepting connections. Connected clients disconnect on shutdown like
+// any other client.
+void mp_uninit_ipc(struct mp_ipc_ctx *ctx);
+
+#endif
@@ -20,6 +20,8 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -202,35 +204,59 @@ bstr mp_charset_guess_and_conv_to_utf8(struct mp_log *log, bstr buf,
                             flags);
 }
 
-// Use iconv to convert buf to UTF-8.
-// Returns buf.start==NULL on error. Returns buf if cp is NULL, or if there is
-// obviously no conversion required (e.g. if cp is "UTF-8").
-// Returns a newly allocated buffer if conversion is done and succeeds. The
-// buffer will be terminated with 0 for convenience (the terminating 0 is not
-// included in the returned length).
-// Free the returned buffer with talloc_free().
-//  buf: input data
-//  cp: iconv codepage (or NULL)
-//  flags: combination of MP_ICONV_* flags
-//  returns: buf (no conversion), .start==NULL (error), or allocated buffer
-bstr mp_iconv_to_utf8(struct mp_log *log, bstr buf, const char *cp, int flags)
-{
+enum conv_mode {
+    CONV_NONE,      // no conversion
+    CONV_FAIL,      // conversion impossible, always return an error
+    CONV_BROKEN,    // UTF-8-BROKEN
+    CONV_ICONV,
+};
+
+struct mp_charset_conv {
+    struct mp_log *log;
+    char *cp;
+    int flags;
+    enum conv_mode mode;
+    int ascii_compatible;   // -1: not checked yet
 #if HAVE_ICONV
-    if (!cp || !cp[0] || mp_charset_is_utf8(cp))
-        return buf;
-
-    if (strcasecmp(cp, "ASCII") == 0)
-        return buf;
+    iconv_t icdsc;
+#endif
+};
 
-    if (strcasecmp(cp, "UTF-8-BROKEN") == 0)
-        return bstr_sanitize_utf8_latin1(NULL, buf);
+// Bytes which ASCII compatible charsets map to the same character. Excludes the
+// control characters used for switching state in ISO-2022 and similar
+// encodings.
+static bool is_plain_ascii_byte(unsigned char c)
+{
+    return c && c < 0x80 && c != 0x0E && c != 0x0F && c != 0x1B;
+}
 
-    iconv_t icdsc;
-    if ((icdsc = iconv_open("UTF-8", cp)) == (iconv_t) (-1)) {
-        if (flags & MP_ICONV_VERBOSE)
-            mp_err(log, "Error opening iconv with codepage '%s'\n", cp);
-        goto failure;
+static bool is_plain_ascii(bstr buf)
+{
+    size_t n = 0;
+    for (; n + 8 <= buf.len; n += 8) {
+        uint64_t v;
+        memcpy(&v, buf.start + n, 8);
+        if (v & 0x8080808080808080ULL)
+            return false;
+        // Only look at single bytes if there is a byte < 0x20.
+        if ((v - 0x2020202020202020ULL) & ~v & 0x8080808080808080ULL) {
+            for (int i = 0; i < 8; i++) {
+                if (!is_plain_ascii_byte(buf.start[n + i]))
+                    return false;
+            }
+        }
     }
+    for (; n < buf.len; n++) {
+        if (!is_plain_ascii_byte(buf.start[n]))
+            return false;
+    }
+    return true;
+}
+
+#if HAVE_ICONV
+static bstr iconv_convert(struct mp_charset_conv *conv, bstr buf, int flags)
+{
+    iconv_t icdsc = conv->icdsc;
 
     size_t size = buf.len;
     size_t osize = size;
@@ -267,22 +293,125 @@ bstr mp_iconv_to_utf8(struct mp_log *log, bstr buf, const char *cp, int flags)
                         break;
                 }
                 if (flags & MP_ICONV_VERBOSE) {
-                    mp_err(log, "Error recoding text with codepage '%s'\n", cp);
+                    mp_err(conv->log, "Error recoding text with codepage '%s'\n",
+                           conv->cp);
                 }
                 talloc_free(outbuf);
-                iconv_close(icdsc);
-                goto failure;
+                iconv(icdsc, NULL, NULL, NULL, NULL); // reset for reuse
+                return (bstr){0};
             }
         } else if (clear)
             break;
     }
 
-    iconv_close(icdsc);
+    iconv(icdsc, NULL, NULL, NULL, NULL);
 
     outbuf[osize - oleft - 1] = 0;
     return (bstr){outbuf, osize - oleft - 1};
+}
+
+static void destroy_conv(void *ptr)
+{
+    struct mp_charset_conv *conv = ptr;
+    if (conv->mode == CONV_ICONV)
+        iconv_close(conv->icdsc);
+}
+#endif
+
+// Create a converter for repeated mp_charset_conv_to_utf8() calls with the
+// same codepage, which keeps the iconv context open. Free it with
+// talloc_free().
+//  cp: iconv codepage (or NULL)
+//  flags: combination of MP_ICONV_* flags
+struct mp_charset_conv *mp_charset_conv_create(void *ta_parent,
+                                               struct mp_log *log,
+                                               const char *cp, int flags)
+{
+    struct mp_charset_conv *conv = talloc_ptrtype(ta_parent, conv);
+    *conv = (struct mp_charset_conv){
+        .log = log,
+        .cp = talloc_strdup(conv, cp),
+        .flags = flags,
+        .mode = CONV_FAIL,
+        .ascii_compatible = -1,
+    };
+#if HAVE_ICONV
+    if (!cp || !cp[0] || mp_charset_is_utf8(cp) || strcasecmp(cp, "ASCII") == 0)
+    {
+        conv->mode = CONV_NONE;
+    } else if (strcasecmp(cp, "UTF-8-BROKEN") == 0) {
+        conv->mode = CONV_BROKEN;
+        conv->ascii_compatible = 1;
+    } else if ((conv->icdsc = iconv_open("UTF-8", cp)) != (iconv_t) (-1)) {
+        conv->mode = CONV_ICONV;
+        talloc_set_destructor(conv, destroy_conv);
+    } else if (flags & MP_ICONV_VERBOSE) {
+        mp_err(log, "Error opening iconv with codepage '%s'\n", cp);
+    }
+#endif
+    return conv;
+}
+
+#if HAVE_ICONV
+// Check whether the codepage maps plain ASCII text to itself.
+static bool check_ascii_compatible(struct mp_charset_conv *conv)
+{
+    char probe[128];
+    int len = 0;
+    for (int c = 0; c < 128; c++) {
+        if (is_plain_ascii_byte(c))
+            probe[len++] = c;
+    }
+    bstr in = {probe, len};
+    bstr res = iconv_convert(conv, in, 0);
+    bool ok = res.start && bstr_equals(res, in);
+    talloc_free(res.start);
+    return ok;
+}
 #endif
 
-failure:
+// Same as mp_iconv_to_utf8(), using the codepage and flags conv was created
+// with. Text that consists of plain ASCII only is returned unchanged without
+// calling iconv, if the codepage is ASCII compatible.
+bstr mp_charset_conv_to_utf8(struct mp_charset_conv *conv, bstr buf)
+{
+#if HAVE_ICONV
+    if (conv->mode == CONV_NONE)
+        return buf;
+    if (conv->mode == CONV_FAIL)
+        return (bstr){0};
+
+    if (is_plain_ascii(buf)) {
+        if (conv->ascii_compatible < 0)
+            conv->ascii_compatible = check_ascii_compatible(conv);
+        if (conv->ascii_compatible)
+            return buf;
+    }
+
+    if (conv->mode == CONV_BROKEN)
+        return bstr_sanitize_utf8_latin1(NULL, buf);
+
+    return iconv_convert(conv, buf, conv->flags);
+#else
     return (bstr){0};
+#endif
+}
+
+// Use iconv to convert buf to UTF-8.
+// Returns buf.start==NULL on error. Returns buf if cp is NULL, or if there is
+// obviously no conversion required (e.g. if cp is "UTF-8").
+// Returns a newly allocated buffer if conversion is done and succeeds. The
+// buffer will be terminated with 0 for convenience (the terminating 0 is not
+// included in the returned length).
+// Free the returned buffer with talloc_free().
+//  buf: input data
+//  cp: iconv codepage (or NULL)
+//  flags: combination of MP_ICONV_* flags
+//  returns: buf (no conversion), .start==NULL (error), or allocated buffer
+bstr mp_iconv_to_utf8(struct mp_log *log, bstr buf, const char *cp, int flags)
+{
+    struct mp_charset_conv *conv = mp_charset_conv_create(NULL, log, cp, flags);
+    bstr res = mp_charset_conv_to_utf8(conv, buf);
+    talloc_free(conv);
+    return res;
 }
@@ -20,4 +20,10 @@ bstr mp_charset_guess_and_conv_to_utf8(struct mp_log *log, bstr buf,
                                        const char *user_cp, int flags);
 bstr mp_iconv_to_utf8(struct mp_log *log, bstr buf, const char *cp, int flags);
 
+struct mp_charset_conv;
+struct mp_charset_conv *mp_charset_conv_create(void *ta_parent,
+                                               struct mp_log *log,
+                                               const char *cp, int flags);
+bstr mp_charset_conv_to_utf8(struct mp_charset_conv *conv, bstr buf);
+
 #endif
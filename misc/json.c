@@ -0,0 +1,313 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* JSON parser and writer operating on mpv_node.
+ *
+ * The parser accepts standard JSON. Numbers without fraction or exponent
+ * are returned as MPV_FORMAT_INT64, all others as MPV_FORMAT_DOUBLE. "null"
+ * maps to MPV_FORMAT_NONE. Object keys must be unique only in the sense that
+ * later duplicates are returned as additional entries.
+ *
+ * The writer escapes control characters and '"' and '\', and leaves all other
+ * bytes (including UTF-8 sequences) untouched.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "common/common.h"
+#include "talloc.h"
+
+#include "json.h"
+
+static bool eat_c(char **s, char c)
+{
+    if (**s == c) {
+        *s += 1;
+        return true;
+    }
+    return false;
+}
+
+void json_skip_whitespace(char **src)
+{
+    while (**src == ' ' || **src == '\t' || **src == '\n' || **src == '\r')
+        *src += 1;
+}
+
+static bool eat_word(char **src, const char *word)
+{
+    size_t len = strlen(word);
+    if (strncmp(*src, word, len) != 0)
+        return false;
+    *src += len;
+    return true;
+}
+
+static int read_hex4(char **src)
+{
+    int res = 0;
+    for (int n = 0; n < 4; n++) {
+        char c = **src;
+        int v;
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v = c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        res = res * 16 + v;
+        *src += 1;
+    }
+    return res;
+}
+
+static int read_str(void *ta_parent, struct mpv_node *dst, char **src)
+{
+    if (!eat_c(src, '"'))
+        return -1;
+    bstr str = {0};
+    bstr_xappend(ta_parent, &str, bstr0(""));
+    while (1) {
+        // Copy runs of unescaped characters at once.
+        char *run = *src;
+        while (**src && **src != '"' && **src != '\\')
+            *src += 1;
+        if (*src != run) {
+            bstr_xappend(ta_parent, &str,
+                         (bstr){(unsigned char *)run, *src - run});
+        }
+        if (eat_c(src, '"'))
+            break;
+        if (!eat_c(src, '\\'))
+            return -1; // unterminated string
+        char c = **src;
+        *src += 1;
+        switch (c) {
+        case '"':  bstr_xappend(ta_parent, &str, bstr0("\"")); break;
+        case '\\': bstr_xappend(ta_parent, &str, bstr0("\\")); break;
+        case '/':  bstr_xappend(ta_parent, &str, bstr0("/"));  break;
+        case 'b':  bstr_xappend(ta_parent, &str, bstr0("\b")); break;
+        case 'f':  bstr_xappend(ta_parent, &str, bstr0("\f")); break;
+        case 'n':  bstr_xappend(ta_parent, &str, bstr0("\n")); break;
+        case 'r':  bstr_xappend(ta_parent, &str, bstr0("\r")); break;
+        case 't':  bstr_xappend(ta_parent, &str, bstr0("\t")); break;
+        case 'u': {
+            int cp = read_hex4(src);
+            if (cp < 0)
+                return -1;
+            // UTF-16 surrogate pair
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                if (!eat_c(src, '\\') || !eat_c(src, 'u'))
+                    return -1;
+                int lo = read_hex4(src);
+                if (lo < 0xDC00 || lo > 0xDFFF)
+                    return -1;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            }
+            mp_append_utf8_bstr(ta_parent, &str, cp);
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    dst->format = MPV_FORMAT_STRING;
+    dst->u.string = (char *)str.start;
+    return 0;
+}
+
+static int read_number(struct mpv_node *dst, char **src)
+{
+    char *start = *src;
+    bool is_float = false;
+    eat_c(src, '-');
+    while ((**src >= '0' && **src <= '9') || **src == '.' || **src == 'e' ||
+           **src == 'E' || **src == '+' || **src == '-')
+    {
+        if (**src == '.' || **src == 'e' || **src == 'E')
+            is_float = true;
+        *src += 1;
+    }
+    if (*src == start)
+        return -1;
+    char *end;
+    if (!is_float) {
+        errno = 0;
+        long long v = strtoll(start, &end, 10);
+        if (end == *src && errno == 0) {
+            dst->format = MPV_FORMAT_INT64;
+            dst->u.int64 = v;
+            return 0;
+        }
+    }
+    double d = strtod(start, &end);
+    if (end != *src)
+        return -1;
+    dst->format = MPV_FORMAT_DOUBLE;
+    dst->u.double_ = d;
+    return 0;
+}
+
+static int read_sub(void *ta_parent, struct mpv_node *dst, char **src,
+                    int max_depth)
+{
+    bool is_arr = eat_c(src, '[');
+    bool is_obj = !is_arr && eat_c(src, '{');
+    if (!is_arr && !is_obj)
+        return -1;
+    if (max_depth <= 0)
+        return -1;
+    char term = is_obj ? '}' : ']';
+    struct mpv_node_list *list = talloc_zero(ta_parent, struct mpv_node_list);
+    while (1) {
+        json_skip_whitespace(src);
+        if (eat_c(src, term))
+            break;
+        if (list->num > 0 && !eat_c(src, ','))
+            return -1;
+        json_skip_whitespace(src);
+        if (is_obj) {
+            struct mpv_node keynode;
+            if (read_str(list, &keynode, src) < 0)
+                return -1;
+            json_skip_whitespace(src);
+            if (!eat_c(src, ':'))
+                return -1;
+            json_skip_whitespace(src);
+            MP_TARRAY_GROW(list, list->keys, list->num);
+            list->keys[list->num] = keynode.u.string;
+        }
+        MP_TARRAY_GROW(list, list->values, list->num);
+        if (json_parse(list, &list->values[list->num], src, max_depth - 1) < 0)
+            return -1;
+        list->num++;
+    }
+    dst->format = is_obj ? MPV_FORMAT_NODE_MAP : MPV_FORMAT_NODE_ARRAY;
+    dst->u.list = list;
+    return 0;
+}
+
+int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth)
+{
+    json_skip_whitespace(src);
+    int r = -1;
+    char c = **src;
+    if (eat_word(src, "null")) {
+        dst->format = MPV_FORMAT_NONE;
+        r = 0;
+    } else if (eat_word(src, "true")) {
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = 1;
+        r = 0;
+    } else if (eat_word(src, "false")) {
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = 0;
+        r = 0;
+    } else if (c == '"') {
+        r = read_str(ta_parent, dst, src);
+    } else if (c == '[' || c == '{') {
+        r = read_sub(ta_parent, dst, src, max_depth);
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        r = read_number(dst, src);
+    }
+    if (r >= 0)
+        json_skip_whitespace(src);
+    return r;
+}
+
+static void write_json_str(void *ta_parent, bstr *dst, const char *str)
+{
+    bstr_xappend(ta_parent, dst, bstr0("\""));
+    while (1) {
+        const char *run = str;
+        while (*str && *str != '"' && *str != '\\' &&
+               (unsigned char)*str >= 0x20)
+            str++;
+        if (str != run) {
+            bstr_xappend(ta_parent, dst,
+                         (bstr){(unsigned char *)run, str - run});
+        }
+        if (!*str)
+            break;
+        switch (*str) {
+        case '"':  bstr_xappend(ta_parent, dst, bstr0("\\\"")); break;
+        case '\\': bstr_xappend(ta_parent, dst, bstr0("\\\\")); break;
+        case '\n': bstr_xappend(ta_parent, dst, bstr0("\\n"));  break;
+        case '\r': bstr_xappend(ta_parent, dst, bstr0("\\r"));  break;
+        case '\t': bstr_xappend(ta_parent, dst, bstr0("\\t"));  break;
+        default:
+            bstr_xappend_asprintf(ta_parent, dst, "\\u%04x",
+                                  (unsigned char)*str);
+        }
+        str++;
+    }
+    bstr_xappend(ta_parent, dst, bstr0("\""));
+}
+
+int json_write(void *ta_parent, bstr *dst, struct mpv_node *src)
+{
+    switch (src->format) {
+    case MPV_FORMAT_NONE:
+        bstr_xappend(ta_parent, dst, bstr0("null"));
+        return 0;
+    case MPV_FORMAT_FLAG:
+        bstr_xappend(ta_parent, dst, bstr0(src->u.flag ? "true" : "false"));
+        return 0;
+    case MPV_FORMAT_STRING:
+        write_json_str(ta_parent, dst, src->u.string);
+        return 0;
+    case MPV_FORMAT_INT64:
+        bstr_xappend_asprintf(ta_parent, dst, "%"PRId64, src->u.int64);
+        return 0;
+    case MPV_FORMAT_DOUBLE:
+        // JSON has no representation for these.
+        if (!isfinite(src->u.double_)) {
+            bstr_xappend(ta_parent, dst, bstr0("null"));
+            return 0;
+        }
+        bstr_xappend_asprintf(ta_parent, dst, "%.17g", src->u.double_);
+        return 0;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        struct mpv_node_list *list = src->u.list;
+        bool is_obj = src->format == MPV_FORMAT_NODE_MAP;
+        bstr_xappend(ta_parent, dst, bstr0(is_obj ? "{" : "["));
+        for (int n = 0; n < list->num; n++) {
+            if (n)
+                bstr_xappend(ta_parent, dst, bstr0(","));
+            if (is_obj) {
+                write_json_str(ta_parent, dst, list->keys[n]);
+                bstr_xappend(ta_parent, dst, bstr0(":"));
+            }
+            if (json_write(ta_parent, dst, &list->values[n]) < 0)
+                return -1;
+        }
+        bstr_xappend(ta_parent, dst, bstr0(is_obj ? "}" : "]"));
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
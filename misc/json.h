@@ -0,0 +1,43 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_JSON_H
+#define MP_JSON_H
+
+#include "bstr/bstr.h"
+#include "libmpv/client.h"
+
+// Reasonable default for max_depth.
+#define MP_JSON_DEFAULT_MAX_DEPTH 50
+
+/**
+ * Parse a single JSON value from *src into dst. All memory is allocated as
+ * talloc children of ta_parent. *src is advanced past the parsed value (and
+ * past trailing whitespace). Returns 0 on success, -1 on error.
+ */
+int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth);
+
+void json_skip_whitespace(char **src);
+
+/**
+ * Append the JSON representation of src to *dst (without trailing newline).
+ * dst->start must be allocated with talloc under ta_parent (or be NULL).
+ * Returns 0 on success, -1 if src contains values that can't be represented.
+ */
+int json_write(void *ta_parent, bstr *dst, struct mpv_node *src);
+
+#endif
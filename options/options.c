@@ -138,6 +138,7 @@ static const m_option_t pvropts_conf[]={
 extern const m_option_t dvbin_opts_conf[];
 extern const m_option_t lavfdopts_conf[];
 
+extern int sws_threads;
 extern int sws_chr_vshift;
 extern int sws_chr_hshift;
 extern float sws_chr_gblur;
@@ -232,6 +233,8 @@ const m_option_t mp_opts[] = {
 #if HAVE_LUA
     OPT_STRINGLIST("lua", lua_files, CONF_GLOBAL),
     OPT_KEYVALUELIST("lua-opts", lua_opts, M_OPT_GLOBAL),
+    OPT_INTRANGE("lua-suspend-limit", lua_suspend_limit, CONF_GLOBAL, 0, 60000),
+    OPT_FLAG("lua-suspend-resume", lua_suspend_resume, CONF_GLOBAL),
     OPT_FLAG("osc", lua_load_osc, CONF_GLOBAL),
     OPT_FLAG("load-scripts", auto_load_scripts, CONF_GLOBAL),
 #endif
@@ -345,6 +348,7 @@ const m_option_t mp_opts[] = {
     OPT_INTRANGE("audio-samplerate", force_srate, 0, 1000, 8*48000),
     OPT_CHMAP("audio-channels", audio_output_channels, CONF_MIN, .min = 0),
     OPT_AUDIOFORMAT("audio-format", audio_output_format, 0),
+    OPT_FLAG("audio-thread", audio_thread, 0),
     OPT_DOUBLE("speed", playback_speed, M_OPT_RANGE | M_OPT_FIXED,
                .min = 0.01, .max = 100.0),
 
@@ -356,6 +360,10 @@ const m_option_t mp_opts[] = {
     OPT_SETTINGSLIST("af-defaults", af_defs, 0, &af_obj_list),
     OPT_SETTINGSLIST("af*", af_settings, M_OPT_FIXED, &af_obj_list),
     OPT_SETTINGSLIST("vf-defaults", vf_defs, 0, &vf_obj_list),
+    // must come before "vf*"
+    OPT_CHOICE("vf-arena", vf_arena, 0,
+               ({"no", 0}, {"yes", 1}, {"hugepages", 2})),
+    OPT_INTRANGE("vf-pipeline", vf_pipeline, 0, 0, 16),
     OPT_SETTINGSLIST("vf*", vf_settings, M_OPT_FIXED, &vf_obj_list),
 
     OPT_CHOICE("deinterlace", deinterlace, M_OPT_OPTIONAL_PARAM | M_OPT_FIXED,
@@ -380,6 +388,7 @@ const m_option_t mp_opts[] = {
 
     // scaling:
     {"sws", &sws_flags, CONF_TYPE_INT, 0, 0, 2, NULL},
+    {"sws-threads", &sws_threads, CONF_TYPE_INT, CONF_RANGE, 0, 16, NULL},
     {"ssf", (void *) scaler_filter_conf, CONF_TYPE_SUBCONFIG, 0, 0, 0, NULL},
     // -1 means auto aspect (prefer container size until aspect change)
     //  0 means square pixels
@@ -414,6 +423,7 @@ const m_option_t mp_opts[] = {
     OPT_CHOICE("sub-auto", sub_auto, 0,
                ({"no", -1}, {"exact", 0}, {"fuzzy", 1}, {"all", 2})),
     OPT_INTRANGE("sub-pos", sub_pos, 0, 0, 100),
+    OPT_FLAG("sub-prerender", sub_prerender, 0),
     OPT_FLOATRANGE("sub-gauss", sub_gauss, 0, 0.0, 3.0),
     OPT_FLAG("sub-gray", sub_gray, 0),
     OPT_FLAG("sub-ass", ass_enabled, 0),
@@ -433,6 +443,7 @@ const m_option_t mp_opts[] = {
                ({"simple", 0}, {"complex", 1})),
     OPT_CHOICE("ass-style-override", ass_style_override, 0,
                ({"no", 0}, {"yes", 1}, {"force", 2})),
+    OPT_INTRANGE("ass-bitmap-cache", ass_bitmap_cache, 0, 0, 1024),
     OPT_FLAG("osd-bar", osd_bar_visible, 0),
     OPT_FLOATRANGE("osd-bar-align-x", osd_bar_align_x, 0, -1.0, +1.0),
     OPT_FLOATRANGE("osd-bar-align-y", osd_bar_align_y, 0, -1.0, +1.0),
@@ -444,6 +455,7 @@ const m_option_t mp_opts[] = {
 //---------------------- libao/libvo options ------------------------
     OPT_SETTINGSLIST("vo", vo.video_driver_list, 0, &vo_obj_list),
     OPT_SETTINGSLIST("vo-defaults", vo.vo_defs, 0, &vo_obj_list),
+    OPT_FLAG("vo-thread", vo.threaded, 0),
     OPT_SETTINGSLIST("ao", audio_driver_list, 0, &ao_obj_list),
     OPT_SETTINGSLIST("ao-defaults", ao_defs, 0, &ao_obj_list),
     OPT_FLAG("fixed-vo", fixed_vo, CONF_GLOBAL),
@@ -464,6 +476,7 @@ const m_option_t mp_opts[] = {
                 {"yes", 1}, {"", 1})),
     OPT_STRING("volume-restore-data", mixer_restore_volume_data, 0),
     OPT_FLAG("gapless-audio", gapless_audio, M_OPT_FIXED),
+    OPT_FLAG("prefetch-playlist", prefetch_playlist, 0),
 
     OPT_GEOMETRY("geometry", vo.geometry, 0),
     OPT_SIZE_BOX("autofit", vo.autofit, 0),
@@ -683,6 +696,7 @@ const struct MPOpts mp_default_opts = {
     .osd_scale_by_window = 1,
 #if HAVE_LUA
     .lua_load_osc = 1,
+    .lua_suspend_limit = 100,
 #endif
     .auto_load_scripts = 1,
     .loop_times = -1,
@@ -732,6 +746,7 @@ const struct MPOpts mp_default_opts = {
     .ass_vsfilter_blur_compat = 1,
     .ass_style_override = 1,
     .ass_shaper = 1,
+    .ass_bitmap_cache = 16,
     .use_embedded_fonts = 1,
     .suboverlap_enabled = 0,
 #if HAVE_ENCA
@@ -38,6 +38,8 @@ typedef struct mp_vo_opts {
     int force_window_position;
 
     int fs_missioncontrol;
+
+    int threaded;
 } mp_vo_opts;
 
 typedef struct MPOpts {
@@ -52,6 +54,8 @@ typedef struct MPOpts {
     char **reset_options;
     char **lua_files;
     char **lua_opts;
+    int lua_suspend_limit;
+    int lua_suspend_resume;
     int lua_load_osc;
     int auto_load_scripts;
 
@@ -65,6 +69,8 @@ typedef struct MPOpts {
     int volstep;
     float softvol_max;
     int gapless_audio;
+    int audio_thread;
+    int prefetch_playlist;
 
     mp_vo_opts vo;
 
@@ -157,6 +163,7 @@ typedef struct MPOpts {
     int audio_display;
     int sub_visibility;
     int sub_pos;
+    int sub_prerender;
     float sub_delay;
     float sub_fps;
     float sub_speed;
@@ -188,6 +195,8 @@ typedef struct MPOpts {
     int dtshd;
     double playback_speed;
     struct m_obj_settings *vf_settings, *vf_defs;
+    int vf_pipeline;
+    int vf_arena;
     struct m_obj_settings *af_settings, *af_defs;
     int deinterlace;
     float movie_aspect;
@@ -219,6 +228,7 @@ typedef struct MPOpts {
     int ass_style_override;
     int ass_hinting;
     int ass_shaper;
+    int ass_bitmap_cache;
 
     int hwdec_api;
     char *hwdec_codecs;
@@ -270,6 +280,7 @@ typedef struct MPOpts {
         int ar_rate;
         char *js_dev;
         char *in_file;
+        char *ipc_path;
         int use_joystick;
         int use_lirc;
         char *lirc_configfile;
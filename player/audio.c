@@ -21,6 +21,7 @@
 #include <inttypes.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "config.h"
 #include "talloc.h"
@@ -29,6 +30,7 @@
 #include "common/encode.h"
 #include "options/options.h"
 #include "common/common.h"
+#include "osdep/threads.h"
 
 #include "audio/mixer.h"
 #include "audio/audio.h"
@@ -371,6 +373,181 @@ static int audio_start_sync(struct MPContext *mpctx, int playsize)
     return audio_decode(d_audio, mpctx->ao_buffer, playsize);
 }
 
+/* The audio thread refills the AO while the playback thread is busy with
+ * things that can take long, like decoding or displaying a video frame.
+ * The playback thread normally holds audio_thread.lock, and only releases it
+ * with audio_thread_start_fill(). The demuxer is not thread-safe, so the
+ * thread decodes only packets queued with audio_prefetch_packets().
+ * Everything that involves A/V sync (initial sync, hr-seek, EOF handling) is
+ * still done by fill_audio_out_buffers() on the playback thread. */
+struct audio_thread {
+    struct MPContext *mpctx;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool terminate;
+    bool enabled;       // playback thread released the lock for refilling
+    // --- written by the audio thread, applied by audio_thread_stop_fill()
+    int played;         // samples written to the AO
+    double ao_pts;      // pts after the last written sample
+    int decode_res;     // audio_decode() failure, passed on to the core
+};
+
+static void audio_thread_refill(struct audio_thread *t)
+{
+    struct MPContext *mpctx = t->mpctx;
+    struct ao *ao = mpctx->ao;
+    struct mp_audio out_format;
+    ao_get_format(ao, &out_format);
+
+    int playsize = ao_get_space(ao);
+    if (playsize <= 0)
+        return;
+
+    int res = audio_decode(mpctx->d_audio, mpctx->ao_buffer, playsize);
+    if (res < 0) {
+        t->decode_res = res;
+        t->enabled = false;
+        return;
+    }
+
+    struct mp_audio data;
+    mp_audio_buffer_peek(mpctx->ao_buffer, &data);
+    data.samples = MPMIN(data.samples, playsize);
+    if (data.samples <= 0)
+        return;
+
+    double real_samplerate = out_format.rate / mpctx->opts->playback_speed;
+    double pts = written_audio_pts(mpctx);
+    int played = ao_play(ao, data.planes, data.samples, 0);
+    assert(played <= data.samples);
+    if (played > 0) {
+        mp_audio_buffer_skip(mpctx->ao_buffer, played);
+        t->played += played;
+        t->ao_pts = pts + played / real_samplerate;
+    }
+}
+
+static void *audio_thread_fn(void *arg)
+{
+    struct audio_thread *t = arg;
+    pthread_mutex_lock(&t->lock);
+    while (!t->terminate) {
+        double timeout = 10;
+        if (t->enabled) {
+            audio_thread_refill(t);
+            // Refill again when about half of the buffered audio was played.
+            timeout = MPCLAMP(ao_get_delay(t->mpctx->ao) / 2, 0.005, 0.1);
+        }
+        mpthread_cond_timedwait(&t->wakeup, &t->lock, timeout);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+static struct audio_thread *get_audio_thread(struct MPContext *mpctx)
+{
+    if (!mpctx->audio_thread) {
+        struct audio_thread *t = talloc_zero(NULL, struct audio_thread);
+        t->mpctx = mpctx;
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->wakeup, NULL);
+        // Held by the playback thread, except while refilling is allowed.
+        pthread_mutex_lock(&t->lock);
+        if (pthread_create(&t->thread, NULL, audio_thread_fn, t)) {
+            pthread_mutex_unlock(&t->lock);
+            pthread_cond_destroy(&t->wakeup);
+            pthread_mutex_destroy(&t->lock);
+            talloc_free(t);
+            return NULL;
+        }
+        mpctx->audio_thread = t;
+    }
+    return mpctx->audio_thread;
+}
+
+// Let the audio thread refill the AO until audio_thread_stop_fill() is called.
+// The caller must not touch audio decoding, the AO, or mpctx->delay/ao_pts
+// in between. Does nothing if the core has to manage audio output itself.
+void audio_thread_start_fill(struct MPContext *mpctx, double endpts)
+{
+    struct dec_audio *d_audio = mpctx->d_audio;
+    if (!mpctx->opts->audio_thread)
+        return;
+    if (!d_audio || !mpctx->ao || !mpctx->ao_buffer || ao_untimed(mpctx->ao))
+        return;
+    if (mpctx->paused || mpctx->restart_playback || mpctx->syncing_audio ||
+        mpctx->hrseek_active || endpts != MP_NOPTS_VALUE ||
+        mpctx->encode_lavc_ctx)
+        return;
+    struct audio_thread *t = get_audio_thread(mpctx);
+    if (!t || t->decode_res < 0)
+        return;
+
+    audio_prefetch_packets(d_audio, 0.5);
+    d_audio->queue_only = true;
+    t->enabled = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void audio_thread_stop_fill(struct MPContext *mpctx)
+{
+    struct audio_thread *t = mpctx->audio_thread;
+    if (!t || !mpctx->d_audio || !mpctx->d_audio->queue_only)
+        return;
+
+    pthread_mutex_lock(&t->lock);
+    t->enabled = false;
+    mpctx->d_audio->queue_only = false;
+    if (t->played) {
+        struct mp_audio out_format;
+        ao_get_format(mpctx->ao, &out_format);
+        double real_samplerate = out_format.rate / mpctx->opts->playback_speed;
+        mpctx->shown_aframes += t->played;
+        mpctx->delay += t->played / real_samplerate;
+        mpctx->ao_pts = t->ao_pts;
+        t->played = 0;
+    }
+}
+
+// Return the AO delay minus mpctx->delay, i.e. how much audio is buffered
+// beyond the current video frame. While the audio thread is refilling, the
+// samples it wrote are not in mpctx->delay yet; take them into account, and
+// read both under its lock so they are consistent.
+double get_audio_sync_delay(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct audio_thread *t = mpctx->audio_thread;
+    bool filling = t && mpctx->d_audio && mpctx->d_audio->queue_only;
+    if (filling)
+        pthread_mutex_lock(&t->lock);
+    double delay = opts->playback_speed * ao_get_delay(mpctx->ao) - mpctx->delay;
+    if (filling) {
+        struct mp_audio out_format;
+        ao_get_format(mpctx->ao, &out_format);
+        double real_samplerate = out_format.rate / opts->playback_speed;
+        delay -= t->played / real_samplerate;
+        pthread_mutex_unlock(&t->lock);
+    }
+    return delay;
+}
+
+void uninit_audio_thread(struct MPContext *mpctx)
+{
+    struct audio_thread *t = mpctx->audio_thread;
+    if (!t)
+        return;
+    t->terminate = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+    mpctx->audio_thread = NULL;
+}
+
 int fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -402,7 +579,12 @@ int fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
     }
 
     int res;
-    if (mpctx->syncing_audio || mpctx->hrseek_active)
+    struct audio_thread *t = mpctx->audio_thread;
+    if (t && t->decode_res < 0) {
+        // Error or format change seen by the audio thread.
+        res = t->decode_res;
+        t->decode_res = 0;
+    } else if (mpctx->syncing_audio || mpctx->hrseek_active)
         res = audio_start_sync(mpctx, playsize);
     else
         res = audio_decode(d_audio, mpctx->ao_buffer, playsize);
@@ -419,7 +601,7 @@ int fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
             return -1;
         } else if (res == ASYNC_PLAY_DONE)
             return 0;
-        else if (demux_stream_eof(d_audio->header))
+        else if (audio_stream_eof(d_audio))
             audio_eof = true;
     }
 
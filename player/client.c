@@ -109,6 +109,16 @@ struct mpv_handle {
 
     struct mp_log_buffer *messages;
     int messages_level;
+
+    // Nesting level of mpv_suspend() calls, time of the outermost call, and
+    // accumulated time the core was suspended by this client (in us).
+    int suspend_count;
+    int64_t suspend_start;
+    int64_t suspend_time;
+
+    bool has_stats;
+    double stats_cpu_time;
+    int64_t stats_memory;
 };
 
 static bool gen_property_change_event(struct mpv_handle *ctx);
@@ -210,6 +220,42 @@ struct MPContext *mp_client_get_core(struct mpv_handle *ctx)
     return ctx->mpctx;
 }
 
+void mp_client_set_stats(struct mpv_handle *ctx, double cpu_time,
+                         int64_t memory)
+{
+    pthread_mutex_lock(&ctx->lock);
+    ctx->has_stats = true;
+    ctx->stats_cpu_time = cpu_time;
+    ctx->stats_memory = memory;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int mp_client_get_stats(struct MPContext *mpctx, void *ta_parent,
+                        struct mp_client_stats **out)
+{
+    struct mp_client_api *clients = mpctx->clients;
+    struct mp_client_stats *list = NULL;
+    int num = 0;
+    pthread_mutex_lock(&clients->lock);
+    for (int n = 0; n < clients->num_clients; n++) {
+        struct mpv_handle *ctx = clients->clients[n];
+        pthread_mutex_lock(&ctx->lock);
+        if (ctx->has_stats) {
+            struct mp_client_stats st = {
+                .name = talloc_strdup(ta_parent, ctx->name),
+                .cpu_time = ctx->stats_cpu_time,
+                .memory = ctx->stats_memory,
+                .suspend_time = ctx->suspend_time / 1e6,
+            };
+            MP_TARRAY_APPEND(ta_parent, list, num, st);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    pthread_mutex_unlock(&clients->lock);
+    *out = list;
+    return num;
+}
+
 static void wakeup_client(struct mpv_handle *ctx)
 {
     pthread_cond_signal(&ctx->wakeup);
@@ -230,10 +276,20 @@ void mpv_set_wakeup_callback(mpv_handle *ctx, void (*cb)(void *d), void *d)
 void mpv_suspend(mpv_handle *ctx)
 {
     mp_dispatch_suspend(ctx->mpctx->dispatch);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->suspend_count++ == 0)
+        ctx->suspend_start = mp_time_us();
+    pthread_mutex_unlock(&ctx->lock);
 }
 
 void mpv_resume(mpv_handle *ctx)
 {
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->suspend_count > 0 && --ctx->suspend_count == 0)
+        ctx->suspend_time += mp_time_us() - ctx->suspend_start;
+    pthread_mutex_unlock(&ctx->lock);
+
     mp_dispatch_resume(ctx->mpctx->dispatch);
 }
 
@@ -1264,7 +1320,7 @@ int mpv_get_wakeup_pipe(mpv_handle *ctx)
 fail:
 #endif
     pthread_mutex_unlock(&ctx->lock);
-    return ctx->wakeup_pipe[1];
+    return ctx->wakeup_pipe[0];
 }
 
 unsigned long mpv_client_api_version(void)
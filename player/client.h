@@ -23,4 +23,17 @@ struct mpv_handle *mp_new_client(struct mp_client_api *clients, const char *name
 struct mp_log *mp_client_get_log(struct mpv_handle *ctx);
 struct MPContext *mp_client_get_core(struct mpv_handle *ctx);
 
+// Resource usage as published by a client (currently scripts only).
+struct mp_client_stats {
+    char *name;
+    double cpu_time;        // thread CPU time in seconds, <0 if unknown
+    int64_t memory;         // bytes allocated by the script VM
+    double suspend_time;    // seconds the core was held with mpv_suspend()
+};
+
+void mp_client_set_stats(struct mpv_handle *ctx, double cpu_time,
+                         int64_t memory);
+int mp_client_get_stats(struct MPContext *mpctx, void *ta_parent,
+                        struct mp_client_stats **out);
+
 #endif
@@ -405,6 +405,16 @@ static int mp_property_drop_frame_cnt(m_option_t *prop, int action, void *arg,
     return m_property_int_ro(prop, action, arg, mpctx->drop_frame_cnt);
 }
 
+/// Time from the end of the previous file to playback start of this one (RO)
+static int mp_property_file_transition_time(m_option_t *prop, int action,
+                                            void *arg, MPContext *mpctx)
+{
+    if (mpctx->file_transition_time < 0)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_double_ro(prop, action, arg,
+                                mpctx->file_transition_time);
+}
+
 /// Current position in percent (RW)
 static int mp_property_percent_pos(m_option_t *prop, int action,
                                    void *arg, MPContext *mpctx)
@@ -1194,6 +1204,15 @@ static int mp_property_audio_codec(m_option_t *prop, int action,
     return m_property_strdup_ro(prop, action, arg, c);
 }
 
+/// Number of audio output underruns (RO)
+static int mp_property_audio_underruns(m_option_t *prop, int action,
+                                       void *arg, MPContext *mpctx)
+{
+    if (!mpctx->ao)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int_ro(prop, action, arg, ao_get_underruns(mpctx->ao));
+}
+
 /// Audio bitrate (RO)
 static int mp_property_audio_bitrate(m_option_t *prop, int action,
                                      void *arg, MPContext *mpctx)
@@ -2198,6 +2217,40 @@ static int mp_property_playlist(m_option_t *prop, int action, void *arg,
                                 get_playlist_entry, mpctx);
 }
 
+struct script_stats_ctx {
+    struct mp_client_stats *list;
+    int num;
+};
+
+static int get_script_stats_entry(int item, int action, void *arg, void *ctx)
+{
+    struct script_stats_ctx *st = ctx;
+    struct mp_client_stats *e = &st->list[item];
+
+    struct m_sub_property props[] = {
+        {"name",        SUB_PROP_STR(e->name)},
+        {"cpu-time",    CONF_TYPE_DOUBLE, {.double_ = e->cpu_time},
+                        .unavailable = e->cpu_time < 0},
+        {"memory",      CONF_TYPE_INT64, {.int64 = e->memory}},
+        {"suspend-time", CONF_TYPE_DOUBLE, {.double_ = e->suspend_time}},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_script_stats(m_option_t *prop, int action, void *arg,
+                                    MPContext *mpctx)
+{
+    void *tmp = talloc_new(NULL);
+    struct script_stats_ctx st = {0};
+    st.num = mp_client_get_stats(mpctx, tmp, &st.list);
+    int r = m_property_read_list(action, arg, st.num, get_script_stats_entry,
+                                 &st);
+    talloc_free(tmp);
+    return r;
+}
+
 static char *print_obj_osd_list(struct m_obj_settings *list)
 {
     char *res = NULL;
@@ -2350,6 +2403,8 @@ static const m_option_t mp_properties[] = {
       CONF_TYPE_DOUBLE },
     { "drop-frame-count", mp_property_drop_frame_cnt, CONF_TYPE_INT,
       0, 0, 0, NULL },
+    { "file-transition-time", mp_property_file_transition_time,
+      CONF_TYPE_DOUBLE },
     { "percent-pos", mp_property_percent_pos, CONF_TYPE_DOUBLE,
       M_OPT_RANGE, 0, 100, NULL },
     { "time-start", mp_property_time_start, CONF_TYPE_TIME,
@@ -2396,6 +2451,8 @@ static const m_option_t mp_properties[] = {
     { "playlist-pos", mp_property_playlist_pos, CONF_TYPE_INT },
     M_PROPERTY_ALIAS("playlist-count", "playlist/count"),
 
+    M_PROPERTY("script-stats", mp_property_script_stats),
+
     // Audio
     { "volume", mp_property_volume, CONF_TYPE_FLOAT,
       M_OPT_RANGE, 0, 100, NULL },
@@ -2412,6 +2469,8 @@ static const m_option_t mp_properties[] = {
       0, 0, 0, NULL },
     { "audio-channels", mp_property_channels, CONF_TYPE_INT,
       0, 0, 0, NULL },
+    { "audio-underruns", mp_property_audio_underruns, CONF_TYPE_INT,
+      0, 0, 0, NULL },
     M_OPTION_PROPERTY_CUSTOM("aid", mp_property_audio),
     { "balance", mp_property_balance, CONF_TYPE_FLOAT,
       M_OPT_RANGE, -1, 1, NULL },
@@ -130,8 +130,9 @@ struct track {
     // Invariant: !stream || stream->demuxer == demuxer
     struct sh_stream *stream;
 
-    // For external subtitles, which are read fully on init. Do not attempt
-    // to read packets from them.
+    // For external subtitles, which are read fully by dec_sub (incrementally,
+    // see sub_preload_packets()). Do not attempt to read packets from them or
+    // to seek their demuxer.
     bool preloaded;
 };
 
@@ -151,6 +152,7 @@ typedef struct MPContext {
     struct input_ctx *input;
     struct mp_client_api *clients;
     struct mp_dispatch_queue *dispatch;
+    struct mp_ipc_ctx *ipc_ctx;
 
     struct mp_log *statusline;
     struct osd_state *osd;
@@ -188,6 +190,8 @@ typedef struct MPContext {
 
     struct timeline_part *timeline;
     int num_timeline_parts;
+    // Segment UIDs of files scanned for ordered chapter sources.
+    struct mkv_uid_cache *mkv_uid_cache;
     int timeline_part;
     struct chapter *chapters;
     int num_chapters;
@@ -218,9 +222,17 @@ typedef struct MPContext {
     struct ao *ao;
     double ao_pts;
     struct mp_audio_buffer *ao_buffer;  // queued audio; passed to ao_play() later
+    struct audio_thread *audio_thread;
 
     struct vo *video_out;
 
+    // Next playlist entry, opened in the background (--prefetch-playlist).
+    struct prefetch *prefetch;
+    // mp_time_sec() when the previous file ended (0 if not applicable), and
+    // the time it took until playback of the next file started (-1 if none).
+    double file_transition_start;
+    double file_transition_time;
+
     /* We're starting playback from scratch or after a seek. Show first
      * video frame immediately and reinitialize sync. */
     bool restart_playback;
@@ -359,6 +371,10 @@ int fill_audio_out_buffers(struct MPContext *mpctx, double endpts);
 double written_audio_pts(struct MPContext *mpctx);
 void clear_audio_output_buffers(struct MPContext *mpctx);
 void clear_audio_decode_buffers(struct MPContext *mpctx);
+void audio_thread_start_fill(struct MPContext *mpctx, double endpts);
+void audio_thread_stop_fill(struct MPContext *mpctx);
+double get_audio_sync_delay(struct MPContext *mpctx);
+void uninit_audio_thread(struct MPContext *mpctx);
 
 // configfiles.c
 bool mp_parse_cfgfiles(struct MPContext *mpctx);
@@ -398,6 +414,9 @@ struct playlist_entry *mp_next_file(struct MPContext *mpctx, int direction,
                                     bool force);
 void mp_set_playlist_entry(struct MPContext *mpctx, struct playlist_entry *e);
 void mp_play_files(struct MPContext *mpctx);
+void mp_prefetch_next_file(struct MPContext *mpctx);
+void mp_discard_prefetch(struct MPContext *mpctx);
+void mp_update_file_transition(struct MPContext *mpctx);
 
 // main.c
 int mpv_main(int argc, char *argv[]);
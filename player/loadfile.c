@@ -20,6 +20,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/avutil.h>
 
@@ -38,8 +39,11 @@
 #include "options/options.h"
 #include "options/m_property.h"
 #include "common/common.h"
+#include "common/global.h"
 #include "common/encode.h"
 #include "input/input.h"
+#include "misc/thread_pool.h"
+#include "compat/atomics.h"
 
 #include "audio/mixer.h"
 #include "audio/audio.h"
@@ -263,7 +267,9 @@ void reselect_demux_streams(struct MPContext *mpctx)
 // External demuxers might need a seek to the current playback position.
 static void external_track_seek(struct MPContext *mpctx, struct track *track)
 {
-    if (track && track->demuxer && track->selected && track->is_external) {
+    if (track && track->demuxer && track->selected && track->is_external &&
+        !track->preloaded)
+    {
         for (int t = 0; t < mpctx->num_tracks; t++) {
             struct track *other = mpctx->tracks[t];
             if (other->demuxer == track->demuxer &&
@@ -708,66 +714,56 @@ bool mp_remove_track(struct MPContext *mpctx, struct track *track)
     return true;
 }
 
-static void open_subtitles_from_options(struct MPContext *mpctx)
-{
-    if (mpctx->opts->sub_name) {
-        for (int i = 0; mpctx->opts->sub_name[i] != NULL; ++i)
-            mp_add_subtitles(mpctx, mpctx->opts->sub_name[i]);
-    }
-    if (mpctx->opts->sub_auto >= 0) { // auto load sub file ...
-        void *tmp = talloc_new(NULL);
-        char *base_filename = mpctx->filename;
-        char *stream_filename = NULL;
-        if (stream_control(mpctx->stream, STREAM_CTRL_GET_BASE_FILENAME,
-                           &stream_filename) > 0)
-            base_filename = talloc_steal(tmp, stream_filename);
-        struct subfn *list = find_text_subtitles(mpctx->global, base_filename);
-        talloc_steal(tmp, list);
-        for (int i = 0; list && list[i].fname; i++) {
-            char *filename = list[i].fname;
-            char *lang = list[i].lang;
-            for (int n = 0; n < mpctx->num_sources; n++) {
-                if (strcmp(mpctx->sources[n]->stream->url, filename) == 0)
-                    goto skip;
-            }
-            struct track *track = mp_add_subtitles(mpctx, filename);
-            if (track) {
-                track->auto_loaded = true;
-                if (!track->lang)
-                    track->lang = talloc_strdup(track, lang);
-            }
-        skip:;
-        }
-        talloc_free(tmp);
-    }
-}
-
-static struct track *open_external_file(struct MPContext *mpctx, char *filename,
-                                        char *demuxer_name, int stream_cache,
-                                        enum stream_type filter)
+// Open the stream for an external file, and read the data the demuxer probe
+// needs. This doesn't access mpctx, and can be called from any thread.
+static struct stream *open_external_stream(struct mpv_global *global,
+                                           struct MPOpts *opts,
+                                           char *filename, int stream_cache)
 {
-    struct MPOpts *opts = mpctx->opts;
-    if (!filename)
-        return NULL;
-    char *disp_filename = filename;
-    if (strncmp(disp_filename, "memory://", 9) == 0)
-        disp_filename = "memory://"; // avoid noise
-    struct stream *stream = stream_open(filename, mpctx->global);
+    struct stream *stream = stream_open(filename, global);
     if (!stream)
-        goto err_out;
+        return NULL;
     stream_enable_cache_percent(&stream, stream_cache,
                                 opts->stream_cache_def_size,
                                 opts->stream_cache_min_percent,
                                 opts->stream_cache_seek_min_percent);
+    stream_peek(stream, STREAM_BUFFER_SIZE);
+    return stream;
+}
+
+// Open the demuxer on a stream returned by open_external_stream(). This takes
+// over ownership of the stream. Must be called on the playback thread, because
+// demux_open() is not reentrant (demux_subreader.c uses static state, and
+// libavcodec is opened without a lock manager).
+static struct demuxer *open_external_demuxer(struct MPContext *mpctx,
+                                             struct stream *stream,
+                                             char *demuxer_name,
+                                             enum stream_type filter)
+{
+    if (!stream)
+        return NULL;
     struct demuxer_params params = {
         .expect_subtitle = filter == STREAM_SUB,
     };
-    struct demuxer *demuxer =
-        demux_open(stream, demuxer_name, &params, mpctx->global);
-    if (!demuxer) {
+    struct demuxer *demuxer = demux_open(stream, demuxer_name, &params,
+                                         mpctx->global);
+    if (!demuxer)
         free_stream(stream);
+    return demuxer;
+}
+
+// Add the tracks of a demuxer returned by open_external_demuxer(). This takes
+// over ownership of the demuxer (demuxer==NULL means opening failed).
+static struct track *add_external_tracks(struct MPContext *mpctx,
+                                         struct demuxer *demuxer,
+                                         char *filename,
+                                         enum stream_type filter)
+{
+    char *disp_filename = filename;
+    if (strncmp(disp_filename, "memory://", 9) == 0)
+        disp_filename = "memory://"; // avoid noise
+    if (!demuxer)
         goto err_out;
-    }
     struct track *first = NULL;
     for (int n = 0; n < demuxer->num_streams; n++) {
         struct sh_stream *sh = demuxer->streams[n];
@@ -780,6 +776,7 @@ static struct track *open_external_file(struct MPContext *mpctx, char *filename,
         }
     }
     if (!first) {
+        struct stream *stream = demuxer->stream;
         free_demuxer(demuxer);
         free_stream(stream);
         MP_WARN(mpctx, "No streams added from file %s.\n",
@@ -795,11 +792,17 @@ err_out:
     return false;
 }
 
-static void open_audiofiles_from_options(struct MPContext *mpctx)
+static struct track *open_external_file(struct MPContext *mpctx, char *filename,
+                                        char *demuxer_name, int stream_cache,
+                                        enum stream_type filter)
 {
-    struct MPOpts *opts = mpctx->opts;
-    open_external_file(mpctx, opts->audio_stream, opts->audio_demuxer_name,
-                       opts->audio_stream_cache, STREAM_AUDIO);
+    if (!filename)
+        return NULL;
+    struct stream *stream = open_external_stream(mpctx->global, mpctx->opts,
+                                                 filename, stream_cache);
+    struct demuxer *demuxer = open_external_demuxer(mpctx, stream,
+                                                    demuxer_name, filter);
+    return add_external_tracks(mpctx, demuxer, filename, filter);
 }
 
 struct track *mp_add_subtitles(struct MPContext *mpctx, char *filename)
@@ -809,25 +812,228 @@ struct track *mp_add_subtitles(struct MPContext *mpctx, char *filename)
                               STREAM_SUB);
 }
 
-static void open_subtitles_from_resolve(struct MPContext *mpctx)
+// Maximum number of external file streams opened at the same time on loading.
+#define MAX_EXT_OPEN_THREADS 8
+
+// An external file whose stream is opened in the background while the main
+// file is loaded. The demuxer is opened on the playback thread.
+struct ext_file {
+    struct mpv_global *global;
+    struct MPOpts *opts;
+    char *filename;
+    char *demuxer_name;
+    int stream_cache;
+    enum stream_type filter;
+    char *lang;
+    bool auto_loaded;       // found by the --sub-auto directory scan
+    bool resolved;          // subtitle returned by the URL resolver
+    struct stream *stream;  // set by the worker
+};
+
+// All external files for the current file. The tracks are added in the order
+// of files[], with the auto-loaded subtitles inserted before files[auto_pos].
+// This is the same order the files used to be opened in sequentially.
+struct ext_files {
+    struct mpv_global *global;
+    struct MPOpts *opts;
+    struct mp_thread_pool *pool;
+    struct ext_file **files;
+    int num_files;
+    int auto_pos;
+    char *auto_base;        // base filename for the directory scan, or NULL
+    // Written by the scan worker only; read after the pool is destroyed.
+    struct ext_file **auto_files;
+    int num_auto_files;
+};
+
+static struct ext_file *add_ext_file(struct ext_files *ef, char *filename,
+                                     char *demuxer_name, int stream_cache,
+                                     enum stream_type filter)
+{
+    struct ext_file *f = talloc_ptrtype(ef, f);
+    *f = (struct ext_file){
+        .global = ef->global,
+        .opts = ef->opts,
+        .filename = talloc_strdup(f, filename),
+        .demuxer_name = talloc_strdup(f, demuxer_name),
+        .stream_cache = stream_cache,
+        .filter = filter,
+    };
+    return f;
+}
+
+static void open_ext_file_fn(void *ctx)
+{
+    struct ext_file *f = ctx;
+    f->stream = open_external_stream(f->global, f->opts, f->filename,
+                                     f->stream_cache);
+}
+
+static void scan_ext_subs_fn(void *ctx)
+{
+    struct ext_files *ef = ctx;
+    char *demuxer_name = ef->opts->sub_demuxer_name;
+    struct subfn *list = find_text_subtitles(ef->global, ef->auto_base);
+    for (int i = 0; list && list[i].fname; i++) {
+        struct ext_file *f =
+            add_ext_file(ef, list[i].fname, demuxer_name, 0, STREAM_SUB);
+        f->lang = talloc_strdup(f, list[i].lang);
+        f->auto_loaded = true;
+        MP_TARRAY_APPEND(ef, ef->auto_files, ef->num_auto_files, f);
+        if (ef->pool)
+            mp_thread_pool_queue(ef->pool, open_ext_file_fn, f);
+    }
+    talloc_free(list);
+}
+
+// Start opening the streams of all external files given by the options and
+// the resolver in worker threads. add_external_files() opens the demuxers.
+// Returns NULL if there's nothing to open.
+static struct ext_files *open_external_files_async(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
+    struct ext_files *ef = talloc_ptrtype(NULL, ef);
+    *ef = (struct ext_files){
+        .global = mpctx->global,
+        .opts = opts,
+    };
+
+    for (int i = 0; opts->sub_name && opts->sub_name[i]; i++) {
+        struct ext_file *f = add_ext_file(ef, opts->sub_name[i],
+                                          opts->sub_demuxer_name, 0,
+                                          STREAM_SUB);
+        MP_TARRAY_APPEND(ef, ef->files, ef->num_files, f);
+    }
+
+    ef->auto_pos = ef->num_files;
+    if (opts->sub_auto >= 0) {
+        char *base_filename = mpctx->filename;
+        char *stream_filename = NULL;
+        if (stream_control(mpctx->stream, STREAM_CTRL_GET_BASE_FILENAME,
+                           &stream_filename) > 0)
+            base_filename = talloc_steal(ef, stream_filename);
+        ef->auto_base = talloc_strdup(ef, base_filename);
+    }
+
     struct mp_resolve_result *res = mpctx->resolve_result;
-    if (!res)
-        return;
-    for (int n = 0; n < res->num_subs; n++) {
+    for (int n = 0; res && n < res->num_subs; n++) {
         struct mp_resolve_sub *sub = res->subs[n];
         char *s = talloc_strdup(NULL, sub->url);
         if (!s)
             s = talloc_asprintf(NULL, "memory://%s", sub->data);
-        struct track *t =
-            open_external_file(mpctx, s, opts->sub_demuxer_name, 0, STREAM_SUB);
+        struct ext_file *f = add_ext_file(ef, s, opts->sub_demuxer_name, 0,
+                                          STREAM_SUB);
         talloc_free(s);
-        if (t) {
-            t->lang = talloc_strdup(t, sub->lang);
-            t->no_default = true;
+        f->lang = talloc_strdup(f, sub->lang);
+        f->resolved = true;
+        MP_TARRAY_APPEND(ef, ef->files, ef->num_files, f);
+    }
+
+    if (opts->audio_stream) {
+        struct ext_file *f = add_ext_file(ef, opts->audio_stream,
+                                          opts->audio_demuxer_name,
+                                          opts->audio_stream_cache,
+                                          STREAM_AUDIO);
+        MP_TARRAY_APPEND(ef, ef->files, ef->num_files, f);
+    }
+
+    if (!ef->num_files && !ef->auto_base) {
+        talloc_free(ef);
+        return NULL;
+    }
+
+    int threads = ef->auto_base ? MAX_EXT_OPEN_THREADS
+                                : MPMIN(ef->num_files, MAX_EXT_OPEN_THREADS);
+    ef->pool = mp_thread_pool_create(ef, threads);
+    if (!ef->pool)
+        return ef; // add_external_files() will open them synchronously
+
+    // Queue the directory scan last, because it allocates from ef.
+    for (int n = 0; n < ef->num_files; n++)
+        mp_thread_pool_queue(ef->pool, open_ext_file_fn, ef->files[n]);
+    if (ef->auto_base)
+        mp_thread_pool_queue(ef->pool, scan_ext_subs_fn, ef);
+
+    return ef;
+}
+
+static void free_ext_file_stream(struct ext_file *f)
+{
+    free_stream(f->stream);
+    f->stream = NULL;
+}
+
+static void add_external_file(struct MPContext *mpctx, struct ext_file *f)
+{
+    if (f->auto_loaded) {
+        // Skip files that were already loaded explicitly (or the main file).
+        for (int n = 0; n < mpctx->num_sources; n++) {
+            if (strcmp(mpctx->sources[n]->stream->url, f->filename) == 0) {
+                free_ext_file_stream(f);
+                return;
+            }
+        }
+    }
+    struct demuxer *demuxer = open_external_demuxer(mpctx, f->stream,
+                                                    f->demuxer_name, f->filter);
+    f->stream = NULL;
+    struct track *t = add_external_tracks(mpctx, demuxer, f->filename,
+                                          f->filter);
+    if (!t)
+        return;
+    if (f->auto_loaded) {
+        t->auto_loaded = true;
+        if (!t->lang)
+            t->lang = talloc_strdup(t, f->lang);
+    }
+    if (f->resolved) {
+        t->lang = talloc_strdup(t, f->lang);
+        t->no_default = true;
+    }
+}
+
+// Wait until the streams queued by open_external_files_async() are opened,
+// then open the demuxers and add their tracks. Frees ef.
+static void add_external_files(struct MPContext *mpctx, struct ext_files *ef)
+{
+    if (!ef)
+        return;
+    if (ef->pool) {
+        talloc_free(ef->pool);
+        ef->pool = NULL;
+    } else {
+        // No worker threads; do it synchronously.
+        for (int n = 0; n < ef->num_files; n++)
+            open_ext_file_fn(ef->files[n]);
+        if (ef->auto_base) {
+            scan_ext_subs_fn(ef);
+            for (int n = 0; n < ef->num_auto_files; n++)
+                open_ext_file_fn(ef->auto_files[n]);
+        }
+    }
+    for (int n = 0; n <= ef->num_files; n++) {
+        if (n == ef->auto_pos) {
+            for (int i = 0; i < ef->num_auto_files; i++)
+                add_external_file(mpctx, ef->auto_files[i]);
         }
+        if (n < ef->num_files)
+            add_external_file(mpctx, ef->files[n]);
     }
+    talloc_free(ef);
+}
+
+// Like add_external_files(), but throw away the results.
+static void discard_external_files(struct ext_files *ef)
+{
+    if (!ef)
+        return;
+    talloc_free(ef->pool);
+    ef->pool = NULL;
+    for (int n = 0; n < ef->num_files; n++)
+        free_ext_file_stream(ef->files[n]);
+    for (int n = 0; n < ef->num_auto_files; n++)
+        free_ext_file_stream(ef->auto_files[n]);
+    talloc_free(ef);
 }
 
 static const char *font_mimetypes[] = {
@@ -1024,6 +1230,167 @@ static void load_per_file_options(m_config_t *conf,
     }
 }
 
+// Start prefetching this long before the end of the current file.
+#define PREFETCH_TIME 10.0
+
+// The stream interrupt state used by a prefetch. The prefetched stream uses
+// this copy of the global context, so it's moved to the stream if the prefetch
+// is used for playback.
+struct prefetch_global {
+    struct mpv_global global;
+    struct mpv_global *parent;
+    int abort;                      // set to stop opening the file
+    int playing;                    // set once the stream is used for playback
+};
+
+static int check_prefetch_interrupt(void *ctx)
+{
+    struct prefetch_global *g = ctx;
+    if (mp_atomic_add_and_fetch(&g->abort, 0))
+        return 1;
+    // Input commands (like playlist_next) must not interrupt the prefetch of
+    // the file they are about to play; the core sets abort if needed.
+    if (!mp_atomic_add_and_fetch(&g->playing, 0))
+        return 0;
+    struct mpv_global *parent = g->parent;
+    return parent->stream_interrupt_cb &&
+           parent->stream_interrupt_cb(parent->stream_interrupt_cb_ctx);
+}
+
+// The next playlist entry, opened in the background while the current file
+// is still playing. Only the stream is opened and its cache filled; the
+// demuxer is opened by play_current_file() as usual, because demux_open() is
+// not reentrant.
+struct prefetch {
+    struct prefetch_global *global;
+    struct MPOpts *opts;
+    struct playlist_entry *entry;   // only for comparison
+    char *filename;
+    int stream_cache;
+    pthread_t thread;
+    struct stream *stream;          // set by the thread
+};
+
+static void *prefetch_thread(void *arg)
+{
+    struct prefetch *p = arg;
+    struct MPOpts *opts = p->opts;
+    struct stream *stream = stream_open(p->filename, &p->global->global);
+    if (!stream)
+        return NULL;
+    // Disc and device streams need mp_nav_init() or similar setup before the
+    // cache is enabled, so leave them to the normal code path.
+    if (stream->type != STREAMTYPE_GENERIC && stream->type != STREAMTYPE_FILE) {
+        free_stream(stream);
+        return NULL;
+    }
+    stream_enable_cache_percent(&stream, p->stream_cache,
+                                opts->stream_cache_def_size,
+                                opts->stream_cache_min_percent,
+                                opts->stream_cache_seek_min_percent);
+    stream_peek(stream, STREAM_BUFFER_SIZE);
+    p->stream = stream;
+    return NULL;
+}
+
+// Called from the playloop. Start opening the next playlist entry if the
+// current file is about to end, and drop a prefetch that is no longer for the
+// next entry (e.g. the playlist was changed).
+void mp_prefetch_next_file(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    if (mpctx->prefetch && !mpctx->stop_play &&
+        mpctx->prefetch->entry != playlist_get_next(mpctx->playlist, +1))
+        mp_discard_prefetch(mpctx);
+    if (!opts->prefetch_playlist || mpctx->prefetch || mpctx->stop_play ||
+        opts->loop_file || opts->stream_dump || opts->seek_to_byte)
+        return;
+    double len = get_time_length(mpctx);
+    if (len <= 0 || len - get_current_time(mpctx) > PREFETCH_TIME)
+        return;
+    struct playlist_entry *e = playlist_get_next(mpctx->playlist, +1);
+    if (!e || e->num_params)
+        return;
+#if HAVE_LIBQUVI
+    if (mp_is_url(bstr0(e->filename)))
+        return; // goes through resolve_url()
+#endif
+
+    struct prefetch *p = talloc_ptrtype(NULL, p);
+    *p = (struct prefetch){
+        .global = talloc_ptrtype(p, p->global),
+        .opts = opts,
+        .entry = e,
+        .stream_cache = opts->stream_cache_size,
+    };
+    *p->global = (struct prefetch_global){
+        .global = *mpctx->global,
+        .parent = mpctx->global,
+    };
+    p->global->global.stream_interrupt_cb = check_prefetch_interrupt;
+    p->global->global.stream_interrupt_cb_ctx = p->global;
+    p->filename = mp_file_url_to_filename(p, bstr0(e->filename));
+    if (!p->filename)
+        p->filename = talloc_strdup(p, e->filename);
+    if (pthread_create(&p->thread, NULL, prefetch_thread, p)) {
+        talloc_free(p);
+        return;
+    }
+    MP_VERBOSE(mpctx, "Prefetching %s\n", p->filename);
+    mpctx->prefetch = p;
+}
+
+// Wait for the prefetch to finish, and return its stream if it matches
+// filename and the current options. Otherwise abort and discard it, and
+// return NULL.
+static struct stream *take_prefetched_stream(struct MPContext *mpctx,
+                                             char *filename)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct prefetch *p = mpctx->prefetch;
+    if (!p)
+        return NULL;
+    mpctx->prefetch = NULL;
+    bool ok = filename && mpctx->playlist->current == p->entry &&
+              strcmp(p->filename, filename) == 0 &&
+              p->stream_cache == opts->stream_cache_size &&
+              !opts->stream_dump && !opts->seek_to_byte;
+    // Don't wait for a slow open (network, cache fill) that isn't needed.
+    if (!ok)
+        mp_atomic_add_and_fetch(&p->global->abort, 1);
+    pthread_join(p->thread, NULL);
+    struct stream *stream = p->stream;
+    if (stream && !ok) {
+        free_stream(stream);
+        stream = NULL;
+    }
+    if (stream) {
+        MP_VERBOSE(mpctx, "Using prefetched file.\n");
+        mp_atomic_add_and_fetch(&p->global->playing, 1);
+        talloc_steal(stream, p->global);
+    }
+    talloc_free(p);
+    return stream;
+}
+
+void mp_discard_prefetch(struct MPContext *mpctx)
+{
+    take_prefetched_stream(mpctx, NULL);
+}
+
+// Called from the playloop. Record how long the switch from the previous file
+// took, once playback of the new file has started.
+void mp_update_file_transition(struct MPContext *mpctx)
+{
+    if (!mpctx->file_transition_start || mpctx->restart_playback ||
+        !(mpctx->d_audio || mpctx->d_video))
+        return;
+    mpctx->file_transition_time = mp_time_sec() - mpctx->file_transition_start;
+    mpctx->file_transition_start = 0;
+    MP_VERBOSE(mpctx, "File transition took %.3f ms.\n",
+               mpctx->file_transition_time * 1e3);
+}
+
 // Start playing the current playlist entry.
 // Handle initialization and deinitialization.
 static void play_current_file(struct MPContext *mpctx)
@@ -1031,6 +1398,8 @@ static void play_current_file(struct MPContext *mpctx)
     struct MPOpts *opts = mpctx->opts;
     void *tmp = talloc_new(NULL);
     double playback_start = -1e100;
+    struct ext_files *ext_files = NULL;
+    bool prefetched = false;
 
     mpctx->initialized_flags |= INITIALIZED_PLAYBACK;
 
@@ -1108,7 +1477,10 @@ static void play_current_file(struct MPContext *mpctx)
         }
         stream_filename = mpctx->resolve_result->url;
     }
-    mpctx->stream = stream_open(stream_filename, mpctx->global);
+    mpctx->stream = take_prefetched_stream(mpctx, stream_filename);
+    prefetched = !!mpctx->stream;
+    if (!prefetched)
+        mpctx->stream = stream_open(stream_filename, mpctx->global);
     if (!mpctx->stream) { // error...
         demux_was_interrupted(mpctx);
         goto terminate_playback;
@@ -1126,14 +1498,17 @@ static void play_current_file(struct MPContext *mpctx)
     mp_nav_init(mpctx);
 
     // CACHE2: initial prefill: 20%  later: 5%  (should be set by -cacheopts)
-    int res = stream_enable_cache_percent(&mpctx->stream,
-                                          opts->stream_cache_size,
-                                          opts->stream_cache_def_size,
-                                          opts->stream_cache_min_percent,
-                                          opts->stream_cache_seek_min_percent);
-    if (res == 0)
-        if (demux_was_interrupted(mpctx))
-            goto terminate_playback;
+    // (A prefetched stream already has the cache enabled.)
+    if (!prefetched) {
+        int res = stream_enable_cache_percent(&mpctx->stream,
+                                              opts->stream_cache_size,
+                                              opts->stream_cache_def_size,
+                                              opts->stream_cache_min_percent,
+                                              opts->stream_cache_seek_min_percent);
+        if (res == 0)
+            if (demux_was_interrupted(mpctx))
+                goto terminate_playback;
+    }
 
     stream_set_capture_file(mpctx->stream, opts->stream_capture);
 
@@ -1141,6 +1516,9 @@ goto_reopen_demuxer: ;
 
     mp_nav_reset(mpctx);
 
+    // Open external files in parallel with the main demuxer.
+    ext_files = open_external_files_async(mpctx);
+
     //============ Open DEMUXERS --- DETECT file type =======================
 
     mpctx->audio_delay = opts->audio_delay;
@@ -1206,9 +1584,8 @@ goto_reopen_demuxer: ;
     // exists, so we (re)create the renderer after fonts are set.
     init_sub_renderer(mpctx);
 
-    open_subtitles_from_options(mpctx);
-    open_subtitles_from_resolve(mpctx);
-    open_audiofiles_from_options(mpctx);
+    add_external_files(mpctx, ext_files);
+    ext_files = NULL;
 
     check_previous_track_selection(mpctx);
 
@@ -1351,6 +1728,8 @@ goto_reopen_demuxer: ;
 
 terminate_playback:  // don't jump here after ao/vo/getch initialization!
 
+    discard_external_files(ext_files);
+
     mp_nav_destroy(mpctx);
 
     if (mpctx->stop_play == KEEP_PLAYING)
@@ -1383,6 +1762,9 @@ terminate_playback:  // don't jump here after ao/vo/getch initialization!
     if (opts->use_terminal && opts->consolecontrols)
         getch2_enable();
 
+    mpctx->file_transition_start =
+        mpctx->stop_play == PT_QUIT ? 0 : mp_time_sec();
+
     mpctx->filename = NULL;
     mpctx->resolve_result = NULL;
     talloc_free(tmp);
@@ -1507,6 +1889,8 @@ void mp_play_files(struct MPContext *mpctx)
         mpctx->playlist->current = new_entry;
         mpctx->playlist->current_was_replaced = false;
         mpctx->stop_play = 0;
+        if (!new_entry)
+            mpctx->file_transition_start = 0;
 
         if (!mpctx->playlist->current && !mpctx->opts->player_idle_mode)
             break;
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <math.h>
+#include <time.h>
 
 #include "osdep/io.h"
 
@@ -68,8 +69,19 @@ struct script_ctx {
     struct mpv_handle *client;
     struct MPContext *mpctx;
     int suspended;
+    // Suspend watchdog state. If the core stays suspended for longer than
+    // suspend_limit (in us, 0 for no limit), a warning is printed. With
+    // suspend_resume, it's also resumed behind the script's back, and
+    // core_released is set until the script resumes it itself.
+    int64_t suspend_limit;
+    bool suspend_resume;
+    int64_t suspend_start;
+    bool core_released;
 };
 
+// Number of Lua VM instructions between suspend watchdog checks.
+#define WATCHDOG_INSTRUCTIONS 1000
+
 static struct script_ctx *get_ctx(lua_State *L)
 {
     lua_getfield(L, LUA_REGISTRYINDEX, "ctx");
@@ -138,6 +150,7 @@ static int run_event_loop(lua_State *L)
 }
 
 static void add_functions(struct script_ctx *ctx);
+static void release_core(struct script_ctx *ctx);
 
 static int load_file(struct script_ctx *ctx, const char *fname)
 {
@@ -197,6 +210,15 @@ static int load_lua(struct mpv_handle *client, const char *fname)
         .log = mp_client_get_log(client),
     };
 
+    int64_t limit_ms = 0;
+    mpv_get_property(client, "options/lua-suspend-limit", MPV_FORMAT_INT64,
+                     &limit_ms);
+    ctx->suspend_limit = limit_ms * 1000;
+    int resume = 0;
+    mpv_get_property(client, "options/lua-suspend-resume", MPV_FORMAT_FLAG,
+                     &resume);
+    ctx->suspend_resume = resume;
+
     lua_State *L = ctx->state = luaL_newstate();
     if (!L)
         goto error_out;
@@ -273,7 +295,7 @@ static int load_lua(struct mpv_handle *client, const char *fname)
 
 error_out:
     if (ctx->suspended)
-        mpv_resume(ctx->client);
+        release_core(ctx);
     if (ctx->state)
         lua_close(ctx->state);
     talloc_free(ctx);
@@ -328,11 +350,47 @@ static int script_find_config_file(lua_State *L)
     return 1;
 }
 
+// Resume the core if it's still suspended on behalf of this script.
+static void release_core(struct script_ctx *ctx)
+{
+    if (!ctx->core_released)
+        mpv_resume(ctx->client);
+    ctx->core_released = true;
+    lua_sethook(ctx->state, NULL, 0, 0);
+}
+
+// Lua count hook, installed while the core is suspended. Since it runs between
+// VM instructions, it also catches scripts stuck in loops.
+static void suspend_watchdog(lua_State *L, lua_Debug *ar)
+{
+    struct script_ctx *ctx = get_ctx(L);
+    if (!ctx->suspended || ctx->core_released)
+        return;
+    int64_t held = mp_time_us() - ctx->suspend_start;
+    if (held < ctx->suspend_limit)
+        return;
+    if (ctx->suspend_resume) {
+        MP_WARN(ctx, "Script kept the player suspended for %lld ms, "
+                "resuming.\n", (long long)(held / 1000));
+        release_core(ctx);
+    } else {
+        MP_WARN(ctx, "Script is keeping the player suspended for more than "
+                "%lld ms.\n", (long long)(held / 1000));
+        lua_sethook(L, NULL, 0, 0); // warn only once per suspend
+    }
+}
+
 static int script_suspend(lua_State *L)
 {
     struct script_ctx *ctx = get_ctx(L);
-    if (!ctx->suspended)
+    if (!ctx->suspended) {
         mpv_suspend(ctx->client);
+        ctx->suspend_start = mp_time_us();
+        ctx->core_released = false;
+        if (ctx->suspend_limit > 0)
+            lua_sethook(L, suspend_watchdog, LUA_MASKCOUNT,
+                        WATCHDOG_INSTRUCTIONS);
+    }
     ctx->suspended++;
     return 0;
 }
@@ -344,7 +402,7 @@ static int script_resume(lua_State *L)
         luaL_error(L, "trying to resume, but core is not suspended");
     ctx->suspended--;
     if (!ctx->suspended)
-        mpv_resume(ctx->client);
+        release_core(ctx);
     return 0;
 }
 
@@ -352,13 +410,36 @@ static int script_resume_all(lua_State *L)
 {
     struct script_ctx *ctx = get_ctx(L);
     if (ctx->suspended)
-        mpv_resume(ctx->client);
+        release_core(ctx);
     ctx->suspended = 0;
     return 0;
 }
 
 static bool pushnode(lua_State *L, mpv_node *node, int depth);
 
+// Make the script's CPU time and Lua heap size visible to the core (see the
+// script-stats property). Called before the script thread goes to sleep.
+static void update_stats(struct script_ctx *ctx)
+{
+    lua_State *L = ctx->state;
+    int64_t mem = lua_gc(L, LUA_GCCOUNT, 0) * (int64_t)1024 +
+                  lua_gc(L, LUA_GCCOUNTB, 0);
+    double cpu_time = -1;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    // Each script has its own thread, so this is the script's CPU time.
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        cpu_time = ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    mp_client_set_stats(ctx->client, cpu_time, mem);
+}
+
+// All fields script_wait_event() can set.
+static const char *const event_fields[] = {
+    "event", "id", "error", "prefix", "level", "text", "arg0", "type",
+    "args", "name", "data", NULL
+};
+
 static int script_wait_event(lua_State *L)
 {
     struct script_ctx *ctx = get_ctx(L);
@@ -366,12 +447,25 @@ static int script_wait_event(lua_State *L)
     double timeout = luaL_optnumber(L, 1, 1e20);
 
     // This will almost surely lead to a deadlock. (Polling is still ok.)
-    if (ctx->suspended && timeout > 0)
+    if (ctx->suspended && !ctx->core_released && timeout > 0)
         luaL_error(L, "attempting to wait while core is suspended");
 
+    if (timeout > 0)
+        update_stats(ctx);
+
     mpv_event *event = mpv_wait_event(ctx->client, timeout);
 
-    lua_newtable(L); // event
+    if (lua_istable(L, 2)) {
+        // Reuse the table passed by the caller, which avoids creating garbage
+        // for every event. Clear the fields set by the previous event.
+        lua_pushvalue(L, 2); // event
+        for (int n = 0; event_fields[n]; n++) {
+            lua_pushnil(L); // event nil
+            lua_setfield(L, -2, event_fields[n]); // event
+        }
+    } else {
+        lua_newtable(L); // event
+    }
     lua_pushstring(L, mpv_event_name(event->event_id)); // event name
     lua_setfield(L, -2, "event"); // event
 
@@ -430,6 +524,9 @@ static int script_wait_event(lua_State *L)
         case MPV_FORMAT_DOUBLE:
             lua_pushnumber(L, *(double *)prop->data);
             break;
+        case MPV_FORMAT_INT64:
+            lua_pushnumber(L, *(int64_t *)prop->data);
+            break;
         case MPV_FORMAT_FLAG:
             lua_pushboolean(L, *(int *)prop->data);
             break;
@@ -318,11 +318,20 @@ function mp.unregister_event(cb)
     end
 end
 
+-- Handlers which don't keep a reference to the event table. Only these get
+-- the table reused by mp.dispatch_events(); all others get a copy.
+local builtin_handlers = {}
+
+local function register_builtin_event(name, cb)
+    builtin_handlers[cb] = true
+    mp.register_event(name, cb)
+end
+
 -- default handlers
-mp.register_event("shutdown", function() mp.keep_running = false end)
-mp.register_event("script-input-dispatch", script_dispatch)
-mp.register_event("client-message", message_dispatch)
-mp.register_event("property-change", property_change)
+register_builtin_event("shutdown", function() mp.keep_running = false end)
+register_builtin_event("script-input-dispatch", script_dispatch)
+register_builtin_event("client-message", message_dispatch)
+register_builtin_event("property-change", property_change)
 
 mp.msg = {
     log = mp.log,
@@ -346,12 +355,26 @@ end
 local function call_event_handlers(e)
     local handlers = event_handlers[e.event]
     if handlers then
+        local copy = nil
         for _, handler in ipairs(handlers) do
-            handler(e)
+            if builtin_handlers[handler] then
+                handler(e)
+            else
+                if not copy then
+                    copy = {}
+                    for k, v in pairs(e) do
+                        copy[k] = v
+                    end
+                end
+                handler(copy)
+            end
         end
     end
 end
 
+-- Event table reused across mp.wait_event() calls by mp.dispatch_events().
+local event_cache = {}
+
 function mp.dispatch_events(allow_wait)
     local more_events = true
     mp.suspend()
@@ -371,7 +394,7 @@ function mp.dispatch_events(allow_wait)
                 return
             end
         end
-        local e = mp.wait_event(wait)
+        local e = mp.wait_event(wait, event_cache)
         -- Empty the event queue while suspended; otherwise, each
         -- event will keep us waiting until the core suspends again.
         mp.suspend()
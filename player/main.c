@@ -48,6 +48,7 @@
 #include "common/playlist.h"
 #include "options/options.h"
 #include "input/input.h"
+#include "input/ipc.h"
 
 #include "audio/decode/dec_audio.h"
 #include "audio/out/ao.h"
@@ -58,6 +59,7 @@
 #include "sub/osd.h"
 #include "video/decode/dec_video.h"
 #include "video/out/vo.h"
+#include "video/sws_utils.h"
 
 #include "core.h"
 #include "client.h"
@@ -121,6 +123,9 @@ void mp_destroy(struct MPContext *mpctx)
     if (mpctx->initialized)
         uninit_player(mpctx, INITIALIZED_ALL);
 
+    uninit_audio_thread(mpctx);
+    mp_discard_prefetch(mpctx);
+
 #if HAVE_ENCODING
     encode_lavc_finish(mpctx->encode_lavc_ctx);
     encode_lavc_free(mpctx->encode_lavc_ctx);
@@ -128,6 +133,11 @@ void mp_destroy(struct MPContext *mpctx)
 
     mpctx->encode_lavc_ctx = NULL;
 
+#if HAVE_UNIX_SOCKETS
+    mp_uninit_ipc(mpctx->ipc_ctx);
+    mpctx->ipc_ctx = NULL;
+#endif
+
     shutdown_clients(mpctx);
 
     command_uninit(mpctx);
@@ -137,6 +147,12 @@ void mp_destroy(struct MPContext *mpctx)
 
     osd_free(mpctx->osd);
 
+    struct mp_sws_cache_stats sws_stats;
+    mp_sws_get_cache_stats(&sws_stats);
+    MP_VERBOSE(mpctx, "swscale context cache: %lld hits, %lld misses\n",
+               sws_stats.hits, sws_stats.misses);
+    mp_sws_flush_cache();
+
 #if HAVE_LIBASS
     if (mpctx->ass_library)
         ass_library_done(mpctx->ass_library);
@@ -299,6 +315,7 @@ struct MPContext *mp_create(void)
     *mpctx = (struct MPContext){
         .last_dvb_step = 1,
         .last_chapter = -2,
+        .file_transition_time = -1,
         .term_osd_contents = talloc_strdup(mpctx, ""),
         .osd_progbar = { .type = -1 },
         .playlist = talloc_struct(mpctx, struct playlist, {0}),
@@ -442,6 +459,10 @@ int mp_initialize(struct MPContext *mpctx)
     // where this is safe.
     mp_load_scripts(mpctx);
 
+#if HAVE_UNIX_SOCKETS
+    mpctx->ipc_ctx = mp_init_ipc(mpctx->clients, mpctx->global);
+#endif
+
     if (opts->shuffle)
         playlist_shuffle(mpctx->playlist);
 
@@ -309,7 +309,10 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
     // Seek external, extra files too:
     for (int t = 0; t < mpctx->num_tracks; t++) {
         struct track *track = mpctx->tracks[t];
-        if (track->selected && track->is_external && track->demuxer) {
+        // Preloaded subtitles are read sequentially, even while loading.
+        if (track->selected && track->is_external && track->demuxer &&
+            !track->preloaded)
+        {
             double main_new_pos;
             if (seek.type == MPSEEK_ABSOLUTE) {
                 main_new_pos = seek.amount - mpctx->video_offset;
@@ -872,7 +875,7 @@ void handle_force_window(struct MPContext *mpctx, bool reconfig)
         // Pick whatever works
         int config_format = 0;
         for (int fmt = IMGFMT_START; fmt < IMGFMT_END; fmt++) {
-            if (vo->driver->query_format(vo, fmt)) {
+            if (vo_query_format(vo, fmt)) {
                 config_format = fmt;
                 break;
             }
@@ -993,7 +996,9 @@ void run_playloop(struct MPContext *mpctx)
         still_playing |= mpctx->last_frame_duration > 0;
 
         double frame_time = 0;
+        audio_thread_start_fill(mpctx, endpts);
         int r = update_video(mpctx, endpts, !still_playing, &frame_time);
+        audio_thread_stop_fill(mpctx);
 
         MP_VERBOSE(mpctx, "update_video: %d\n", r);
         if (r < 0) {
@@ -1112,6 +1117,7 @@ void run_playloop(struct MPContext *mpctx)
         MP_STATS(mpctx, "vo sleep");
 
         mpctx->time_frame -= get_relative_time(mpctx);
+        audio_thread_start_fill(mpctx, endpts);
         mpctx->time_frame -= vo->flip_queue_offset;
         if (mpctx->time_frame > 0.001)
             mpctx->time_frame = timing_sleep(mpctx, mpctx->time_frame);
@@ -1151,14 +1157,16 @@ void run_playloop(struct MPContext *mpctx)
         MP_STATS(mpctx, "start flip");
         vo_flip_page(vo, pts_us | 1, duration);
         MP_STATS(mpctx, "end flip");
+        audio_thread_stop_fill(mpctx);
 
         if (audio_pts != MP_NOPTS_VALUE)
             MP_STATS(mpctx, "value %f ptsdiff", mpctx->video_pts - audio_pts);
 
         mpctx->last_vo_flip_duration = (mp_time_us() - t2) * 0.000001;
-        if (vo->driver->flip_page_timed) {
-            // No need to adjust sync based on flip speed
-            mpctx->last_vo_flip_duration = 0;
+        if (vo_has_timed_flip(vo)) {
+            // No need to adjust sync based on flip speed, but take into
+            // account how late the VO actually presented the last frame.
+            mpctx->last_vo_flip_duration = vo_get_flip_delay(vo);
             // For print_status - VO call finishing early is OK for sync
             mpctx->time_frame -= get_relative_time(mpctx);
         }
@@ -1312,6 +1320,10 @@ void run_playloop(struct MPContext *mpctx)
 
     execute_queued_seek(mpctx);
 
+    mp_update_file_transition(mpctx);
+
+    mp_prefetch_next_file(mpctx);
+
     if (mpctx->opts->use_terminal)
         getch2_poll();
 }
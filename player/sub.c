@@ -38,6 +38,11 @@
 
 #include "core.h"
 
+// Load external subtitles at least this far ahead of the playback position.
+#define PRELOAD_WINDOW 10.0
+// Time spent on loading further subtitle packets per playloop iteration.
+#define PRELOAD_TIME 0.005
+
 void uninit_subs(struct demuxer *demuxer)
 {
     for (int i = 0; i < demuxer->num_streams; i++) {
@@ -108,6 +113,9 @@ static void update_subtitle(struct MPContext *mpctx, int order)
     double refpts_s = mpctx->playback_pts - state.video_offset;
     double curpts_s = refpts_s - opts->sub_delay;
 
+    if (track->preloaded)
+        sub_preload_packets(dec_sub, curpts_s + PRELOAD_WINDOW, PRELOAD_TIME);
+
     if (!track->preloaded && track->stream) {
         struct sh_stream *sh_stream = track->stream;
         bool interleaved = is_interleaved(mpctx, track);
@@ -219,9 +227,10 @@ static void reinit_subdec(struct MPContext *mpctx, struct track *track,
     // Don't do this if the file has video/audio streams. Don't do it even
     // if it has only sub streams, because reading packets will change the
     // demuxer position.
+    // The packets are loaded incrementally by update_subtitle().
     if (!track->preloaded && track->is_external) {
         demux_seek(track->demuxer, 0, SEEK_ABSOLUTE);
-        track->preloaded = sub_read_all_packets(dec_sub, track->stream);
+        track->preloaded = sub_preload_start(dec_sub, track->stream);
     }
 }
 
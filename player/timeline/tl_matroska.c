@@ -37,6 +37,7 @@
 #include "bstr/bstr.h"
 #include "common/common.h"
 #include "common/playlist.h"
+#include "misc/thread_pool.h"
 #include "stream/stream.h"
 
 struct find_entry {
@@ -246,6 +247,116 @@ static bool missing(struct demuxer **sources, int num_sources)
     return false;
 }
 
+// Maximum number of files scanned for segment UIDs at the same time.
+#define MAX_SCAN_THREADS 8
+
+// Segment UIDs of a file, as read by demux_matroska_read_segment_uids().
+struct uid_cache_entry {
+    char *filename;
+    time_t mtime;
+    off_t size;
+    struct matroska_segment_uid *uids;
+    int num_uids;           // 0 if not a Matroska file, or not readable
+};
+
+// Scan results are kept for the lifetime of the player, so playing several
+// files from the same directory scans it only once.
+struct mkv_uid_cache {
+    struct uid_cache_entry **entries;
+    int num_entries;
+};
+
+struct scan_job {
+    struct mpv_global *global;
+    struct mp_log *log;
+    struct uid_cache_entry *entry;
+};
+
+static void scan_file_fn(void *ctx)
+{
+    struct scan_job *job = ctx;
+    struct uid_cache_entry *e = job->entry;
+    struct stream *s = stream_open(e->filename, job->global);
+    if (!s)
+        return;
+    e->num_uids = demux_matroska_read_segment_uids(s, job->log, e, &e->uids);
+    free_stream(s);
+}
+
+// Return the segment UIDs of all files, reading the files which are not in the
+// cache (or changed since) in parallel. An entry is NULL if the file couldn't
+// be stat()ed (e.g. it's not a local file).
+static struct uid_cache_entry **scan_files(struct MPContext *mpctx,
+                                           void *ta_parent, char **filenames,
+                                           int num_filenames)
+{
+    if (!mpctx->mkv_uid_cache)
+        mpctx->mkv_uid_cache = talloc_zero(mpctx, struct mkv_uid_cache);
+    struct mkv_uid_cache *cache = mpctx->mkv_uid_cache;
+    struct uid_cache_entry **res =
+        talloc_zero_array(ta_parent, struct uid_cache_entry *, num_filenames);
+    struct mp_thread_pool *pool = NULL;
+    int num_scanned = 0;
+
+    for (int i = 0; i < num_filenames; i++) {
+        struct stat st;
+        if (stat(filenames[i], &st) != 0)
+            continue;
+        struct uid_cache_entry *e = NULL;
+        for (int n = 0; n < cache->num_entries; n++) {
+            if (strcmp(cache->entries[n]->filename, filenames[i]) == 0) {
+                e = cache->entries[n];
+                if (e->mtime != st.st_mtime || e->size != st.st_size) {
+                    MP_TARRAY_REMOVE_AT(cache->entries, cache->num_entries, n);
+                    talloc_free(e);
+                    e = NULL;
+                }
+                break;
+            }
+        }
+        if (!e) {
+            e = talloc_ptrtype(cache, e);
+            *e = (struct uid_cache_entry){
+                .filename = talloc_strdup(e, filenames[i]),
+                .mtime = st.st_mtime,
+                .size = st.st_size,
+            };
+            MP_TARRAY_APPEND(cache, cache->entries, cache->num_entries, e);
+            struct scan_job *job = talloc_ptrtype(ta_parent, job);
+            *job = (struct scan_job){mpctx->global, mpctx->log, e};
+            if (!pool && num_scanned == 0) {
+                pool = mp_thread_pool_create(NULL,
+                                    MPMIN(num_filenames, MAX_SCAN_THREADS));
+            }
+            if (pool) {
+                mp_thread_pool_queue(pool, scan_file_fn, job);
+            } else {
+                scan_file_fn(job);
+            }
+            num_scanned++;
+        }
+        res[i] = e;
+    }
+    talloc_free(pool); // waits until all files are scanned
+    MP_VERBOSE(mpctx, "Read segment UIDs from %d of %d files.\n",
+               num_scanned, num_filenames);
+    return res;
+}
+
+// Whether the file contains a segment for one of the missing sources.
+static bool has_wanted_segment(struct uid_cache_entry *e,
+                               struct demuxer **sources, int num_sources,
+                               struct matroska_segment_uid *uids)
+{
+    for (int n = 0; n < e->num_uids; n++) {
+        for (int i = 1; i < num_sources; i++) {
+            if (!sources[i] && !memcmp(e->uids[n].segment, uids[i].segment, 16))
+                return true;
+        }
+    }
+    return false;
+}
+
 static int find_ordered_chapter_sources(struct MPContext *mpctx,
                                         struct demuxer ***sources,
                                         int *num_sources,
@@ -255,6 +366,7 @@ static int find_ordered_chapter_sources(struct MPContext *mpctx,
     void *tmp = talloc_new(NULL);
     int num_filenames = 0;
     char **filenames = NULL;
+    struct uid_cache_entry **scanned = NULL;
     if (*num_sources > 1) {
         char *main_filename = mpctx->demuxer->filename;
         MP_INFO(mpctx, "This file references data from "
@@ -277,6 +389,9 @@ static int find_ordered_chapter_sources(struct MPContext *mpctx,
             num_filenames = MP_TALLOC_ELEMS(filenames);
             talloc_steal(tmp, filenames);
         }
+        // Read only the segment UIDs first, so that full demuxers are opened
+        // only for files which contain wanted segments.
+        scanned = scan_files(mpctx, tmp, filenames, num_filenames);
         // Possibly get further segments appended to the first segment
         check_file(mpctx, sources, num_sources, uids, main_filename, 1);
     }
@@ -287,6 +402,9 @@ static int find_ordered_chapter_sources(struct MPContext *mpctx,
         for (int i = 0; i < num_filenames; i++) {
             if (!missing(*sources, *num_sources))
                 break;
+            if (scanned && scanned[i] &&
+                !has_wanted_segment(scanned[i], *sources, *num_sources, *uids))
+                continue;
             MP_INFO(mpctx, "Checking file %s\n", filenames[i]);
             check_file(mpctx, sources, num_sources, uids, filenames[i], 0);
         }
@@ -59,7 +59,7 @@ static void set_allowed_vo_formats(struct vf_chain *c, struct vo *vo)
 {
     for (int fmt = IMGFMT_START; fmt < IMGFMT_END; fmt++) {
         c->allowed_output_formats[fmt - IMGFMT_START] =
-            vo->driver->query_format(vo, fmt);
+            vo_query_format(vo, fmt);
     }
 }
 
@@ -284,8 +284,7 @@ static int check_framedrop(struct MPContext *mpctx, double frame_time)
     if (mpctx->d_audio && !ao_untimed(mpctx->ao) && sh_audio &&
         !demux_stream_eof(sh_audio))
     {
-        float delay = opts->playback_speed * ao_get_delay(mpctx->ao);
-        float d = delay - mpctx->delay;
+        float d = get_audio_sync_delay(mpctx);
         float fps = mpctx->d_video->fps;
         if (frame_time < 0)
             frame_time = fps > 0 ? 1.0 / fps : 0;
@@ -295,7 +294,7 @@ static int check_framedrop(struct MPContext *mpctx, double frame_time)
             && !mpctx->restart_playback) {
             mpctx->drop_frame_cnt++;
             mpctx->dropped_frames++;
-            return mpctx->opts->frame_dropping;
+            return opts->frame_dropping;
         } else
             mpctx->dropped_frames = 0;
     }
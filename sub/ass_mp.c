@@ -29,6 +29,9 @@
 
 #include <libavutil/common.h>
 
+#include "talloc.h"
+
+#include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
 #include "options/path.h"
@@ -237,3 +240,183 @@ ASS_Library *mp_ass_init(struct mpv_global *global, struct mp_log *log)
     talloc_free(path);
     return priv;
 }
+
+// Events with a longer duration are kept in a separate list, which is always
+// searched completely. This bounds the number of events to look at in
+// mp_ass_index_find() for the rest.
+#define INDEX_LONG_EVENT_MS 10000
+
+struct mp_ass_index {
+    int num_indexed;    // track->events[0..num_indexed) are indexed
+    int *by_start;      // indexes of all events, sorted by (start, index)
+    int *by_end;        // indexes of all events, sorted by (end, index)
+    int *long_events;   // events longer than INDEX_LONG_EVENT_MS
+    int num_long;
+    int *found;         // result of mp_ass_index_find()
+    int num_found;
+};
+
+struct mp_ass_index *mp_ass_index_create(void *ta_parent)
+{
+    return talloc_zero(ta_parent, struct mp_ass_index);
+}
+
+void mp_ass_index_reset(struct mp_ass_index *idx)
+{
+    idx->num_indexed = 0;
+    idx->num_long = 0;
+}
+
+static long long event_key(ASS_Track *track, int n, bool end)
+{
+    ASS_Event *event = &track->events[n];
+    return event->Start + (end ? event->Duration : 0);
+}
+
+// Return the position of the first entry in list with a key > key.
+static int upper_bound(ASS_Track *track, int *list, int num, bool end,
+                       long long key)
+{
+    int lo = 0, hi = num;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (event_key(track, list[mid], end) <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void insert_sorted(ASS_Track *track, int *list, int num, bool end,
+                          int n)
+{
+    // Events are usually added in order, so this is mostly an append.
+    int pos = upper_bound(track, list, num, end, event_key(track, n, end));
+    memmove(list + pos + 1, list + pos, (num - pos) * sizeof(list[0]));
+    list[pos] = n;
+}
+
+// Add the events which were added to the track since the last call.
+static void update_index(struct mp_ass_index *idx, ASS_Track *track)
+{
+    if (track->n_events < idx->num_indexed)
+        mp_ass_index_reset(idx);
+    if (track->n_events == idx->num_indexed)
+        return;
+    idx->by_start = talloc_realloc(idx, idx->by_start, int, track->n_events);
+    idx->by_end = talloc_realloc(idx, idx->by_end, int, track->n_events);
+    for (int n = idx->num_indexed; n < track->n_events; n++) {
+        insert_sorted(track, idx->by_start, n, false, n);
+        insert_sorted(track, idx->by_end, n, true, n);
+        if (track->events[n].Duration > INDEX_LONG_EVENT_MS)
+            MP_TARRAY_APPEND(idx, idx->long_events, idx->num_long, n);
+    }
+    idx->num_indexed = track->n_events;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return ia > ib ? 1 : (ia < ib ? -1 : 0);
+}
+
+// Find the events shown at now (in ms). *events is set to the indexes of the
+// events in ascending order, and is valid until the next call.
+int mp_ass_index_find(struct mp_ass_index *idx, ASS_Track *track,
+                      long long now, int **events)
+{
+    update_index(idx, track);
+    idx->num_found = 0;
+    int start_pos = upper_bound(track, idx->by_start, idx->num_indexed, false,
+                                now);
+    for (int i = start_pos - 1; i >= 0; i--) {
+        int n = idx->by_start[i];
+        ASS_Event *event = &track->events[n];
+        // No short event starting this early can still be shown.
+        if (event->Start + INDEX_LONG_EVENT_MS <= now)
+            break;
+        if (event->Duration <= INDEX_LONG_EVENT_MS &&
+            now < event->Start + event->Duration)
+            MP_TARRAY_APPEND(idx, idx->found, idx->num_found, n);
+    }
+    for (int i = 0; i < idx->num_long; i++) {
+        ASS_Event *event = &track->events[idx->long_events[i]];
+        if (event->Start <= now && now < event->Start + event->Duration) {
+            MP_TARRAY_APPEND(idx, idx->found, idx->num_found,
+                             idx->long_events[i]);
+        }
+    }
+    qsort(idx->found, idx->num_found, sizeof(idx->found[0]), compare_int);
+    *events = idx->found;
+    return idx->num_found;
+}
+
+// Return the first time after t (in ms) at which an event starts or ends, or
+// -1 if there is none.
+long long mp_ass_index_next_change(struct mp_ass_index *idx, ASS_Track *track,
+                                   long long t)
+{
+    update_index(idx, track);
+    int num = idx->num_indexed;
+    long long next = -1;
+    int pos = upper_bound(track, idx->by_start, num, false, t);
+    if (pos < num)
+        next = event_key(track, idx->by_start[pos], false);
+    pos = upper_bound(track, idx->by_end, num, true, t);
+    if (pos < num) {
+        long long end = event_key(track, idx->by_end[pos], true);
+        if (next < 0 || end < next)
+            next = end;
+    }
+    return next;
+}
+
+// Same as ass_step_sub(), but using the index.
+long long mp_ass_index_step(struct mp_ass_index *idx, ASS_Track *track,
+                            long long now, int movement)
+{
+    update_index(idx, track);
+    int num = idx->num_indexed;
+    if (!num)
+        return 0;
+
+    int direction = movement > 0 ? 1 : (movement < 0 ? -1 : 0);
+    long long target = now;
+    int best = -1;
+    do {
+        int closest = -1;
+        long long closest_time = now;
+        if (direction < 0) {
+            // Latest end before target; the first such event if equal.
+            int pos = upper_bound(track, idx->by_end, num, true, target - 1);
+            if (pos > 0) {
+                closest_time = event_key(track, idx->by_end[pos - 1], true);
+                pos = upper_bound(track, idx->by_end, num, true,
+                                  closest_time - 1);
+                closest = idx->by_end[pos];
+            }
+        } else if (direction > 0) {
+            // Earliest start after target; the first such event if equal.
+            int pos = upper_bound(track, idx->by_start, num, false, target);
+            if (pos < num) {
+                closest = idx->by_start[pos];
+                closest_time = event_key(track, closest, false);
+            }
+        } else {
+            // Latest start before target; the last such event if equal.
+            int pos = upper_bound(track, idx->by_start, num, false, target - 1);
+            if (pos > 0) {
+                closest = idx->by_start[pos - 1];
+                closest_time = event_key(track, closest, false);
+            }
+        }
+        target = closest_time + direction;
+        movement -= direction;
+        if (closest >= 0)
+            best = closest;
+    } while (movement);
+
+    return best >= 0 ? track->events[best].Start - now : 0;
+}
@@ -64,5 +64,18 @@ struct sub_bitmaps;
 void mp_ass_render_frame(ASS_Renderer *renderer, ASS_Track *track, double time,
                          struct sub_bitmap **parts, struct sub_bitmaps *res);
 
+// Index for looking up the events of a track by time. Events added to the
+// track are picked up automatically; call mp_ass_index_reset() if events were
+// removed.
+struct mp_ass_index;
+struct mp_ass_index *mp_ass_index_create(void *ta_parent);
+void mp_ass_index_reset(struct mp_ass_index *idx);
+int mp_ass_index_find(struct mp_ass_index *idx, ASS_Track *track,
+                      long long now, int **events);
+long long mp_ass_index_next_change(struct mp_ass_index *idx, ASS_Track *track,
+                                   long long t);
+long long mp_ass_index_step(struct mp_ass_index *idx, ASS_Track *track,
+                            long long now, int movement);
+
 #endif                          /* HAVE_LIBASS */
 #endif                          /* MPLAYER_ASS_MP_H */
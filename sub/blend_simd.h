@@ -0,0 +1,56 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_SUB_BLEND_SIMD_H
+#define MP_SUB_BLEND_SIMD_H
+
+// Helpers for the SSE2 versions of the subtitle blending functions. They
+// compute exactly the same results as the C versions.
+
+#include "video/filter/simd.h"
+
+#if HAVE_X86_SIMD
+
+// x / 65025 for 4 unsigned 32 bit lanes with x < 2^24 (exact in this range).
+static inline __m128i SSE2_FN mp_div65025_epu32(__m128i x)
+{
+    const __m128i m = _mm_set1_epi32(16909061); // ceil(2^40 / 65025)
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(x, m), 40);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), m), 40);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+// (c * a + d * (65025 - a) + round) / 65025 for 8 unsigned 16 bit lanes,
+// with c, d <= 255, a <= 65025, and round given as 32 bit lanes.
+static inline __m128i SSE2_FN mp_blend65025_epu16(__m128i c, __m128i d,
+                                                  __m128i a, __m128i round)
+{
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16((short)65025), a);
+    __m128i cl = _mm_mullo_epi16(c, a), ch = _mm_mulhi_epu16(c, a);
+    __m128i dl = _mm_mullo_epi16(d, inv), dh = _mm_mulhi_epu16(d, inv);
+    __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(cl, ch),
+                               _mm_unpacklo_epi16(dl, dh));
+    __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(cl, ch),
+                               _mm_unpackhi_epi16(dl, dh));
+    lo = mp_div65025_epu32(_mm_add_epi32(lo, round));
+    hi = mp_div65025_epu32(_mm_add_epi32(hi, round));
+    return _mm_packs_epi32(lo, hi);
+}
+
+#endif
+
+#endif
@@ -32,6 +32,7 @@
 #include "common/msg.h"
 #include "misc/charset_conv.h"
 #include "osdep/threads.h"
+#include "osdep/timer.h"
 
 extern const struct sd_functions sd_ass;
 extern const struct sd_functions sd_lavc;
@@ -56,18 +57,42 @@ static const struct sd_functions *sd_list[] = {
 
 #define MAX_NUM_SD 3
 
+// Amount of subtitle data used to guess the charset.
+#define CHARSET_PROBE_SIZE (256 * 1024)
+
+// Number of packets read between checking the time budget when preloading.
+#define PRELOAD_CHUNK 64
+
 struct dec_sub {
     pthread_mutex_t lock;
 
     struct mp_log *log;
+    struct mpv_global *global;
     struct MPOpts *opts;
     struct sd init_sd;
 
     double video_fps;
     const char *charset;
+    struct mp_charset_conv *charset_conv;
+    bool preloaded;
+    struct sub_preload *preload;
 
     struct sd *sd[MAX_NUM_SD];
     int num_sd;
+
+    // --sub-prerender worker thread
+    pthread_t prerender_thread;
+    pthread_cond_t prerender_wakeup;
+    bool prerender_started;
+    bool prerender_running;
+    bool prerender_exit;
+    bool prerender_pending;
+    struct mp_osd_res prerender_dim;
+    double prerender_pts;
+    int prerender_request;          // incremented on each new request
+    // The prerender thread has nothing to do for requests with the same dim,
+    // and prerender_pts <= pts < prerender_idle_until (if not NOPTS).
+    double prerender_idle_until;
 };
 
 struct packet_list {
@@ -75,6 +100,22 @@ struct packet_list {
     int num_packets;
 };
 
+// State for loading an external subtitle file incrementally.
+struct sub_preload {
+    struct sh_stream *sh;
+    // In some cases, we want to put the packets through a decoder first.
+    // Preprocess until sub->sd[preprocess].
+    int preprocess;
+    double speed;
+    bool fix_overlaps;
+    bool fix_last_duration;
+    // Packets read, but not yet decoded. The last one is held back until the
+    // next one is read, so fix_overlaps_and_gaps() can adjust it.
+    struct packet_list *pending;
+    double loaded_pts;
+    bool eof;
+};
+
 
 void sub_lock(struct dec_sub *sub)
 {
@@ -93,9 +134,12 @@ struct dec_sub *sub_create(struct mpv_global *global)
 {
     struct dec_sub *sub = talloc_zero(NULL, struct dec_sub);
     sub->log = mp_log_new(sub, global->log, "sub");
+    sub->global = global;
     sub->opts = global->opts;
 
     mpthread_mutex_init_recursive(&sub->lock);
+    pthread_cond_init(&sub->prerender_wakeup, NULL);
+    sub->prerender_idle_until = MP_NOPTS_VALUE;
 
     return sub;
 }
@@ -111,11 +155,59 @@ static void sub_uninit(struct dec_sub *sub)
     sub->num_sd = 0;
 }
 
+static struct sd *sub_get_last_sd(struct dec_sub *sub)
+{
+    return sub->num_sd ? sub->sd[sub->num_sd - 1] : NULL;
+}
+
+static void *prerender_thread(void *p)
+{
+    struct dec_sub *sub = p;
+    pthread_mutex_lock(&sub->lock);
+    while (!sub->prerender_exit) {
+        struct sd *sd = sub_get_last_sd(sub);
+        bool more = false;
+        int request = sub->prerender_request;
+        double idle_until = MP_NOPTS_VALUE;
+        if (sub->prerender_pending && sd && sd->driver->prerender) {
+            more = sd->driver->prerender(sd, sub->prerender_dim,
+                                         sub->prerender_pts, &sub->lock,
+                                         &idle_until);
+        }
+        if (more) {
+            // Give sub_get_bitmaps() a chance to get the lock.
+            mpthread_cond_timedwait(&sub->prerender_wakeup, &sub->lock, 0.001);
+        } else if (request != sub->prerender_request) {
+            // A new request came in while the lock was released.
+        } else {
+            sub->prerender_pending = false;
+            sub->prerender_idle_until = idle_until;
+            pthread_cond_wait(&sub->prerender_wakeup, &sub->lock);
+        }
+    }
+    pthread_mutex_unlock(&sub->lock);
+    return NULL;
+}
+
+static void stop_prerender(struct dec_sub *sub)
+{
+    if (!sub->prerender_running)
+        return;
+    pthread_mutex_lock(&sub->lock);
+    sub->prerender_exit = true;
+    pthread_cond_signal(&sub->prerender_wakeup);
+    pthread_mutex_unlock(&sub->lock);
+    pthread_join(sub->prerender_thread, NULL);
+    sub->prerender_running = false;
+}
+
 void sub_destroy(struct dec_sub *sub)
 {
     if (!sub)
         return;
+    stop_prerender(sub);
     sub_uninit(sub);
+    pthread_cond_destroy(&sub->prerender_wakeup);
     pthread_mutex_destroy(&sub->lock);
     talloc_free(sub);
 }
@@ -128,11 +220,6 @@ bool sub_is_initialized(struct dec_sub *sub)
     return r;
 }
 
-static struct sd *sub_get_last_sd(struct dec_sub *sub)
-{
-    return sub->num_sd ? sub->sd[sub->num_sd - 1] : NULL;
-}
-
 void sub_set_video_res(struct dec_sub *sub, int w, int h)
 {
     pthread_mutex_lock(&sub->lock);
@@ -213,6 +300,7 @@ void sub_init_from_sh(struct dec_sub *sub, struct sh_stream *sh)
     while (sub->num_sd < MAX_NUM_SD) {
         struct sd *sd = talloc(NULL, struct sd);
         *sd = init_sd;
+        sd->global = sub->global;
         sd->opts = sub->opts;
         if (sub_init_decoder(sub, sd) < 0) {
             talloc_free(sd);
@@ -263,13 +351,12 @@ static void decode_chain(struct sd **sd, int num_sd, struct demux_packet *packet
     }
 }
 
-static struct demux_packet *recode_packet(struct mp_log *log,
-                                          struct demux_packet *in,
-                                          const char *charset)
+static struct demux_packet *recode_packet(struct mp_charset_conv *charset_conv,
+                                          struct demux_packet *in)
 {
     struct demux_packet *pkt = NULL;
     bstr in_buf = {in->buffer, in->len};
-    bstr conv = mp_iconv_to_utf8(log, in_buf, charset, MP_ICONV_VERBOSE);
+    bstr conv = mp_charset_conv_to_utf8(charset_conv, in_buf);
     if (conv.start && conv.start != in_buf.start) {
         pkt = talloc_ptrtype(NULL, pkt);
         talloc_steal(pkt, conv.start);
@@ -289,8 +376,14 @@ static void decode_chain_recode(struct dec_sub *sub, struct sd **sd, int num_sd,
 {
     if (num_sd > 0) {
         struct demux_packet *recoded = NULL;
-        if (sub->charset)
-            recoded = recode_packet(sub->log, packet, sub->charset);
+        if (sub->charset) {
+            if (!sub->charset_conv) {
+                sub->charset_conv = mp_charset_conv_create(sub, sub->log,
+                                                           sub->charset,
+                                                           MP_ICONV_VERBOSE);
+            }
+            recoded = recode_packet(sub->charset_conv, packet);
+        }
         decode_chain(sd, num_sd, recoded ? recoded : packet);
         talloc_free(recoded);
     }
@@ -311,7 +404,7 @@ static const char *guess_sub_cp(struct mp_log *log, struct packet_list *subs,
 
     // Concat all subs into a buffer. We can't probably do much better without
     // having the original data (which we don't, not anymore).
-    int max_size = 2 * 1024 * 1024;
+    int max_size = CHARSET_PROBE_SIZE;
     const char *sep = "\n\n"; // In utf-16: U+0A0A GURMUKHI LETTER UU
     int sep_len = strlen(sep);
     int num_pkt = 0;
@@ -335,15 +428,12 @@ static const char *guess_sub_cp(struct mp_log *log, struct packet_list *subs,
     return guess;
 }
 
-static void multiply_timings(struct packet_list *subs, double factor)
+static void multiply_timings(struct demux_packet *pkt, double factor)
 {
-    for (int n = 0; n < subs->num_packets; n++) {
-        struct demux_packet *pkt = subs->packets[n];
-        if (pkt->pts != MP_NOPTS_VALUE)
-            pkt->pts *= factor;
-        if (pkt->duration > 0)
-            pkt->duration *= factor;
-    }
+    if (pkt->pts != MP_NOPTS_VALUE)
+        pkt->pts *= factor;
+    if (pkt->duration > 0)
+        pkt->duration *= factor;
 }
 
 #define MS_TS(f_ts) ((int)((f_ts) * 1000 + 0.5))
@@ -377,15 +467,16 @@ static void fix_overlaps_and_gaps(struct packet_list *subs)
     }
 }
 
-static void add_sub_list(struct dec_sub *sub, int at, struct packet_list *subs)
+static void add_sub_list(struct dec_sub *sub, int at,
+                         struct demux_packet **packets, int num_packets)
 {
     struct sd *sd = sub_get_last_sd(sub);
     assert(sd);
 
     sd->no_remove_duplicates = true;
 
-    for (int n = 0; n < subs->num_packets; n++)
-        decode_chain_recode(sub, sub->sd + at, sub->num_sd - at, subs->packets[n]);
+    for (int n = 0; n < num_packets; n++)
+        decode_chain_recode(sub, sub->sd + at, sub->num_sd - at, packets[n]);
 
     // Hack for broken FFmpeg packet format: make sd_ass keep the subtitle
     // events on reset(), even if broken FFmpeg ASS packets were received
@@ -404,9 +495,80 @@ static void add_packet(struct packet_list *subs, struct demux_packet *pkt)
     MP_TARRAY_APPEND(subs, subs->packets, subs->num_packets, pkt);
 }
 
-// Read all packets from the demuxer and decode/add them. Returns false if
-// there are circumstances which makes this not possible.
-bool sub_read_all_packets(struct dec_sub *sub, struct sh_stream *sh)
+// Read the next packet from the demuxer into p->pending. Returns false on EOF.
+static bool read_preload_packet(struct dec_sub *sub, struct sub_preload *p)
+{
+    struct packet_list *subs = p->pending;
+    int preprocess = p->preprocess;
+    int first = subs->num_packets;
+
+    struct demux_packet *pkt = demux_read_packet(p->sh);
+    if (!pkt) {
+        p->eof = true;
+        return false;
+    }
+    if (preprocess) {
+        decode_chain(sub->sd, preprocess, pkt);
+        talloc_free(pkt);
+        while (1) {
+            pkt = get_decoded_packet(sub->sd[preprocess - 1]);
+            if (!pkt)
+                break;
+            add_packet(subs, pkt);
+        }
+    } else {
+        add_packet(subs, pkt);
+        talloc_free(pkt);
+    }
+
+    if (p->speed != 1.0) {
+        for (int n = first; n < subs->num_packets; n++)
+            multiply_timings(subs->packets[n], p->speed);
+    }
+    return true;
+}
+
+// Decode the pending packets, except the last one if not at EOF.
+static void decode_preload_packets(struct dec_sub *sub, struct sub_preload *p)
+{
+    struct packet_list *subs = p->pending;
+
+    if (p->fix_overlaps)
+        fix_overlaps_and_gaps(subs);
+
+    int num = subs->num_packets;
+    if (!p->eof)
+        num = MPMAX(num - 1, 0);
+
+    if (p->eof && p->fix_last_duration && num) {
+        // The last subtitle event in MicroDVD subs can have duration unset,
+        // which means show the subtitle until end of video.
+        // See FFmpeg FATE MicroDVD_capability_tester.sub
+        struct demux_packet *last = subs->packets[num - 1];
+        if (last->duration <= 0)
+            last->duration = 10; // arbitrary
+    }
+
+    if (!num)
+        return;
+
+    add_sub_list(sub, p->preprocess, subs->packets, num);
+
+    for (int n = 0; n < num; n++) {
+        struct demux_packet *pkt = subs->packets[n];
+        if (pkt->pts != MP_NOPTS_VALUE)
+            p->loaded_pts = MPMAX(p->loaded_pts, pkt->pts);
+        talloc_free(pkt);
+    }
+    subs->num_packets -= num;
+    memmove(subs->packets, subs->packets + num,
+            subs->num_packets * sizeof(subs->packets[0]));
+}
+
+// Prepare reading all packets from the demuxer and decoding/adding them with
+// sub_preload_packets(). Returns false if there are circumstances which makes
+// this not possible. The charset is guessed from the start of the file.
+bool sub_preload_start(struct dec_sub *sub, struct sh_stream *sh)
 {
     assert(sh && sh->sub);
     struct MPOpts *opts = sub->opts;
@@ -418,81 +580,97 @@ bool sub_read_all_packets(struct dec_sub *sub, struct sh_stream *sh)
         return false;
     }
 
-    struct packet_list *subs = talloc_zero(NULL, struct packet_list);
-
-    // In some cases, we want to put the packets through a decoder first.
-    // Preprocess until sub->sd[preprocess].
-    int preprocess = 0;
+    struct sub_preload *p = talloc_zero(sub, struct sub_preload);
+    *p = (struct sub_preload) {
+        .sh = sh,
+        .pending = talloc_zero(p, struct packet_list),
+        .speed = 1.0,
+        .fix_overlaps = !opts->suboverlap_enabled,
+        .fix_last_duration = sh->codec && strcmp(sh->codec, "microdvd") == 0,
+        .loaded_pts = MP_NOPTS_VALUE,
+    };
 
     // movtext is currently the only subtitle format that has text output,
     // but binary input. Do charset conversion after converting to text.
     if (sub->sd[0]->driver == &sd_movtext)
-        preprocess = 1;
+        p->preprocess = 1;
 
     // Broken Libav libavformat srt packet format (fix timestamps first).
     if (sub->sd[0]->driver == &sd_lavf_srt)
-        preprocess = 1;
-
-    for (;;) {
-        struct demux_packet *pkt = demux_read_packet(sh);
-        if (!pkt)
-            break;
-        if (preprocess) {
-            decode_chain(sub->sd, preprocess, pkt);
-            talloc_free(pkt);
-            while (1) {
-                pkt = get_decoded_packet(sub->sd[preprocess - 1]);
-                if (!pkt)
-                    break;
-                add_packet(subs, pkt);
-            }
-        } else {
-            add_packet(subs, pkt);
-            talloc_free(pkt);
+        p->preprocess = 1;
+
+    if (opts->sub_cp && !sh->sub->is_utf8) {
+        int size = 0;
+        while (size < CHARSET_PROBE_SIZE && read_preload_packet(sub, p)) {
+            struct packet_list *subs = p->pending;
+            size += subs->num_packets ? subs->packets[subs->num_packets - 1]->len
+                                      : 0;
         }
+        sub->charset = guess_sub_cp(sub->log, p->pending, opts->sub_cp);
     }
 
-    if (opts->sub_cp && !sh->sub->is_utf8)
-        sub->charset = guess_sub_cp(sub->log, subs, opts->sub_cp);
-
     if (sub->charset && sub->charset[0] && !mp_charset_is_utf8(sub->charset))
         MP_INFO(sub, "Using subtitle charset: %s\n", sub->charset);
 
-    double sub_speed = 1.0;
-
     if (sub->video_fps && sh->sub->frame_based > 0) {
         MP_VERBOSE(sub, "Frame based format, dummy FPS: %f, video FPS: %f\n",
                    sh->sub->frame_based, sub->video_fps);
-        sub_speed *= sh->sub->frame_based / sub->video_fps;
+        p->speed *= sh->sub->frame_based / sub->video_fps;
     }
 
     if (opts->sub_fps && sub->video_fps)
-        sub_speed *= opts->sub_fps / sub->video_fps;
+        p->speed *= opts->sub_fps / sub->video_fps;
 
-    sub_speed *= opts->sub_speed;
+    p->speed *= opts->sub_speed;
 
-    if (sub_speed != 1.0)
-        multiply_timings(subs, sub_speed);
+    if (p->speed != 1.0) {
+        for (int n = 0; n < p->pending->num_packets; n++)
+            multiply_timings(p->pending->packets[n], p->speed);
+    }
 
-    if (!opts->suboverlap_enabled)
-        fix_overlaps_and_gaps(subs);
+    sub->preload = p;
+    sub->preloaded = true;
 
-    if (sh->codec && strcmp(sh->codec, "microdvd") == 0) {
-        // The last subtitle event in MicroDVD subs can have duration unset,
-        // which means show the subtitle until end of video.
-        // See FFmpeg FATE MicroDVD_capability_tester.sub
-        if (subs->num_packets) {
-            struct demux_packet *last = subs->packets[subs->num_packets - 1];
-            if (last->duration <= 0)
-                last->duration = 10; // arbitrary
+    pthread_mutex_unlock(&sub->lock);
+    return true;
+}
+
+// Continue loading packets started with sub_preload_start(). Packets are read
+// at least until pts is covered (assuming the file is sorted by time), then
+// until max_time seconds have passed. Returns true once everything is loaded.
+bool sub_preload_packets(struct dec_sub *sub, double pts, double max_time)
+{
+    pthread_mutex_lock(&sub->lock);
+
+    struct sub_preload *p = sub->preload;
+    if (!p) {
+        pthread_mutex_unlock(&sub->lock);
+        return true;
+    }
+
+    double end = mp_time_sec() + max_time;
+    while (!p->eof) {
+        bool covered = p->loaded_pts != MP_NOPTS_VALUE && p->loaded_pts >= pts;
+        if (covered && mp_time_sec() >= end)
+            break;
+        for (int n = 0; n < PRELOAD_CHUNK; n++) {
+            if (!read_preload_packet(sub, p))
+                break;
         }
+        decode_preload_packets(sub, p);
+        sub->prerender_idle_until = MP_NOPTS_VALUE; // new events
     }
 
-    add_sub_list(sub, preprocess, subs);
+    bool done = p->eof;
+    if (done) {
+        decode_preload_packets(sub, p);
+        MP_VERBOSE(sub, "Subtitle file loaded.\n");
+        talloc_free(p);
+        sub->preload = NULL;
+    }
 
     pthread_mutex_unlock(&sub->lock);
-    talloc_free(subs);
-    return true;
+    return done;
 }
 
 bool sub_accept_packets_in_advance(struct dec_sub *sub)
@@ -505,6 +683,38 @@ bool sub_accept_packets_in_advance(struct dec_sub *sub)
     return r;
 }
 
+static bool osd_res_equals(struct mp_osd_res a, struct mp_osd_res b)
+{
+    return a.w == b.w && a.h == b.h && a.mt == b.mt && a.mb == b.mb &&
+           a.ml == b.ml && a.mr == b.mr && a.display_par == b.display_par;
+}
+
+// Called with sub->lock held. Let the prerender thread continue from pts.
+// The thread is only woken up if it could have something new to do.
+static void start_prerender(struct dec_sub *sub, struct mp_osd_res dim,
+                            double pts)
+{
+    if (sub->prerender_started && !sub->prerender_pending &&
+        sub->prerender_idle_until != MP_NOPTS_VALUE &&
+        osd_res_equals(dim, sub->prerender_dim) &&
+        pts >= sub->prerender_pts && pts < sub->prerender_idle_until)
+        return;
+    if (!sub->prerender_started) {
+        sub->prerender_started = true;
+        if (pthread_create(&sub->prerender_thread, NULL, prerender_thread, sub))
+        {
+            MP_ERR(sub, "Could not start subtitle prerender thread.\n");
+            return;
+        }
+        sub->prerender_running = true;
+    }
+    sub->prerender_dim = dim;
+    sub->prerender_pts = pts;
+    sub->prerender_pending = true;
+    sub->prerender_request++;
+    pthread_cond_signal(&sub->prerender_wakeup);
+}
+
 // You must call sub_lock/sub_unlock if more than 1 thread access sub.
 // The issue is that *res will contain decoder allocated data, which might
 // be deallocated on the next decoder access.
@@ -518,6 +728,8 @@ void sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim, double pts,
     if (sd && opts->sub_visibility) {
         if (sd->driver->get_bitmaps)
             sd->driver->get_bitmaps(sd, dim, pts, res);
+        if (sd->driver->prerender && opts->sub_prerender && sub->preloaded)
+            start_prerender(sub, dim, pts);
     }
 }
 
@@ -548,6 +760,7 @@ char *sub_get_text(struct dec_sub *sub, double pts)
 void sub_reset(struct dec_sub *sub)
 {
     pthread_mutex_lock(&sub->lock);
+    sub->prerender_pending = false;
     for (int n = 0; n < sub->num_sd; n++) {
         if (sub->sd[n]->driver->reset)
             sub->sd[n]->driver->reset(sub->sd[n]);
@@ -36,7 +36,8 @@ void sub_init_from_sh(struct dec_sub *sub, struct sh_stream *sh);
 
 bool sub_is_initialized(struct dec_sub *sub);
 
-bool sub_read_all_packets(struct dec_sub *sub, struct sh_stream *sh);
+bool sub_preload_start(struct dec_sub *sub, struct sh_stream *sh);
+bool sub_preload_packets(struct dec_sub *sub, double pts, double max_time);
 bool sub_accept_packets_in_advance(struct dec_sub *sub);
 void sub_decode(struct dec_sub *sub, struct demux_packet *packet);
 void sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim, double pts,
@@ -24,10 +24,12 @@
 
 #include <libswscale/swscale.h>
 #include <libavutil/common.h>
+#include <libavutil/cpu.h>
 
 #include "common/common.h"
 #include "draw_bmp.h"
 #include "img_convert.h"
+#include "blend_simd.h"
 #include "video/mp_image.h"
 #include "video/sws_utils.h"
 #include "video/img_format.h"
@@ -56,13 +58,15 @@ struct mp_draw_sub_cache
     struct part *parts[MAX_OSD_PARTS];
     struct mp_image *upsample_img;
     struct mp_image upsample_temp;
+    // for blend_area() with subsampled chroma
+    uint8_t *chroma_alpha, *chroma_src;
 };
 
 
 static struct part *get_cache(struct mp_draw_sub_cache *cache,
                               struct sub_bitmaps *sbs, struct mp_image *format);
 static bool get_sub_area(struct mp_rect bb, struct mp_image *temp,
-                         struct sub_bitmap *sb, struct mp_image *out_area,
+                         struct sub_bitmap *sb, struct mp_rect *out_rc,
                          int *out_src_x, int *out_src_y);
 
 #define ACCURATE
@@ -115,19 +119,6 @@ static void blend_const8_alpha(void *dst, int dst_stride, uint16_t srcp,
     }
 }
 
-static void blend_const_alpha(void *dst, int dst_stride, int srcp,
-                              uint8_t *srca, int srca_stride, uint8_t srcamul,
-                              int w, int h, int bytes)
-{
-    if (bytes == 2) {
-        blend_const16_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
-                            w, h);
-    } else if (bytes == 1) {
-        blend_const8_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
-                           w, h);
-    }
-}
-
 static void blend_src16_alpha(void *dst, int dst_stride, void *src,
                               int src_stride, uint8_t *srca, int srca_stride,
                               int w, int h)
@@ -170,6 +161,108 @@ static void blend_src8_alpha(void *dst, int dst_stride, void *src,
     }
 }
 
+#if HAVE_X86_SIMD && defined(ACCURATE)
+// SSE2 versions of the 8 bit functions above (same results). The remaining
+// pixels of each row are left to the C functions.
+
+static void SSE2_FN blend_const8_alpha_sse2(void *dst, int dst_stride,
+                                            uint16_t srcp, uint8_t *srca,
+                                            int srca_stride, uint8_t srcamul,
+                                            int w, int h)
+{
+    if (!srcamul)
+        return;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_set1_epi16(srcp);
+    const __m128i mul = _mm_set1_epi16(srcamul);
+    const __m128i round = _mm_set1_epi32(32512);
+    for (int y = 0; y < h; y++) {
+        uint8_t *dst_r = (uint8_t *)dst + dst_stride * y;
+        uint8_t *srca_r = srca + srca_stride * y;
+        int x = 0;
+        for (; x + 8 <= w; x += 8) {
+            __m128i a = _mm_loadl_epi64((__m128i *)(srca_r + x));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) == 0xFFFF)
+                continue;
+            a = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), mul);
+            __m128i d = _mm_loadl_epi64((__m128i *)(dst_r + x));
+            d = mp_blend65025_epu16(c, _mm_unpacklo_epi8(d, zero), a, round);
+            _mm_storel_epi64((__m128i *)(dst_r + x), _mm_packus_epi16(d, d));
+        }
+        if (x < w) {
+            blend_const8_alpha(dst_r + x, dst_stride, srcp, srca_r + x,
+                               srca_stride, srcamul, w - x, 1);
+        }
+    }
+}
+
+// (s * a + d * (255 - a) + 127) / 255 for 8 unsigned 16 bit lanes
+static inline __m128i SSE2_FN blend255_epu16(__m128i s, __m128i d, __m128i a)
+{
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a),
+                    _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+    x = _mm_add_epi16(x, _mm_set1_epi16(127));
+    // exact division by 255 for x < 65536 - 256
+    x = _mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8));
+    return _mm_srli_epi16(x, 8);
+}
+
+static void SSE2_FN blend_src8_alpha_sse2(void *dst, int dst_stride,
+                                          void *src, int src_stride,
+                                          uint8_t *srca, int srca_stride,
+                                          int w, int h)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int y = 0; y < h; y++) {
+        uint8_t *dst_r = (uint8_t *)dst + dst_stride * y;
+        uint8_t *src_r = (uint8_t *)src + src_stride * y;
+        uint8_t *srca_r = srca + srca_stride * y;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            __m128i a = _mm_loadu_si128((__m128i *)(srca_r + x));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) == 0xFFFF)
+                continue;
+            __m128i s = _mm_loadu_si128((__m128i *)(src_r + x));
+            __m128i d = _mm_loadu_si128((__m128i *)(dst_r + x));
+            __m128i lo = blend255_epu16(_mm_unpacklo_epi8(s, zero),
+                                        _mm_unpacklo_epi8(d, zero),
+                                        _mm_unpacklo_epi8(a, zero));
+            __m128i hi = blend255_epu16(_mm_unpackhi_epi8(s, zero),
+                                        _mm_unpackhi_epi8(d, zero),
+                                        _mm_unpackhi_epi8(a, zero));
+            _mm_storeu_si128((__m128i *)(dst_r + x), _mm_packus_epi16(lo, hi));
+        }
+        if (x < w) {
+            blend_src8_alpha(dst_r + x, dst_stride, src_r + x, src_stride,
+                             srca_r + x, srca_stride, w - x, 1);
+        }
+    }
+}
+#define HAVE_BLEND_SSE2 1
+#else
+#define HAVE_BLEND_SSE2 0
+#endif
+
+static void blend_const_alpha(void *dst, int dst_stride, int srcp,
+                              uint8_t *srca, int srca_stride, uint8_t srcamul,
+                              int w, int h, int bytes)
+{
+    if (bytes == 2) {
+        blend_const16_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
+                            w, h);
+    } else if (bytes == 1) {
+#if HAVE_BLEND_SSE2
+        if (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) {
+            blend_const8_alpha_sse2(dst, dst_stride, srcp, srca, srca_stride,
+                                    srcamul, w, h);
+            return;
+        }
+#endif
+        blend_const8_alpha(dst, dst_stride, srcp, srca, srca_stride, srcamul,
+                           w, h);
+    }
+}
+
 static void blend_src_alpha(void *dst, int dst_stride, void *src,
                             int src_stride, uint8_t *srca, int srca_stride,
                             int w, int h, int bytes)
@@ -178,11 +271,133 @@ static void blend_src_alpha(void *dst, int dst_stride, void *src,
         blend_src16_alpha(dst, dst_stride, src, src_stride, srca, srca_stride,
                           w, h);
     } else if (bytes == 1) {
+#if HAVE_BLEND_SSE2
+        if (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) {
+            blend_src8_alpha_sse2(dst, dst_stride, src, src_stride, srca,
+                                  srca_stride, w, h);
+            return;
+        }
+#endif
         blend_src8_alpha(dst, dst_stride, src, src_stride, srca, srca_stride,
                          w, h);
     }
 }
 
+// Average the alpha values of the pixels in rc covered by each chroma sample
+// in crc. Pixels not in rc count as fully transparent. alpha points to the
+// pixel at (rc.x0, rc.y0), dst has a stride of crc's width.
+static void downsample_alpha(uint8_t *dst, struct mp_rect crc, int xs, int ys,
+                             struct mp_rect rc, uint8_t *alpha,
+                             int alpha_stride)
+{
+    int cw = crc.x1 - crc.x0;
+    int shift = xs + ys;
+    for (int cy = crc.y0; cy < crc.y1; cy++) {
+        int y0 = MPMAX(cy << ys, rc.y0), y1 = MPMIN((cy + 1) << ys, rc.y1);
+        uint8_t *dst_r = dst + (cy - crc.y0) * cw;
+        for (int cx = crc.x0; cx < crc.x1; cx++) {
+            int x0 = MPMAX(cx << xs, rc.x0), x1 = MPMIN((cx + 1) << xs, rc.x1);
+            unsigned sum = 0;
+            for (int y = y0; y < y1; y++) {
+                uint8_t *a_r = alpha + (y - rc.y0) * alpha_stride - rc.x0;
+                for (int x = x0; x < x1; x++)
+                    sum += a_r[x];
+            }
+            dst_r[cx - crc.x0] = (sum + (1 << shift) / 2) >> shift;
+        }
+    }
+}
+
+// Average the src values like downsample_alpha(), but weighted by alpha. This
+// way, blending the result with the averaged alpha is the same as blending at
+// full resolution and then averaging the blended pixels.
+static void downsample_src(void *dst, struct mp_rect crc, int xs, int ys,
+                           struct mp_rect rc, void *src, int src_stride,
+                           uint8_t *alpha, int alpha_stride, int bytes)
+{
+    int cw = crc.x1 - crc.x0;
+    for (int cy = crc.y0; cy < crc.y1; cy++) {
+        int y0 = MPMAX(cy << ys, rc.y0), y1 = MPMIN((cy + 1) << ys, rc.y1);
+        for (int cx = crc.x0; cx < crc.x1; cx++) {
+            int x0 = MPMAX(cx << xs, rc.x0), x1 = MPMIN((cx + 1) << xs, rc.x1);
+            uint32_t sum_a = 0, sum = 0;
+            for (int y = y0; y < y1; y++) {
+                uint8_t *a_r = alpha + (y - rc.y0) * alpha_stride - rc.x0;
+                uint8_t *s_r = (uint8_t *)src + (y - rc.y0) * src_stride;
+                for (int x = x0; x < x1; x++) {
+                    uint32_t v = bytes == 2 ? ((uint16_t *)s_r)[x - rc.x0]
+                                            : s_r[x - rc.x0];
+                    sum_a += a_r[x];
+                    sum += v * a_r[x];
+                }
+            }
+            uint32_t v = sum_a ? (sum + sum_a / 2) / sum_a : 0;
+            int i = (cy - crc.y0) * cw + cx - crc.x0;
+            if (bytes == 2) {
+                ((uint16_t *)dst)[i] = v;
+            } else {
+                ((uint8_t *)dst)[i] = v;
+            }
+        }
+    }
+}
+
+// Blend into the rectangle rc of img, either the constant color[] (if src is
+// NULL), or the pixels of src starting at (src_x, src_y). alpha points to the
+// alpha value of the pixel at (rc.x0, rc.y0), and is multiplied with
+// alpha_mul (constant color only). Subsampled chroma planes are blended with
+// alpha and source averaged over the luma pixels of each chroma sample, so
+// img doesn't need to be converted to a 4:4:4 format first.
+static void blend_area(struct mp_draw_sub_cache *cache, struct mp_image *img,
+                       struct mp_rect rc, int bits, int color[3],
+                       struct mp_image *src, int src_x, int src_y,
+                       uint8_t *alpha, int alpha_stride, uint8_t alpha_mul)
+{
+    int bytes = (bits + 7) / 8;
+    int num_planes = img->num_planes > 2 ? 3 : 1;
+    int xs = img->chroma_x_shift, ys = img->chroma_y_shift;
+    for (int p = 0; p < num_planes; p++) {
+        if (p > 0 && (xs || ys))
+            break;
+        void *dst = img->planes[p] + rc.y0 * img->stride[p] + rc.x0 * bytes;
+        int w = rc.x1 - rc.x0, h = rc.y1 - rc.y0;
+        if (src) {
+            void *s = src->planes[p] + src_y * src->stride[p] + src_x * bytes;
+            blend_src_alpha(dst, img->stride[p], s, src->stride[p],
+                            alpha, alpha_stride, w, h, bytes);
+        } else {
+            blend_const_alpha(dst, img->stride[p], color[p], alpha,
+                              alpha_stride, alpha_mul, w, h, bytes);
+        }
+    }
+    if (num_planes < 3 || !(xs || ys))
+        return;
+
+    struct mp_rect crc = {
+        rc.x0 >> xs, rc.y0 >> ys,
+        (rc.x1 + (1 << xs) - 1) >> xs, (rc.y1 + (1 << ys) - 1) >> ys,
+    };
+    int cw = crc.x1 - crc.x0, ch = crc.y1 - crc.y0;
+    MP_TARRAY_GROW(cache, cache->chroma_alpha, cw * ch);
+    downsample_alpha(cache->chroma_alpha, crc, xs, ys, rc, alpha, alpha_stride);
+    if (src)
+        MP_TARRAY_GROW(cache, cache->chroma_src, cw * ch * bytes);
+    for (int p = 1; p < 3; p++) {
+        void *dst = img->planes[p] + crc.y0 * img->stride[p] + crc.x0 * bytes;
+        if (src) {
+            void *s = src->planes[p] + src_y * src->stride[p] + src_x * bytes;
+            downsample_src(cache->chroma_src, crc, xs, ys, rc, s,
+                           src->stride[p], alpha, alpha_stride, bytes);
+            blend_src_alpha(dst, img->stride[p], cache->chroma_src, cw * bytes,
+                            cache->chroma_alpha, cw, cw, ch, bytes);
+        } else {
+            blend_const_alpha(dst, img->stride[p], color[p],
+                              cache->chroma_alpha, cw, alpha_mul, cw, ch,
+                              bytes);
+        }
+    }
+}
+
 static void unpremultiply_and_split_BGR32(struct mp_image *img,
                                           struct mp_image *alpha)
 {
@@ -239,11 +454,17 @@ static void scale_sb_rgba(struct sub_bitmap *sb, struct mp_image *dst_format,
     *out_sba = sba;
 }
 
+// format is the (4:4:4) format the bitmaps are converted to
 static void draw_rgba(struct mp_draw_sub_cache *cache, struct mp_rect bb,
-                      struct mp_image *temp, int bits,
+                      struct mp_image *temp, int format, int bits,
                       struct sub_bitmaps *sbs)
 {
-    struct part *part = get_cache(cache, sbs, temp);
+    struct mp_image sb_format = {0};
+    mp_image_setfmt(&sb_format, format);
+    sb_format.params.colorspace = temp->params.colorspace;
+    sb_format.params.colorlevels = temp->params.colorlevels;
+
+    struct part *part = get_cache(cache, sbs, &sb_format);
     assert(part);
 
     for (int i = 0; i < sbs->num_parts; ++i) {
@@ -252,7 +473,7 @@ static void draw_rgba(struct mp_draw_sub_cache *cache, struct mp_rect bb,
         if (sb->w < 1 || sb->h < 1)
             continue;
 
-        struct mp_image dst;
+        struct mp_rect dst;
         int src_x, src_y;
         if (!get_sub_area(bb, temp, sb, &dst, &src_x, &src_y))
             continue;
@@ -261,15 +482,11 @@ static void draw_rgba(struct mp_draw_sub_cache *cache, struct mp_rect bb,
         struct mp_image *sba = part->imgs[i].a;
 
         if (!(sbi && sba))
-            scale_sb_rgba(sb, temp, &sbi, &sba);
+            scale_sb_rgba(sb, &sb_format, &sbi, &sba);
 
-        int bytes = (bits + 7) / 8;
         uint8_t *alpha_p = sba->planes[0] + src_y * sba->stride[0] + src_x;
-        for (int p = 0; p < (temp->num_planes > 2 ? 3 : 1); p++) {
-            void *src = sbi->planes[p] + src_y * sbi->stride[p] + src_x * bytes;
-            blend_src_alpha(dst.planes[p], dst.stride[p], src, sbi->stride[p],
-                            alpha_p, sba->stride[0], dst.w, dst.h, bytes);
-        }
+        blend_area(cache, temp, dst, bits, NULL, sbi, src_x, src_y,
+                   alpha_p, sba->stride[0], 255);
 
         part->imgs[i].i = talloc_steal(part, sbi);
         part->imgs[i].a = talloc_steal(part, sba);
@@ -295,7 +512,7 @@ static void draw_ass(struct mp_draw_sub_cache *cache, struct mp_rect bb,
     for (int i = 0; i < sbs->num_parts; ++i) {
         struct sub_bitmap *sb = &sbs->parts[i];
 
-        struct mp_image dst;
+        struct mp_rect dst;
         int src_x, src_y;
         if (!get_sub_area(bb, temp, sb, &dst, &src_x, &src_y))
             continue;
@@ -305,21 +522,18 @@ static void draw_ass(struct mp_draw_sub_cache *cache, struct mp_rect bb,
         int b = (sb->libass.color >> 8) & 0xFF;
         int a = 255 - (sb->libass.color & 0xFF);
         int color_yuv[3] = {r, g, b};
-        if (dst.flags & MP_IMGFLAG_YUV) {
+        if (temp->flags & MP_IMGFLAG_YUV) {
             mp_map_int_color(rgb2yuv, bits, color_yuv);
         } else {
-            assert(dst.imgfmt == IMGFMT_GBRP);
+            assert(temp->imgfmt == IMGFMT_GBRP);
             color_yuv[0] = g;
             color_yuv[1] = b;
             color_yuv[2] = r;
         }
 
-        int bytes = (bits + 7) / 8;
         uint8_t *alpha_p = (uint8_t *)sb->bitmap + src_y * sb->stride + src_x;
-        for (int p = 0; p < (temp->num_planes > 2 ? 3 : 1); p++) {
-            blend_const_alpha(dst.planes[p], dst.stride[p], color_yuv[p],
-                              alpha_p, sb->stride, a, dst.w, dst.h, bytes);
-        }
+        blend_area(cache, temp, dst, bits, color_yuv, NULL, 0, 0,
+                   alpha_p, sb->stride, a);
     }
 }
 
@@ -419,9 +633,10 @@ static struct part *get_cache(struct mp_draw_sub_cache *cache,
     return part;
 }
 
-// Return area of intersection between target and sub-bitmap as cropped image
+// Return area of intersection between target and sub-bitmap as rectangle in
+// temp's coordinates
 static bool get_sub_area(struct mp_rect bb, struct mp_image *temp,
-                         struct sub_bitmap *sb, struct mp_image *out_area,
+                         struct sub_bitmap *sb, struct mp_rect *out_rc,
                          int *out_src_x, int *out_src_y)
 {
     // coordinates are relative to the bbox
@@ -433,8 +648,7 @@ static bool get_sub_area(struct mp_rect bb, struct mp_image *temp,
 
     *out_src_x = (dst.x0 - sb->x) + bb.x0;
     *out_src_y = (dst.y0 - sb->y) + bb.y0;
-    *out_area = *temp;
-    mp_image_crop_rc(out_area, dst);
+    *out_rc = dst;
 
     return true;
 }
@@ -518,6 +732,26 @@ static void chroma_down(struct mp_image *old_src, struct mp_image *temp)
     }
 }
 
+// Whether blend_area() can blend into img directly, without converting it to
+// a 4:4:4 format first: native endian planar YUV with at most 2x2 subsampling.
+static bool can_blend_direct(struct mp_image *img)
+{
+    struct mp_imgfmt_desc desc = img->fmt;
+    return (desc.flags & MP_IMGFLAG_YUV_P) && (desc.flags & MP_IMGFLAG_NE) &&
+           desc.num_planes == 3 && desc.chroma_xs <= 1 && desc.chroma_ys <= 1;
+}
+
+static void draw_subs(struct mp_draw_sub_cache *cache, struct mp_rect bb,
+                      struct mp_image *temp, int format, int bits,
+                      struct sub_bitmaps *sbs)
+{
+    if (sbs->format == SUBBITMAP_RGBA) {
+        draw_rgba(cache, bb, temp, format, bits, sbs);
+    } else if (sbs->format == SUBBITMAP_LIBASS) {
+        draw_ass(cache, bb, temp, bits, sbs);
+    }
+}
+
 // cache: if not NULL, the function will set *cache to a talloc-allocated cache
 //        containing scaled versions of sbs contents - free the cache with
 //        talloc_free()
@@ -536,7 +770,15 @@ void mp_draw_sub_bitmaps(struct mp_draw_sub_cache **cache, struct mp_image *dst,
     get_closest_y444_format(dst->imgfmt, &format, &bits);
 
     struct mp_rect rc_list[MP_SUB_BB_LIST_MAX];
-    int num_rc = mp_get_sub_bb_list(sbs, rc_list, MP_SUB_BB_LIST_MAX);
+    int num_rc = 0;
+
+    if (can_blend_direct(dst) && bits == dst->fmt.plane_bits) {
+        // The bitmaps are blended in place; no bounding boxes needed.
+        struct mp_rect bb = {0, 0, dst->w, dst->h};
+        draw_subs(cache_, bb, dst, format, bits, sbs);
+    } else {
+        num_rc = mp_get_sub_bb_list(sbs, rc_list, MP_SUB_BB_LIST_MAX);
+    }
 
     for (int r = 0; r < num_rc; r++) {
         struct mp_rect bb = rc_list[r];
@@ -548,11 +790,7 @@ void mp_draw_sub_bitmaps(struct mp_draw_sub_cache **cache, struct mp_image *dst,
         mp_image_crop_rc(&dst_region, bb);
         struct mp_image *temp = chroma_up(cache_, format, &dst_region);
 
-        if (sbs->format == SUBBITMAP_RGBA) {
-            draw_rgba(cache_, bb, temp, bits, sbs);
-        } else if (sbs->format == SUBBITMAP_LIBASS) {
-            draw_ass(cache_, bb, temp, bits, sbs);
-        }
+        draw_subs(cache_, bb, temp, format, bits, sbs);
 
         chroma_down(&dst_region, temp);
     }
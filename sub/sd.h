@@ -1,11 +1,14 @@
 #ifndef MPLAYER_SD_H
 #define MPLAYER_SD_H
 
+#include <pthread.h>
+
 #include "dec_sub.h"
 #include "demux/packet.h"
 
 struct sd {
     struct mp_log *log;
+    struct mpv_global *global;
     struct MPOpts *opts;
 
     const struct sd_functions *driver;
@@ -60,6 +63,15 @@ struct sd_functions {
     // decoder
     void (*get_bitmaps)(struct sd *sd, struct mp_osd_res dim, double pts,
                         struct sub_bitmaps *res);
+    // Optional. Render ahead of pts, called from a separate thread with lock
+    // (the dec_sub lock) held. Should do a small amount of work per call, and
+    // return false if there is nothing left to do. In that case, *idle_until
+    // can be set to the pts before which later calls won't find new work
+    // either (unless new packets are decoded). Expensive work should be done
+    // with lock released, without touching state shared with the other
+    // callbacks.
+    bool (*prerender)(struct sd *sd, struct mp_osd_res dim, double pts,
+                      pthread_mutex_t *lock, double *idle_until);
     char *(*get_text)(struct sd *sd, double pts);
 
     // converter
@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <libavutil/common.h>
 #include <ass/ass.h>
@@ -35,14 +36,56 @@
 #include "ass_mp.h"
 #include "sd.h"
 
+// Everything besides the set of active events that affects rendering.
+struct render_state {
+    struct mp_osd_res dim;
+    double scale;
+    struct mp_image_params video_params;
+    int style_override, use_margins, sub_pos, hinting, shaper;
+    int blur_compat, color_compat;
+    float line_spacing, sub_scale;
+};
+
+// A rendered frame, kept for reuse when the same events are shown again.
+struct cached_frame {
+    uint64_t id;            // unique for each cached_frame
+    struct render_state state;
+    uint32_t hash;          // of events[]
+    int *events;            // indexes of the active events
+    int num_events;
+    struct sub_bitmap *parts;
+    int num_parts;
+    size_t size;            // approximate memory used
+};
+
 struct sd_ass_priv {
     struct ass_track *ass_track;
+    struct mp_ass_index *index;
     bool is_converted;
     struct sub_bitmap *parts;
     bool flush_on_seek;
     char last_text[500];
     struct mp_image_params video_params;
     struct mp_image_params last_params;
+    // Rendered frames, most recently used first
+    struct cached_frame **cache;
+    int num_cache;
+    size_t cache_size;
+    uint64_t cache_ids;
+    uint64_t last_id;       // id of the frame returned last (0 if not cached)
+    int *active;            // scratch array for get_active_events()
+    int num_active;
+    long long cache_hits, cache_misses;
+    unsigned int flushes;   // incremented when the track's events are dropped
+    // For prerender(); uses its own renderer, as it runs on another thread
+    // than the shared renderer might be used from. The renderer and the parts
+    // array are only accessed by the prerender thread.
+    ASS_Renderer *prerender_renderer;
+    bool prerender_failed;
+    struct sub_bitmap *prerender_parts;
+    struct render_state prerender_state;
+    long long prerender_pos;    // time of the last pre-rendered event change
+    long long prerendered;
 };
 
 static void mangle_colors(struct sd *sd, struct sub_bitmaps *parts);
@@ -69,6 +112,7 @@ static int init(struct sd *sd)
     ctx->is_converted = sd->converted_from != NULL;
 
     ctx->ass_track = ass_new_track(sd->ass_library);
+    ctx->index = mp_ass_index_create(ctx);
     if (!ctx->is_converted)
         ctx->ass_track->track_type = TRACK_TYPE_ASS;
 
@@ -134,28 +178,146 @@ static ASS_Style *find_style(ASS_Track *track, const char *name)
     return NULL;
 }
 
-static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
-                        struct sub_bitmaps *res)
+static bool render_state_equals(struct render_state *a, struct render_state *b)
 {
-    struct sd_ass_priv *ctx = sd->priv;
-    struct MPOpts *opts = sd->opts;
+    return a->dim.w == b->dim.w && a->dim.h == b->dim.h &&
+           a->dim.ml == b->dim.ml && a->dim.mt == b->dim.mt &&
+           a->dim.mr == b->dim.mr && a->dim.mb == b->dim.mb &&
+           a->dim.display_par == b->dim.display_par &&
+           a->scale == b->scale &&
+           mp_image_params_equals(&a->video_params, &b->video_params) &&
+           a->style_override == b->style_override &&
+           a->use_margins == b->use_margins && a->sub_pos == b->sub_pos &&
+           a->hinting == b->hinting && a->shaper == b->shaper &&
+           a->blur_compat == b->blur_compat &&
+           a->color_compat == b->color_compat &&
+           a->line_spacing == b->line_spacing && a->sub_scale == b->sub_scale;
+}
 
-    if (pts == MP_NOPTS_VALUE || !sd->ass_renderer)
-        return;
+// Whether the event renders differently depending on the time within the
+// event (or is likely to).
+static bool is_animated(ASS_Event *event)
+{
+    const char *text = event->Text ? event->Text : "";
+    return (event->Effect && event->Effect[0]) || strstr(text, "\\t(") ||
+           strstr(text, "\\move") || strstr(text, "\\fad") ||
+           strstr(text, "\\k") || strstr(text, "\\K");
+}
 
-    ASS_Style prev_default_style;
-    ASS_Style *default_style = NULL;
-    if (opts->ass_style_override == 2) {
-        default_style = find_style(ctx->ass_track, "Default");
-        if (default_style) {
-            prev_default_style = *default_style;
-            default_style->FontName = NULL; // don't free this
-            mp_ass_set_style(default_style, ctx->ass_track->PlayResY,
-                             opts->sub_text_style);
+// Set ctx->active to the events shown at the given time (in ms). Return false
+// if the rendered frame can't be cached.
+static bool get_active_events(struct sd_ass_priv *ctx, long long now)
+{
+    ASS_Track *track = ctx->ass_track;
+    int *events;
+    int num_events = mp_ass_index_find(ctx->index, track, now, &events);
+    ctx->num_active = 0;
+    for (int i = 0; i < num_events; i++) {
+        if (is_animated(&track->events[events[i]]))
+            return false;
+        MP_TARRAY_APPEND(ctx, ctx->active, ctx->num_active, events[i]);
+    }
+    return true;
+}
+
+static uint32_t hash_events(int *events, int num_events)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int n = 0; n < num_events; n++)
+        hash = (hash ^ events[n]) * 16777619u;
+    return hash;
+}
+
+static void cache_insert_front(struct sd_ass_priv *ctx, struct cached_frame *f)
+{
+    MP_TARRAY_GROW(ctx, ctx->cache, ctx->num_cache);
+    memmove(ctx->cache + 1, ctx->cache, ctx->num_cache * sizeof(ctx->cache[0]));
+    ctx->cache[0] = f;
+    ctx->num_cache++;
+}
+
+static struct cached_frame *cache_lookup(struct sd_ass_priv *ctx,
+                                         struct render_state *state)
+{
+    uint32_t hash = hash_events(ctx->active, ctx->num_active);
+    for (int n = 0; n < ctx->num_cache; n++) {
+        struct cached_frame *f = ctx->cache[n];
+        if (f->hash == hash && f->num_events == ctx->num_active &&
+            !memcmp(f->events, ctx->active, f->num_events * sizeof(int)) &&
+            render_state_equals(&f->state, state))
+        {
+            MP_TARRAY_REMOVE_AT(ctx->cache, ctx->num_cache, n);
+            cache_insert_front(ctx, f);
+            return f;
         }
     }
+    return NULL;
+}
+
+static void cache_clear(struct sd_ass_priv *ctx)
+{
+    for (int n = 0; n < ctx->num_cache; n++)
+        talloc_free(ctx->cache[n]);
+    ctx->num_cache = 0;
+    ctx->cache_size = 0;
+    ctx->last_id = 0;
+    ctx->flushes++;
+}
+
+// Add a copy of the rendered frame in res (whose bitmaps are owned by libass).
+static struct cached_frame *cache_add(struct sd *sd, struct render_state *state,
+                                      struct sub_bitmaps *res)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    size_t max_size = (size_t)sd->opts->ass_bitmap_cache * 1024 * 1024;
+
+    size_t bitmap_size = 0;
+    for (int n = 0; n < res->num_parts; n++)
+        bitmap_size += res->parts[n].w * res->parts[n].h;
+    size_t size = sizeof(struct cached_frame) + bitmap_size +
+                  ctx->num_active * sizeof(int) +
+                  res->num_parts * sizeof(struct sub_bitmap);
+    if (size > max_size)
+        return NULL;
+
+    struct cached_frame *f = talloc_ptrtype(ctx, f);
+    *f = (struct cached_frame){
+        .id = ++ctx->cache_ids,
+        .state = *state,
+        .hash = hash_events(ctx->active, ctx->num_active),
+        .events = talloc_memdup(f, ctx->active, ctx->num_active * sizeof(int)),
+        .num_events = ctx->num_active,
+        .parts = talloc_memdup(f, res->parts,
+                               res->num_parts * sizeof(struct sub_bitmap)),
+        .num_parts = res->num_parts,
+        .size = size,
+    };
+    uint8_t *data = talloc_size(f, bitmap_size);
+    for (int n = 0; n < f->num_parts; n++) {
+        struct sub_bitmap *p = &f->parts[n];
+        for (int y = 0; y < p->h; y++)
+            memcpy(data + y * p->w, (uint8_t *)p->bitmap + y * p->stride, p->w);
+        p->bitmap = data;
+        p->stride = p->w;
+        data += p->w * p->h;
+    }
+
+    while (ctx->num_cache && ctx->cache_size + size > max_size) {
+        struct cached_frame *old = ctx->cache[--ctx->num_cache];
+        ctx->cache_size -= old->size;
+        talloc_free(old);
+    }
+    cache_insert_front(ctx, f);
+    ctx->cache_size += size;
+    return f;
+}
+
+static void get_render_state(struct sd *sd, struct mp_osd_res dim,
+                             struct render_state *state)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct MPOpts *opts = sd->opts;
 
-    ASS_Renderer *renderer = sd->ass_renderer;
     double scale = dim.display_par;
     if (!ctx->is_converted && (!opts->ass_style_override ||
                                opts->ass_vsfilter_aspect_compat))
@@ -167,23 +329,58 @@ static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
         if (isnormal(par))
             scale = par;
     }
-    mp_ass_configure(renderer, opts, &dim);
-    ass_set_aspect_ratio(renderer, scale, 1);
+
+    *state = (struct render_state){
+        .dim = dim,
+        .scale = scale,
+        .video_params = ctx->video_params,
+        .style_override = opts->ass_style_override,
+        .use_margins = opts->ass_use_margins,
+        .sub_pos = opts->sub_pos,
+        .hinting = opts->ass_hinting,
+        .shaper = opts->ass_shaper,
+        .blur_compat = opts->ass_vsfilter_blur_compat,
+        .color_compat = opts->ass_vsfilter_color_compat,
+        .line_spacing = opts->ass_line_spacing,
+        .sub_scale = opts->sub_scale,
+    };
+}
+
+// Render track with the given renderer. Uses only state and constant fields of
+// ctx, so that it can run without the lock on a copy of the track.
+static void render_frame(struct sd *sd, ASS_Renderer *renderer,
+                         ASS_Track *track, struct render_state *state,
+                         long long now, struct sub_bitmap **parts,
+                         struct sub_bitmaps *res)
+{
+    struct MPOpts *opts = sd->opts;
+
+    ASS_Style prev_default_style;
+    ASS_Style *default_style = NULL;
+    if (opts->ass_style_override == 2) {
+        default_style = find_style(track, "Default");
+        if (default_style) {
+            prev_default_style = *default_style;
+            default_style->FontName = NULL; // don't free this
+            mp_ass_set_style(default_style, track->PlayResY,
+                             opts->sub_text_style);
+        }
+    }
+
+    mp_ass_configure(renderer, opts, &state->dim);
+    ass_set_aspect_ratio(renderer, state->scale, 1);
 #if LIBASS_VERSION >= 0x01020000
+    struct sd_ass_priv *ctx = sd->priv;
     if (!ctx->is_converted && (!opts->ass_style_override ||
                                opts->ass_vsfilter_blur_compat))
     {
-        ass_set_storage_size(renderer, ctx->video_params.w, ctx->video_params.h);
+        ass_set_storage_size(renderer, state->video_params.w,
+                             state->video_params.h);
     } else {
         ass_set_storage_size(renderer, 0, 0);
     }
 #endif
-    mp_ass_render_frame(renderer, ctx->ass_track, pts * 1000 + .5,
-                        &ctx->parts, res);
-    talloc_steal(ctx, ctx->parts);
-
-    if (!ctx->is_converted)
-        mangle_colors(sd, res);
+    mp_ass_render_frame(renderer, track, now, parts, res);
 
     if (default_style) {
         free(default_style->FontName);
@@ -191,6 +388,209 @@ static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
     }
 }
 
+static void get_bitmaps(struct sd *sd, struct mp_osd_res dim, double pts,
+                        struct sub_bitmaps *res)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct MPOpts *opts = sd->opts;
+
+    if (pts == MP_NOPTS_VALUE || !sd->ass_renderer)
+        return;
+
+    long long now = pts * 1000 + .5;
+    struct render_state state;
+    get_render_state(sd, dim, &state);
+
+    // With "force", the --sub-text-* options also matter; don't bother.
+    bool use_cache = opts->ass_bitmap_cache > 0 &&
+                     opts->ass_style_override != 2 &&
+                     get_active_events(ctx, now);
+    if (use_cache) {
+        struct cached_frame *f = cache_lookup(ctx, &state);
+        if (f) {
+            ctx->cache_hits++;
+            res->format = SUBBITMAP_LIBASS;
+            res->parts = f->parts;
+            res->num_parts = f->num_parts;
+            if (f->id != ctx->last_id)
+                res->bitmap_id = res->bitmap_pos_id = 1;
+            ctx->last_id = f->id;
+            return;
+        }
+        ctx->cache_misses++;
+    }
+
+    render_frame(sd, sd->ass_renderer, ctx->ass_track, &state, now,
+                 &ctx->parts, res);
+    talloc_steal(ctx, ctx->parts);
+    if (!ctx->is_converted)
+        mangle_colors(sd, res);
+
+    // libass reports changes relative to its previous frame, which is not
+    // what was returned last if that came from the cache.
+    if (ctx->last_id)
+        res->bitmap_id = res->bitmap_pos_id = 1;
+    ctx->last_id = 0;
+    if (use_cache) {
+        struct cached_frame *f = cache_add(sd, &state, res);
+        if (f)
+            ctx->last_id = f->id;
+    }
+}
+
+#define PRERENDER_TIME 5000 // ms
+
+static char *strdup_or_null(const char *s)
+{
+    return s ? strdup(s) : NULL;
+}
+
+static bool has_explicit_pos(ASS_Event *event)
+{
+    return event->Text && strstr(event->Text, "\\pos(");
+}
+
+// Whether libass might move some of the events in ctx->active to avoid
+// collisions. Where they end up then depends on the previously shown events
+// (kept in event->render_priv), which rendering a copy of the track can't
+// reproduce, so a prerendered frame could differ from the live one.
+static bool active_events_may_collide(struct sd_ass_priv *ctx)
+{
+    ASS_Track *track = ctx->ass_track;
+    for (int i = 0; i < ctx->num_active; i++) {
+        ASS_Event *a = &track->events[ctx->active[i]];
+        if (has_explicit_pos(a))
+            continue;
+        for (int j = i + 1; j < ctx->num_active; j++) {
+            ASS_Event *b = &track->events[ctx->active[j]];
+            if (a->Layer == b->Layer && !has_explicit_pos(b))
+                return true;
+        }
+    }
+    return false;
+}
+
+// Return a new track with the styles of ctx->ass_track and the events listed
+// in ctx->active, which the prerender thread can render without the lock.
+static ASS_Track *copy_active_events(struct sd *sd)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    ASS_Track *src = ctx->ass_track;
+    ASS_Track *dst = ass_new_track(sd->ass_library);
+    if (!dst)
+        return NULL;
+    dst->track_type = src->track_type;
+    dst->PlayResX = src->PlayResX;
+    dst->PlayResY = src->PlayResY;
+    dst->Timer = src->Timer;
+    dst->WrapStyle = src->WrapStyle;
+    dst->ScaledBorderAndShadow = src->ScaledBorderAndShadow;
+    dst->Kerning = src->Kerning;
+    dst->default_style = src->default_style;
+    for (int n = 0; n < src->n_styles; n++) {
+        int sid = ass_alloc_style(dst);
+        ASS_Style *style = &dst->styles[sid];
+        *style = src->styles[n];
+        style->Name = strdup_or_null(style->Name);
+        style->FontName = strdup_or_null(style->FontName);
+    }
+    for (int n = 0; n < ctx->num_active; n++) {
+        int eid = ass_alloc_event(dst);
+        ASS_Event *event = &dst->events[eid];
+        *event = src->events[ctx->active[n]];
+        event->Name = strdup_or_null(event->Name);
+        event->Effect = strdup_or_null(event->Effect);
+        event->Text = strdup_or_null(event->Text);
+        event->render_priv = NULL;
+    }
+    return dst;
+}
+
+// Render the next event change after the current playback position into the
+// frame cache, so that get_bitmaps() only has to look it up. Returns false if
+// there is nothing (left) to do.
+static bool prerender(struct sd *sd, struct mp_osd_res dim, double pts,
+                      pthread_mutex_t *lock, double *idle_until)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    struct MPOpts *opts = sd->opts;
+
+    if (pts == MP_NOPTS_VALUE || opts->ass_bitmap_cache <= 0 ||
+        opts->ass_style_override == 2 || ctx->prerender_failed)
+        return false;
+
+    if (!ctx->prerender_renderer) {
+        // Font setup can take very long, so don't hold the lock meanwhile.
+        pthread_mutex_unlock(lock);
+        ASS_Renderer *renderer = ass_renderer_init(sd->ass_library);
+        if (renderer) {
+            mp_ass_configure_fonts(renderer, opts->sub_text_style,
+                                   sd->global, sd->log);
+        }
+        pthread_mutex_lock(lock);
+        ctx->prerender_renderer = renderer;
+        ctx->prerender_failed = !renderer;
+        return !!renderer;
+    }
+
+    long long now = pts * 1000 + .5;
+    struct render_state state;
+    get_render_state(sd, dim, &state);
+    if (!render_state_equals(&state, &ctx->prerender_state) ||
+        ctx->prerender_pos < now || ctx->prerender_pos > now + PRERENDER_TIME)
+    {
+        ctx->prerender_state = state;
+        ctx->prerender_pos = now;
+    }
+
+    long long next = mp_ass_index_next_change(ctx->index, ctx->ass_track,
+                                              ctx->prerender_pos);
+    if (next < 0) {
+        *idle_until = INFINITY;
+        return false;
+    }
+    if (next > now + PRERENDER_TIME) {
+        *idle_until = (next - PRERENDER_TIME) / 1000.0;
+        return false;
+    }
+    ctx->prerender_pos = next;
+
+    if (!get_active_events(ctx, next) || active_events_may_collide(ctx) ||
+        cache_lookup(ctx, &state))
+        return true;
+
+    ASS_Track *track = copy_active_events(sd);
+    if (!track) {
+        ctx->prerender_failed = true;
+        return false;
+    }
+    int num_events = ctx->num_active;
+    int *events = talloc_memdup(NULL, ctx->active, num_events * sizeof(int));
+    unsigned int flushes = ctx->flushes;
+
+    // Render without the lock, so that get_bitmaps() is never blocked by it.
+    pthread_mutex_unlock(lock);
+    struct sub_bitmaps res = {0};
+    render_frame(sd, ctx->prerender_renderer, track, &state, next,
+                 &ctx->prerender_parts, &res);
+    pthread_mutex_lock(lock);
+
+    // Drop the frame if the track changed meanwhile.
+    if (ctx->flushes == flushes && get_active_events(ctx, next) &&
+        ctx->num_active == num_events &&
+        !memcmp(ctx->active, events, num_events * sizeof(int)) &&
+        !cache_lookup(ctx, &state))
+    {
+        if (!ctx->is_converted)
+            mangle_colors(sd, &res);
+        cache_add(sd, &state, &res);
+        ctx->prerendered++;
+    }
+    talloc_free(events);
+    ass_free_track(track);
+    return true;
+}
+
 struct buf {
     char *start;
     int size;
@@ -265,17 +665,17 @@ static char *get_text(struct sd *sd, double pts)
 
     struct buf b = {ctx->last_text, sizeof(ctx->last_text) - 1};
 
-    for (int i = 0; i < track->n_events; ++i) {
-        ASS_Event *event = track->events + i;
-        if (ipts >= event->Start && ipts < event->Start + event->Duration) {
-            if (event->Text) {
-                int start = b.len;
-                ass_to_plaintext(&b, event->Text);
-                if (is_whitespace_only(&b.start[start], b.len - start)) {
-                    b.len = start;
-                } else {
-                    append(&b, '\n');
-                }
+    int *events;
+    int num_events = mp_ass_index_find(ctx->index, track, ipts, &events);
+    for (int i = 0; i < num_events; ++i) {
+        ASS_Event *event = track->events + events[i];
+        if (event->Text) {
+            int start = b.len;
+            ass_to_plaintext(&b, event->Text);
+            if (is_whitespace_only(&b.start[start], b.len - start)) {
+                b.len = start;
+            } else {
+                append(&b, '\n');
             }
         }
     }
@@ -297,15 +697,28 @@ static void fix_events(struct sd *sd)
 static void reset(struct sd *sd)
 {
     struct sd_ass_priv *ctx = sd->priv;
-    if (ctx->flush_on_seek)
+    if (ctx->flush_on_seek) {
         ass_flush_events(ctx->ass_track);
+        mp_ass_index_reset(ctx->index);
+        cache_clear(ctx);
+    }
     ctx->flush_on_seek = false;
+    ctx->prerender_pos = -1;
 }
 
 static void uninit(struct sd *sd)
 {
     struct sd_ass_priv *ctx = sd->priv;
 
+    if (ctx->cache_hits || ctx->cache_misses) {
+        MP_VERBOSE(sd, "Rendered frame cache: %lld hits, %lld misses.\n",
+                   ctx->cache_hits, ctx->cache_misses);
+    }
+    if (ctx->prerendered)
+        MP_VERBOSE(sd, "Pre-rendered %lld frames.\n", ctx->prerendered);
+    if (ctx->prerender_renderer)
+        ass_renderer_done(ctx->prerender_renderer);
+    talloc_free(ctx->prerender_parts);
     ass_free_track(ctx->ass_track);
     talloc_free(ctx);
 }
@@ -316,7 +729,8 @@ static int control(struct sd *sd, enum sd_ctrl cmd, void *arg)
     switch (cmd) {
     case SD_CTRL_SUB_STEP: {
         double *a = arg;
-        long long res = ass_step_sub(ctx->ass_track, a[0] * 1000 + 0.5, a[1]);
+        long long res = mp_ass_index_step(ctx->index, ctx->ass_track,
+                                          a[0] * 1000 + 0.5, a[1]);
         if (!res)
             return false;
         a[0] = res / 1000.0;
@@ -337,6 +751,7 @@ const struct sd_functions sd_ass = {
     .init = init,
     .decode = decode,
     .get_bitmaps = get_bitmaps,
+    .prerender = prerender,
     .get_text = get_text,
     .fix_events = fix_events,
     .control = control,
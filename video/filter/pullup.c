@@ -19,9 +19,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <libavutil/cpu.h>
+
 #include "config.h"
 #include "pullup.h"
 #include "common/common.h"
+#include "video/filter/simd.h"
 
 
 #define ABS(a) (((a)^((a)>>31))-((a)>>31))
@@ -81,6 +84,63 @@ static int var_y(unsigned char *a, unsigned char *b, int s)
         return 4*var; /* match comb scaling */
 }
 
+#if HAVE_X86_SIMD
+/* SSE2 versions of the metrics above. They give exactly the same results,
+ * and are selected at runtime if the CPU supports SSE2. */
+
+#define LOAD8(p) _mm_loadl_epi64((const __m128i *)(p))
+
+static int SSE2_FN hsum_sad(__m128i v)
+{
+        return _mm_cvtsi128_si32(_mm_add_epi32(v, _mm_srli_si128(v, 8)));
+}
+
+static int SSE2_FN diff_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+        __m128i a01 = _mm_unpacklo_epi64(LOAD8(a), LOAD8(a + s));
+        __m128i b01 = _mm_unpacklo_epi64(LOAD8(b), LOAD8(b + s));
+        __m128i a23 = _mm_unpacklo_epi64(LOAD8(a + 2*s), LOAD8(a + 3*s));
+        __m128i b23 = _mm_unpacklo_epi64(LOAD8(b + 2*s), LOAD8(b + 3*s));
+        return hsum_sad(_mm_add_epi64(_mm_sad_epu8(a01, b01),
+                                      _mm_sad_epu8(a23, b23)));
+}
+
+static int SSE2_FN licomb_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+        int i;
+        for (i=4; i; i--) {
+                __m128i va = _mm_unpacklo_epi8(LOAD8(a), zero);
+                __m128i vb = _mm_unpacklo_epi8(LOAD8(b), zero);
+                __m128i vbp = _mm_unpacklo_epi8(LOAD8(b - s), zero);
+                __m128i van = _mm_unpacklo_epi8(LOAD8(a + s), zero);
+                __m128i t1 = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(va, va),
+                                                         vbp), vb);
+                __m128i t2 = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(vb, vb),
+                                                         va), van);
+                /* |t| <= 510, so 4 rows of 2 terms can't overflow int16 */
+                t1 = _mm_max_epi16(t1, _mm_sub_epi16(zero, t1));
+                t2 = _mm_max_epi16(t2, _mm_sub_epi16(zero, t2));
+                sum = _mm_add_epi16(sum, _mm_add_epi16(t1, t2));
+                a+=s; b+=s;
+        }
+        sum = _mm_madd_epi16(sum, _mm_set1_epi16(1));
+        sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+        sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+        return _mm_cvtsi128_si32(sum);
+}
+
+static int SSE2_FN var_y_sse2(unsigned char *a, unsigned char *b, int s)
+{
+        __m128i a01 = _mm_unpacklo_epi64(LOAD8(a), LOAD8(a + s));
+        __m128i a12 = _mm_unpacklo_epi64(LOAD8(a + s), LOAD8(a + 2*s));
+        __m128i a2 = LOAD8(a + 2*s), a3 = LOAD8(a + 3*s);
+        __m128i v = _mm_add_epi64(_mm_sad_epu8(a01, a12), _mm_sad_epu8(a2, a3));
+        return 4*hsum_sad(v); /* match comb scaling */
+}
+#endif
+
 
 
 
@@ -153,18 +213,42 @@ struct pullup_buffer *pullup_get_buffer(struct pullup_context *c, int parity)
 
 
 
-static void compute_metric(struct pullup_context *c,
-        struct pullup_field *fa, int pa,
-        struct pullup_field *fb, int pb,
-        int (*func)(unsigned char *, unsigned char *, int), int *dest)
-{
+struct metric_job {
+        struct pullup_context *c;
         unsigned char *a, *b;
+        int (*func)(unsigned char *, unsigned char *, int);
+        int *dest;
+};
+
+/* Compute the metric for block rows y0 <= y < y1 */
+static void compute_metric_rows(void *ptr, int y0, int y1)
+{
+        struct metric_job *job = ptr;
+        struct pullup_context *c = job->c;
         int x, y;
         int mp = c->metric_plane;
         int xstep = c->bpp[mp];
         int ystep = c->stride[mp]<<3;
         int s = c->stride[mp]<<1; /* field stride */
         int w = c->metric_w*xstep;
+        unsigned char *a = job->a + y0 * ystep;
+        unsigned char *b = job->b + y0 * ystep;
+        int *dest = job->dest + y0 * c->metric_w;
+
+        for (y = y0; y < y1; y++) {
+                for (x = 0; x < w; x += xstep) {
+                        *dest++ = job->func(a + x, b + x, s);
+                }
+                a += ystep; b += ystep;
+        }
+}
+
+static void compute_metric(struct pullup_context *c,
+        struct pullup_field *fa, int pa,
+        struct pullup_field *fb, int pb,
+        int (*func)(unsigned char *, unsigned char *, int), int *dest)
+{
+        int mp = c->metric_plane;
 
         if (!fa->buffer || !fb->buffer) return;
 
@@ -174,14 +258,19 @@ static void compute_metric(struct pullup_context *c,
                 return;
         }
 
-        a = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset;
-        b = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset;
-
-        for (y = c->metric_h; y; y--) {
-                for (x = 0; x < w; x += xstep) {
-                        *dest++ = func(a + x, b + x, s);
-                }
-                a += ystep; b += ystep;
+        struct metric_job job = {
+                .c = c,
+                .a = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset,
+                .b = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset,
+                .func = func,
+                .dest = dest,
+        };
+
+        if (c->run_slices) {
+                c->run_slices(c->run_slices_ctx, c->metric_h,
+                              compute_metric_rows, &job);
+        } else {
+                compute_metric_rows(&job, 0, c->metric_h);
         }
 }
 
@@ -590,6 +679,13 @@ void pullup_init_context(struct pullup_context *c)
                 c->diff = diff_y;
                 c->comb = licomb_y;
                 c->var = var_y;
+#if HAVE_X86_SIMD
+                if (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) {
+                        c->diff = diff_y_sse2;
+                        c->comb = licomb_y_sse2;
+                        c->var = var_y_sse2;
+                }
+#endif
                 break;
         }
 }
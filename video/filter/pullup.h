@@ -65,6 +65,12 @@ struct pullup_context
         int metric_plane;
         int strict_breaks;
         int strict_pairs;
+        /* Optional: call fn(fn_ctx, y0, y1) for row ranges covering [0, h),
+         * possibly in parallel, and return when all calls are done. */
+        void (*run_slices)(void *ctx, int h,
+                           void (*fn)(void *fn_ctx, int y0, int y1),
+                           void *fn_ctx);
+        void *run_slices_ctx;
         /* Internal data */
         struct pullup_field *first, *last, *head;
         struct pullup_buffer *buffers;
@@ -0,0 +1,36 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_VF_SIMD_H
+#define MP_VF_SIMD_H
+
+// Support for SIMD versions of filter kernels using compiler intrinsics.
+// Functions marked with SSE2_FN are compiled for SSE2 even if the rest of
+// the code isn't, so they must only be called if av_get_cpu_flags() reports
+// AV_CPU_FLAG_SSE2.
+
+#if (defined(__i386__) || defined(__x86_64__)) && (defined(__SSE2__) || \
+    (defined(__GNUC__) && !defined(__clang__) && \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define HAVE_X86_SIMD 1
+#include <emmintrin.h>
+#define SSE2_FN __attribute__((target("sse2")))
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+#endif
@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <libavutil/common.h>
 #include <libavutil/mem.h>
@@ -31,8 +33,12 @@
 #include "options/m_option.h"
 #include "options/m_config.h"
 
+#include "misc/thread_pool.h"
 #include "options/options.h"
+#include "osdep/numcores.h"
+#include "osdep/timer.h"
 
+#include "video/frame_arena.h"
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "video/mp_image_pool.h"
@@ -124,6 +130,9 @@ static const vf_info_t *const filter_list[] = {
 };
 
 static void vf_uninit_filter(vf_instance_t *vf);
+static void pipeline_pause(struct vf_chain *c);
+static void pipeline_resume(struct vf_chain *c);
+static void pipeline_destroy(struct vf_chain *c);
 
 static bool get_desc(struct m_obj_desc *dst, int index)
 {
@@ -152,14 +161,17 @@ const struct m_obj_list vf_obj_list = {
 // filter which does not return CONTROL_UNKNOWN for it.
 int vf_control_any(struct vf_chain *c, int cmd, void *arg)
 {
+    int r = CONTROL_UNKNOWN;
+    pipeline_pause(c);
     for (struct vf_instance *cur = c->first; cur; cur = cur->next) {
         if (cur->control) {
-            int r = cur->control(cur, cmd, arg);
+            r = cur->control(cur, cmd, arg);
             if (r != CONTROL_UNKNOWN)
-                return r;
+                break;
         }
     }
-    return CONTROL_UNKNOWN;
+    pipeline_resume(c);
+    return r;
 }
 
 int vf_control_by_label(struct vf_chain *c,int cmd, void *arg, bstr label)
@@ -167,10 +179,13 @@ int vf_control_by_label(struct vf_chain *c,int cmd, void *arg, bstr label)
     char *label_str = bstrdup0(NULL, label);
     struct vf_instance *cur = vf_find_by_label(c, label_str);
     talloc_free(label_str);
-    if (cur)
-        return cur->control(cur, cmd, arg);
-    else
-        return CONTROL_UNKNOWN;
+    int r = CONTROL_UNKNOWN;
+    if (cur) {
+        pipeline_pause(c);
+        r = cur->control(cur, cmd, arg);
+        pipeline_resume(c);
+    }
+    return r;
 }
 
 static void vf_control_all(struct vf_chain *c, int cmd, void *arg)
@@ -213,6 +228,88 @@ void vf_make_out_image_writeable(struct vf_instance *vf, struct mp_image *img)
     mp_image_pool_make_writeable(vf->out_pool, img);
 }
 
+// Minimum number of rows per slice; smaller slices aren't worth the overhead.
+#define MIN_SLICE_ROWS 16
+
+struct slice_job {
+    void (*fn)(void *ctx, int y0, int y1);
+    void *ctx;
+    int h, num_slices;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // --- protected by lock
+    int next_slice;
+    int pending;        // number of queued work items not finished yet
+};
+
+static void run_slices(struct slice_job *job)
+{
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int slice = job->next_slice++;
+        pthread_mutex_unlock(&job->lock);
+        if (slice >= job->num_slices)
+            break;
+        int y0 = (int64_t)job->h * slice / job->num_slices;
+        int y1 = (int64_t)job->h * (slice + 1) / job->num_slices;
+        job->fn(job->ctx, y0, y1);
+    }
+}
+
+static void slice_worker(void *ptr)
+{
+    struct slice_job *job = ptr;
+    run_slices(job);
+    pthread_mutex_lock(&job->lock);
+    job->pending--;
+    pthread_cond_signal(&job->wakeup);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Call fn(ctx, y0, y1) for consecutive row ranges covering [0, h), possibly
+// in parallel on worker threads. Returns only after all calls have finished.
+// fn must not touch rows outside of its range. The caller runs slices itself
+// too, so this works (serially) even if no threads could be created.
+void vf_run_slices(struct vf_instance *vf, int h,
+                   void (*fn)(void *ctx, int y0, int y1), void *ctx)
+{
+    if (!vf->slice_threads) {
+        vf->slice_threads = MPMAX(default_thread_count(), 1);
+        if (vf->slice_threads > 1) {
+            vf->slice_pool = mp_thread_pool_create(vf, vf->slice_threads - 1);
+            if (!vf->slice_pool)
+                vf->slice_threads = 1;
+        }
+    }
+
+    int num_slices = MPMIN(vf->slice_threads, h / MIN_SLICE_ROWS);
+    if (num_slices < 2) {
+        fn(ctx, 0, h);
+        return;
+    }
+
+    struct slice_job job = {
+        .fn = fn,
+        .ctx = ctx,
+        .h = h,
+        .num_slices = num_slices,
+        .pending = num_slices - 1,
+    };
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.wakeup, NULL);
+    for (int n = 0; n < num_slices - 1; n++)
+        mp_thread_pool_queue(vf->slice_pool, slice_worker, &job);
+    run_slices(&job);
+    // The work items reference job, so wait until all of them have run, even
+    // if the slices were all taken by the calling thread.
+    pthread_mutex_lock(&job.lock);
+    while (job.pending)
+        pthread_cond_wait(&job.wakeup, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+    pthread_cond_destroy(&job.wakeup);
+    pthread_mutex_destroy(&job.lock);
+}
+
 //============================================================================
 
 // The default callback assumes all formats are passed through.
@@ -276,6 +373,11 @@ static struct vf_instance *vf_open(struct vf_chain *c, const char *name,
         .query_format = vf_default_query_format,
         .out_pool = talloc_steal(vf, mp_image_pool_new(16)),
     };
+    if (c->opts->vf_arena) {
+        struct mp_frame_arena *arena =
+            mp_frame_arena_create(vf, c->opts->vf_arena == 2);
+        mp_image_pool_set_allocator(vf->out_pool, mp_frame_arena_alloc, arena);
+    }
     struct m_config *config = m_config_from_obj_desc(vf, vf->log, &desc);
     if (m_config_apply_defaults(config, name, c->opts->vf_defs) < 0)
         goto error;
@@ -312,6 +414,7 @@ static vf_instance_t *vf_open_filter(struct vf_chain *c, const char *name,
 void vf_remove_filter(struct vf_chain *c, struct vf_instance *vf)
 {
     assert(vf != c->first && vf != c->last); // these are sentinels
+    pipeline_destroy(c);
     struct vf_instance *prev = c->first;
     while (prev && prev->next != vf)
         prev = prev->next;
@@ -325,6 +428,7 @@ struct vf_instance *vf_append_filter(struct vf_chain *c, const char *name,
 {
     struct vf_instance *vf = vf_open_filter(c, name, args);
     if (vf) {
+        pipeline_destroy(c);
         // Insert it before the last filter, which is the "out" pseudo-filter
         // (But after the "in" pseudo-filter)
         struct vf_instance **pprev = &c->first->next;
@@ -401,6 +505,261 @@ static int vf_do_filter(struct vf_instance *vf, struct mp_image *img)
     }
 }
 
+/* Pipelined mode: each filter between the "in" and "out" pseudo-filters runs
+ * on its own thread, and frames are passed along through per-filter input
+ * queues. The "in" and "out" filters are still run by the caller. A NULL
+ * entry in a queue signals EOF (the filter is flushed with a NULL image).
+ * Anything else that touches the filters (controls, seek reset, reconfig)
+ * pauses the pipeline first, so filters never see concurrent calls. */
+struct vf_stage {
+    struct vf_pipeline *p;
+    struct vf_instance *vf;
+    pthread_t thread;
+    // --- protected by vf_pipeline.lock
+    struct mp_image **queue;
+    int num_queue;
+    bool busy;              // filtering a frame outside of the lock
+    // statistics
+    int64_t frames;
+    int64_t time_us;
+    int max_queue;
+};
+
+struct vf_pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int depth;              // soft limit for each stage's input queue
+    struct vf_stage **stages;
+    int num_stages;
+    // --- protected by lock
+    bool terminate;
+    int paused;
+    struct mp_image **output; // output of the last stage
+    int num_output;
+    bool eof_sent, eof_done;
+    int error;
+};
+
+static bool stage_output_full(struct vf_pipeline *p, int index)
+{
+    if (index + 1 >= p->num_stages)
+        return false; // the caller reads output only when it needs to
+    return p->stages[index + 1]->num_queue >= p->depth;
+}
+
+static void stage_add_output(struct vf_pipeline *p, int index,
+                             struct mp_image *img)
+{
+    if (index + 1 < p->num_stages) {
+        struct vf_stage *next = p->stages[index + 1];
+        MP_TARRAY_APPEND(next, next->queue, next->num_queue, img);
+        next->max_queue = MPMAX(next->max_queue, next->num_queue);
+    } else {
+        MP_TARRAY_APPEND(p, p->output, p->num_output, img);
+    }
+}
+
+static void *stage_thread(void *ptr)
+{
+    struct vf_stage *st = ptr;
+    struct vf_pipeline *p = st->p;
+    int index = 0;
+    while (p->stages[index] != st)
+        index++;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->terminate) {
+        if (p->paused || !st->num_queue || stage_output_full(p, index)) {
+            pthread_cond_wait(&p->wakeup, &p->lock);
+            continue;
+        }
+        struct mp_image *img = st->queue[0];
+        MP_TARRAY_REMOVE_AT(st->queue, st->num_queue, 0);
+        st->busy = true;
+        pthread_cond_broadcast(&p->wakeup);
+        pthread_mutex_unlock(&p->lock);
+
+        MP_STATS(st->vf, "start filter");
+        int64_t start = mp_time_us();
+        bool eof = !img;
+        int r = vf_do_filter(st->vf, img);
+        int64_t duration = mp_time_us() - start;
+        MP_STATS(st->vf, "end filter");
+
+        pthread_mutex_lock(&p->lock);
+        st->busy = false;
+        st->frames += !eof;
+        st->time_us += duration;
+        if (r < 0)
+            p->error = r;
+        struct mp_image *out;
+        while ((out = vf_dequeue_output_frame(st->vf)))
+            stage_add_output(p, index, out);
+        if (eof)
+            stage_add_output(p, index, NULL);
+        pthread_cond_broadcast(&p->wakeup);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void pipeline_drop_frames(struct vf_pipeline *p)
+{
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_stage *st = p->stages[n];
+        for (int i = 0; i < st->num_queue; i++)
+            talloc_free(st->queue[i]);
+        st->num_queue = 0;
+    }
+    for (int n = 0; n < p->num_output; n++)
+        talloc_free(p->output[n]);
+    p->num_output = 0;
+    p->eof_sent = p->eof_done = false;
+    p->error = 0;
+}
+
+static void pipeline_create(struct vf_chain *c)
+{
+    if (c->pipeline || c->opts->vf_pipeline < 1 || c->initialized < 1)
+        return;
+    if (c->first->next == c->last)
+        return; // no actual filters
+
+    struct vf_pipeline *p = talloc_zero(NULL, struct vf_pipeline);
+    p->depth = c->opts->vf_pipeline;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    for (struct vf_instance *vf = c->first->next; vf != c->last; vf = vf->next) {
+        struct vf_stage *st = talloc_zero(p, struct vf_stage);
+        *st = (struct vf_stage){ .p = p, .vf = vf };
+        MP_TARRAY_APPEND(p, p->stages, p->num_stages, st);
+    }
+    c->pipeline = p;
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_stage *st = p->stages[n];
+        if (pthread_create(&st->thread, NULL, stage_thread, st)) {
+            MP_ERR(c, "Could not create filter thread.\n");
+            p->num_stages = n;
+            pipeline_destroy(c);
+            return;
+        }
+    }
+    MP_VERBOSE(c, "Running %d filters in a pipeline.\n", p->num_stages);
+}
+
+static void pipeline_destroy(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->terminate = true;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+    for (int n = 0; n < p->num_stages; n++) {
+        struct vf_stage *st = p->stages[n];
+        pthread_join(st->thread, NULL);
+        if (st->frames) {
+            MP_VERBOSE(c, "Filter %s: %"PRId64" frames, %.3f ms/frame, "
+                       "max. queue %d.\n", st->vf->info->name, st->frames,
+                       st->time_us / 1000.0 / st->frames, st->max_queue);
+        }
+    }
+    pipeline_drop_frames(p);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+    talloc_free(p);
+    c->pipeline = NULL;
+}
+
+// Wait until no filter is running on a worker thread, and keep it that way
+// until pipeline_resume().
+static void pipeline_pause(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->paused++;
+    for (int n = 0; n < p->num_stages; n++) {
+        while (p->stages[n]->busy)
+            pthread_cond_wait(&p->wakeup, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void pipeline_resume(struct vf_chain *c)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->paused--;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Pass the output of the "in" filter to the first stage.
+static void pipeline_feed(struct vf_chain *c, bool eof)
+{
+    struct vf_pipeline *p = c->pipeline;
+    struct vf_stage *st = p->stages[0];
+    pthread_mutex_lock(&p->lock);
+    struct mp_image *img;
+    while ((img = vf_dequeue_output_frame(c->first)))
+        MP_TARRAY_APPEND(st, st->queue, st->num_queue, img);
+    if (eof) {
+        MP_TARRAY_APPEND(st, st->queue, st->num_queue, NULL);
+        p->eof_sent = true;
+    } else {
+        p->eof_sent = p->eof_done = false;
+    }
+    st->max_queue = MPMAX(st->max_queue, st->num_queue);
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Like vf_output_frame(), but for pipelined mode. Blocks only if the first
+// stage's queue is full (or on EOF) and no output is available yet.
+static int pipeline_output_frame(struct vf_chain *c, bool eof)
+{
+    struct vf_pipeline *p = c->pipeline;
+    if (eof && !p->eof_sent)
+        pipeline_feed(c, true);
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        if (p->error < 0) {
+            int r = p->error;
+            p->error = 0;
+            pthread_mutex_unlock(&p->lock);
+            return r;
+        }
+        if (p->num_output) {
+            struct mp_image *img = p->output[0];
+            MP_TARRAY_REMOVE_AT(p->output, p->num_output, 0);
+            pthread_cond_broadcast(&p->wakeup);
+            if (!img) {
+                p->eof_done = true;
+                continue;
+            }
+            pthread_mutex_unlock(&p->lock);
+            int r = vf_do_filter(c->last, img);
+            if (r < 0)
+                return r;
+            c->output = vf_dequeue_output_frame(c->last);
+            if (c->output)
+                return 1;
+            pthread_mutex_lock(&p->lock);
+            continue;
+        }
+        if (eof ? p->eof_done : p->stages[0]->num_queue < p->depth)
+            break;
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
 // Input a frame into the filter chain. Ownership of img is transferred.
 // Return >= 0 on success, < 0 on failure (even if output frames were produced)
 int vf_filter_frame(struct vf_chain *c, struct mp_image *img)
@@ -412,7 +771,11 @@ int vf_filter_frame(struct vf_chain *c, struct mp_image *img)
     }
     assert(mp_image_params_equals(&img->params, &c->input_params));
     vf_fix_img_params(img, &c->override_params);
-    return vf_do_filter(c->first, img);
+    pipeline_create(c);
+    int r = vf_do_filter(c->first, img);
+    if (c->pipeline)
+        pipeline_feed(c, false);
+    return r;
 }
 
 // Output the next queued image (if any) from the full filter chain.
@@ -426,6 +789,8 @@ int vf_output_frame(struct vf_chain *c, bool eof)
         return 1;
     if (c->initialized < 1)
         return -1;
+    if (c->pipeline)
+        return pipeline_output_frame(c, eof);
     while (1) {
         struct vf_instance *last = NULL;
         for (struct vf_instance * cur = c->first; cur; cur = cur->next) {
@@ -477,8 +842,15 @@ static void vf_chain_forget_frames(struct vf_chain *c)
 
 void vf_seek_reset(struct vf_chain *c)
 {
+    pipeline_pause(c);
+    if (c->pipeline) {
+        pthread_mutex_lock(&c->pipeline->lock);
+        pipeline_drop_frames(c->pipeline);
+        pthread_mutex_unlock(&c->pipeline->lock);
+    }
     vf_control_all(c, VFCTRL_SEEK_RESET, NULL);
     vf_chain_forget_frames(c);
+    pipeline_resume(c);
 }
 
 int vf_next_config(struct vf_instance *vf,
@@ -590,6 +962,7 @@ int vf_reconfig(struct vf_chain *c, const struct mp_image_params *params,
                 const struct mp_image_params *override_params)
 {
     int r = 0;
+    pipeline_destroy(c);
     vf_chain_forget_frames(c);
     for (struct vf_instance *vf = c->first; vf; ) {
         struct vf_instance *next = vf->next;
@@ -640,6 +1013,14 @@ struct vf_instance *vf_find_by_label(struct vf_chain *c, const char *label)
 
 static void vf_uninit_filter(vf_instance_t *vf)
 {
+    if (vf->out_pool) {
+        struct mp_image_pool_stats st;
+        mp_image_pool_get_stats(vf->out_pool, &st);
+        if (st.hits || st.allocs) {
+            MP_DBG(vf, "Image pool: %lld hits, %lld misses, %lld allocations.\n",
+                   st.hits, st.misses, st.allocs);
+        }
+    }
     if (vf->uninit)
         vf->uninit(vf);
     vf_forget_frames(vf);
@@ -690,6 +1071,7 @@ void vf_destroy(struct vf_chain *c)
 {
     if (!c)
         return;
+    pipeline_destroy(c);
     while (c->first) {
         vf_instance_t *vf = c->first;
         c->first = vf->next;
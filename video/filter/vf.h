@@ -31,6 +31,7 @@ struct mpv_global;
 struct vf_instance;
 struct vf_priv_s;
 struct m_obj_settings;
+struct mp_thread_pool;
 
 typedef struct vf_info {
     const char *description;
@@ -90,6 +91,10 @@ typedef struct vf_instance {
     struct mp_image **out_queued;
     int num_out_queued;
 
+    // Lazily created by vf_run_slices().
+    struct mp_thread_pool *slice_pool;
+    int slice_threads;
+
     // Caches valid output formats.
     uint8_t last_outfmts[IMGFMT_END - IMGFMT_START];
 
@@ -113,6 +118,9 @@ struct vf_chain {
     struct mp_hwdec_info *hwdec;
 
     struct mp_image *output;
+
+    // Set if filters run on worker threads (--vf-pipeline)
+    struct vf_pipeline *pipeline;
 };
 
 typedef struct vf_seteq {
@@ -156,6 +164,8 @@ void vf_print_filter_chain(struct vf_chain *c, int msglevel,
 struct mp_image *vf_alloc_out_image(struct vf_instance *vf);
 void vf_make_out_image_writeable(struct vf_instance *vf, struct mp_image *img);
 void vf_add_output_frame(struct vf_instance *vf, struct mp_image *img);
+void vf_run_slices(struct vf_instance *vf, int h,
+                   void (*fn)(void *ctx, int y0, int y1), void *ctx);
 
 // default wrappers:
 int vf_next_config(struct vf_instance *vf,
@@ -22,6 +22,9 @@
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#include <libavutil/cpu.h>
 
 #include "config.h"
 #include "common/msg.h"
@@ -31,6 +34,7 @@
 #include "video/img_format.h"
 #include "video/mp_image.h"
 #include "vf.h"
+#include "video/filter/simd.h"
 
 #include "video/memcpy_pic.h"
 
@@ -61,25 +65,80 @@ static int diff_C(unsigned char *old, unsigned char *new, int os, int ns)
    return d;
    }
 
+#if HAVE_X86_SIMD
+/* same result as diff_C */
+static int SSE2_FN diff_sse2(unsigned char *old, unsigned char *new,
+                             int os, int ns)
+   {
+   __m128i sum=_mm_setzero_si128();
+   int y;
+
+   for(y=4; y; y--, new+=2*ns, old+=2*os)
+      {
+      __m128i o=_mm_unpacklo_epi64(_mm_loadl_epi64((__m128i *)(old+1)),
+                                   _mm_loadl_epi64((__m128i *)(old+os+1)));
+      __m128i n=_mm_unpacklo_epi64(_mm_loadl_epi64((__m128i *)(new+1)),
+                                   _mm_loadl_epi64((__m128i *)(new+ns+1)));
+      sum=_mm_add_epi64(sum, _mm_sad_epu8(o, n));
+      }
+
+   return _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_srli_si128(sum, 8)));
+   }
+#endif
+
 static int (*diff)(unsigned char *, unsigned char *, int, int);
 
-static int diff_plane(unsigned char *old, unsigned char *new,
-                      int w, int h, int os, int ns, int arg)
+/*
+ * The per-plane metrics below are computed in horizontal slices with
+ * vf_run_slices(). Each slice accumulates into locals, and the results
+ * are merged under the lock, so the result does not depend on the
+ * slicing.
+ */
+
+struct plane_slice
+   {
+   unsigned char *old, *new;
+   int w, os, ns;
+   pthread_mutex_t lock;
+   int max, sum, n;
+   unsigned int checksum;
+   };
+
+static void diff_slice(void *ptr, int y0, int y1)
    {
+   struct plane_slice *s=ptr;
    int x, y, d, max=0, sum=0, n=0;
 
-   for(y=0; y<h-7; y+=8)
+   /* y0/y1 are in units of 8 line blocks */
+   for(y=y0*8; y<y1*8; y+=8)
       {
-      for(x=0; x<w-7; x+=8)
+      for(x=0; x<s->w-7; x+=8)
          {
-         d=diff(old+x+y*os, new+x+y*ns, os, ns);
+         d=diff(s->old+x+y*s->os, s->new+x+y*s->ns, s->os, s->ns);
          if(d>max) max=d;
          sum+=d;
          n++;
          }
       }
 
-   return (sum+n*max)/2;
+   pthread_mutex_lock(&s->lock);
+   if(max>s->max) s->max=max;
+   s->sum+=sum;
+   s->n+=n;
+   pthread_mutex_unlock(&s->lock);
+   }
+
+static int diff_plane(struct vf_instance *vf, unsigned char *old,
+                      unsigned char *new, int w, int h, int os, int ns,
+                      int arg)
+   {
+   struct plane_slice s={ .old=old, .new=new, .w=w, .os=os, .ns=ns };
+
+   pthread_mutex_init(&s.lock, NULL);
+   vf_run_slices(vf, h/8, diff_slice, &s);
+   pthread_mutex_destroy(&s.lock);
+
+   return (s.sum+s.n*s.max)/2;
    }
 
 /*
@@ -99,8 +158,7 @@ static unsigned int checksum_plane(unsigned char *p, unsigned char *z,
 
 #define FAST_64BIT (UINTPTR_MAX >= UINT64_MAX)
 
-static unsigned int checksum_plane(unsigned char *p, unsigned char *z,
-                                   int w, int h, int s, int zs, int arg)
+static unsigned int checksum_lines(unsigned char *p, int w, int h, int s)
    {
    unsigned int shift;
    uint32_t sum, t;
@@ -133,7 +191,32 @@ static unsigned int checksum_plane(unsigned char *p, unsigned char *z,
    return sum;
    }
 
-static int deghost_plane(unsigned char *d, unsigned char *s,
+static void checksum_slice(void *ptr, int y0, int y1)
+   {
+   struct plane_slice *s=ptr;
+   /* every line starts with shift 0, so lines can be xor-ed in any order */
+   unsigned int sum=checksum_lines(s->old+y0*s->os, s->w, y1-y0, s->os);
+
+   pthread_mutex_lock(&s->lock);
+   s->checksum^=sum;
+   pthread_mutex_unlock(&s->lock);
+   }
+
+static unsigned int checksum_plane(struct vf_instance *vf, unsigned char *p,
+                                   unsigned char *z, int w, int h, int s,
+                                   int zs, int arg)
+   {
+   struct plane_slice sl={ .old=p, .w=w, .os=s };
+
+   pthread_mutex_init(&sl.lock, NULL);
+   vf_run_slices(vf, h, checksum_slice, &sl);
+   pthread_mutex_destroy(&sl.lock);
+
+   return sl.checksum;
+   }
+
+static int deghost_plane(struct vf_instance *vf, unsigned char *d,
+                         unsigned char *s,
                          int w, int h, int ds, int ss, int threshold)
    {
    int t;
@@ -147,18 +230,19 @@ static int deghost_plane(unsigned char *d, unsigned char *s,
    return 0;
    }
 
-static int copyop(unsigned char *d, unsigned char *s, int bpl, int h, int dstride, int sstride, int dummy) {
+static int copyop(struct vf_instance *vf, unsigned char *d, unsigned char *s, int bpl, int h, int dstride, int sstride, int dummy) {
   memcpy_pic(d, s, bpl, h, dstride, sstride);
   return 0;
 }
 
-static int imgop(int(*planeop)(unsigned char *, unsigned char *,
-                               int, int, int, int, int),
+static int imgop(struct vf_instance *vf,
+                 int(*planeop)(struct vf_instance *, unsigned char *,
+                               unsigned char *, int, int, int, int, int),
                  mp_image_t *dst, mp_image_t *src, int arg)
    {
        int sum = 0;
        for (int p = 0; p < dst->num_planes; p++) {
-           sum += planeop(dst->planes[p], src ? src->planes[p] : NULL,
+           sum += planeop(vf, dst->planes[p], src ? src->planes[p] : NULL,
                           (dst->w * dst->fmt.bytes[p]) >> dst->fmt.xs[p],
                           dst->plane_h[p], dst->stride[p],
                           src ? src->stride[p] : 0, arg);
@@ -234,8 +318,8 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
       {
       case 1:
          fprintf(p->file, "%08x %d\n",
-                 (unsigned int)imgop((void *)checksum_plane, mpi, 0, 0),
-                 p->frameno?imgop(diff_plane, dmpi, mpi, 0):0);
+                 (unsigned int)imgop(vf, (void *)checksum_plane, mpi, 0, 0),
+                 p->frameno?imgop(vf, diff_plane, dmpi, mpi, 0):0);
          break;
 
       case 2:
@@ -247,7 +331,7 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
             break;
             }
 
-         checksum=(unsigned int)imgop((void *)checksum_plane, mpi, 0, 0);
+         checksum=(unsigned int)imgop(vf, (void *)checksum_plane, mpi, 0, 0);
 
          if(checksum!=p->csdata[p->frameno])
             {
@@ -290,7 +374,7 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
                *histp=p->history+p->frameno%p->window;
 
             *sump-=*histp;
-            *sump+=(*histp=imgop(diff_plane, dmpi, mpi, 0));
+            *sump+=(*histp=imgop(vf, diff_plane, dmpi, mpi, 0));
             }
 
          m=match(p, p->sum, -1, -1, &d);
@@ -310,7 +394,7 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
    switch((p->frameno++-p->phase+10)%5)
       {
       case 0:
-         imgop(copyop, dmpi, mpi, 0);
+         imgop(vf, copyop, dmpi, mpi, 0);
          vf_detc_adjust_pts(&p->ptsbuf, pts, 0, 1);
          talloc_free(mpi);
          return 0;
@@ -318,16 +402,16 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
       case 4:
          if(p->deghost>0)
             {
-            imgop(copyop, dmpi, mpi, 0);
+            imgop(vf, copyop, dmpi, mpi, 0);
             vf_make_out_image_writeable(vf, mpi);
 
-            imgop(deghost_plane, mpi, dmpi, p->deghost);
+            imgop(vf, deghost_plane, mpi, dmpi, p->deghost);
             mpi->pts = vf_detc_adjust_pts(&p->ptsbuf, pts, 0, 0);
             return mpi;
             }
       }
 
-   imgop(copyop, dmpi, mpi, 0);
+   imgop(vf, copyop, dmpi, mpi, 0);
    mpi->pts = vf_detc_adjust_pts(&p->ptsbuf, pts, 0, 0);
    return mpi;
    }
@@ -599,6 +683,10 @@ static int vf_open(vf_instance_t *vf)
       abort();
 
    diff = diff_C;
+#if HAVE_X86_SIMD
+   if(av_get_cpu_flags() & AV_CPU_FLAG_SSE2)
+      diff = diff_sse2;
+#endif
 
    vf_detc_init_pts_buf(&p->ptsbuf);
    return 1;
@@ -56,6 +56,7 @@ typedef struct FilterParam{
         int shiftptr;
         int8_t *noise;
         int8_t *prev_shift[MAX_RES][3];
+        int shift[MAX_RES];     // per-line shift for the current plane
 }FilterParam;
 
 struct vf_priv_s {
@@ -175,7 +176,32 @@ static inline void lineNoiseAvg(uint8_t *dst, uint8_t *src, int len, int8_t **sh
 
 /***************************************************************************/
 
-static void donoise(uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp){
+struct noise_slice {
+        uint8_t *dst, *src;
+        int dstStride, srcStride, width;
+        FilterParam *fp;
+};
+
+static void donoise_slice(void *ptr, int y0, int y1){
+        struct noise_slice *s = ptr;
+        FilterParam *fp = s->fp;
+        int y;
+
+        for(y=y0; y<y1; y++)
+        {
+                uint8_t *dst = s->dst + y * s->dstStride;
+                uint8_t *src = s->src + y * s->srcStride;
+                int shift = fp->shift[y];
+                if (fp->averaged) {
+                    lineNoiseAvg(dst, src, s->width, fp->prev_shift[y]);
+                    fp->prev_shift[y][fp->shiftptr] = fp->noise + shift;
+                } else {
+                    lineNoise(dst, src, fp->noise, s->width, shift);
+                }
+        }
+}
+
+static void donoise(struct vf_instance *vf, uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp){
         int8_t *noise= fp->noise;
         int y;
         int shift=0;
@@ -197,21 +223,24 @@ static void donoise(uint8_t *dst, uint8_t *src, int dstStride, int srcStride, in
                 return;
         }
 
+        // Draw the random numbers up front, so that the lines can be processed
+        // in parallel and the result does not depend on the slicing.
         for(y=0; y<height; y++)
         {
                 if(fp->temporal)        shift=  rand()&(MAX_SHIFT  -1);
                 else                    shift= nonTempRandShift[y];
 
                 if(fp->quality==0) shift&= ~7;
-                if (fp->averaged) {
-                    lineNoiseAvg(dst, src, width, fp->prev_shift[y]);
-                    fp->prev_shift[y][fp->shiftptr] = noise + shift;
-                } else {
-                    lineNoise(dst, src, noise, width, shift);
-                }
-                dst+= dstStride;
-                src+= srcStride;
+                fp->shift[y] = shift;
         }
+
+        struct noise_slice slice = {
+            .dst = dst, .src = src,
+            .dstStride = dstStride, .srcStride = srcStride,
+            .width = width, .fp = fp,
+        };
+        vf_run_slices(vf, height, donoise_slice, &slice);
+
         fp->shiftptr++;
         if (fp->shiftptr == 3) fp->shiftptr = 0;
 }
@@ -224,9 +253,9 @@ static struct mp_image *filter(struct vf_instance *vf, struct mp_image *mpi)
             mp_image_copy_attributes(dmpi, mpi);
         }
 
-        donoise(dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w, mpi->h, &vf->priv->lumaParam);
-        donoise(dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
-        donoise(dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
+        donoise(vf, dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w, mpi->h, &vf->priv->lumaParam);
+        donoise(vf, dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
+        donoise(vf, dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam);
 
         if (dmpi != mpi)
             talloc_free(mpi);
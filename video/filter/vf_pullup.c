@@ -47,6 +47,12 @@ struct vf_priv_s {
         struct vf_lw_opts *lw_opts;
 };
 
+static void run_slices(void *ctx, int h, void (*fn)(void *fn_ctx, int y0, int y1),
+                       void *fn_ctx)
+{
+    vf_run_slices(ctx, h, fn, fn_ctx);
+}
+
 static void reset(struct vf_instance *vf)
 {
     if (vf->priv->ctx)
@@ -63,6 +69,8 @@ static void reset(struct vf_instance *vf)
     c->junk_bottom = vf->priv->junk_bottom;
     c->strict_breaks = vf->priv->strict_breaks;
     c->metric_plane = vf->priv->metric_plane;
+    c->run_slices = run_slices;
+    c->run_slices_ctx = vf;
 }
 
 static void init_pullup(struct vf_instance *vf, mp_image_t *mpi)
@@ -0,0 +1,261 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <libavutil/mem.h>
+
+#include "talloc.h"
+
+#include "common/common.h"
+#include "video/mp_image.h"
+
+#include "frame_arena.h"
+
+/* Allocator for big video frames, meant to be used with
+ * mp_image_pool_set_allocator(). Frame buffers are carved out of larger
+ * chunks, which are mapped and pre-faulted once when they're created. So the
+ * page fault cost of fresh buffers is paid once per chunk instead of every
+ * time the pool reallocates, and freed frames keep their pages. If requested,
+ * the chunks are aligned to and advised for transparent huge pages.
+ *
+ * Chunks with free slots are kept around as long as the requested frame size
+ * doesn't change, so it works best with a fixed-size mp_image_pool.
+ */
+
+// Alignment of the frame buffers and their strides (cache line size, and
+// enough for any SIMD code operating on the planes).
+#define FRAME_ALIGN 64
+#define SLOTS_PER_CHUNK 4
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+struct chunk;
+
+struct slot {
+    struct chunk *chunk;
+    uint8_t *data;
+    bool used;
+};
+
+struct chunk {
+    struct arena_state *state;
+    void *mem;                  // allocation as returned by mmap/av_malloc
+    size_t mem_size;
+    size_t slot_size;
+    int num_used;
+    struct slot slots[SLOTS_PER_CHUNK];
+};
+
+// Shared between the arena and the frames allocated from it, because the
+// frames can outlive the arena, and can be freed from any thread.
+struct arena_state {
+    pthread_mutex_t lock;
+    // --- the following fields are protected by lock
+    int refcount;               // arena + allocated frames
+    bool hugepages;
+    size_t cur_slot_size;       // size of the last requested frame
+    struct chunk **chunks;
+    int num_chunks;
+};
+
+struct mp_frame_arena {
+    struct arena_state *state;
+};
+
+static void *map_memory(size_t size, bool hugepages)
+{
+#if HAVE_SYS_MMAN_H
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (hugepages)
+        madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    // Pre-fault the memory, so that page faults don't happen while decoding
+    // or filtering into a fresh frame.
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+        page_size = 4096;
+    for (size_t n = 0; n < size; n += page_size)
+        ((volatile uint8_t *)mem)[n] = 0;
+    return mem;
+#else
+    void *mem = av_malloc(size);
+    if (mem)
+        memset(mem, 0, size);
+    return mem;
+#endif
+}
+
+static void unmap_memory(void *mem, size_t size)
+{
+#if HAVE_SYS_MMAN_H
+    munmap(mem, size);
+#else
+    av_free(mem);
+#endif
+}
+
+static void free_chunk(struct chunk *c)
+{
+    assert(!c->num_used);
+    unmap_memory(c->mem, c->mem_size);
+    talloc_free(c);
+}
+
+static struct chunk *new_chunk(struct arena_state *st, size_t slot_size)
+{
+    size_t align = st->hugepages ? HUGEPAGE_SIZE : FRAME_ALIGN;
+    size_t mem_size = slot_size * SLOTS_PER_CHUNK + align;
+    void *mem = map_memory(mem_size, st->hugepages);
+    if (!mem)
+        return NULL;
+    struct chunk *c = talloc_ptrtype(NULL, c);
+    *c = (struct chunk){
+        .state = st,
+        .mem = mem,
+        .mem_size = mem_size,
+        .slot_size = slot_size,
+    };
+    uint8_t *data = (uint8_t *)MP_ALIGN_UP((uintptr_t)mem, align);
+    for (int n = 0; n < SLOTS_PER_CHUNK; n++) {
+        c->slots[n] = (struct slot){ .chunk = c, .data = data };
+        data += slot_size;
+    }
+    return c;
+}
+
+static void state_unref_locked(struct arena_state *st)
+{
+    st->refcount--;
+    if (st->refcount) {
+        pthread_mutex_unlock(&st->lock);
+        return;
+    }
+    for (int n = 0; n < st->num_chunks; n++)
+        free_chunk(st->chunks[n]);
+    pthread_mutex_unlock(&st->lock);
+    pthread_mutex_destroy(&st->lock);
+    talloc_free(st);
+}
+
+// Release chunks that are unused and don't have the current frame size.
+static void gc_chunks(struct arena_state *st)
+{
+    for (int n = st->num_chunks - 1; n >= 0; n--) {
+        struct chunk *c = st->chunks[n];
+        if (!c->num_used && c->slot_size != st->cur_slot_size) {
+            free_chunk(c);
+            MP_TARRAY_REMOVE_AT(st->chunks, st->num_chunks, n);
+        }
+    }
+}
+
+static void free_frame(void *arg)
+{
+    struct slot *slot = arg;
+    struct chunk *c = slot->chunk;
+    struct arena_state *st = c->state;
+    pthread_mutex_lock(&st->lock);
+    assert(slot->used);
+    slot->used = false;
+    c->num_used--;
+    gc_chunks(st);
+    state_unref_locked(st);
+}
+
+static void arena_destructor(void *ptr)
+{
+    struct mp_frame_arena *arena = ptr;
+    struct arena_state *st = arena->state;
+    pthread_mutex_lock(&st->lock);
+    st->cur_slot_size = 0;
+    gc_chunks(st);
+    state_unref_locked(st);
+}
+
+// If hugepages is set, try to back the frames with transparent huge pages.
+// The arena can be freed with talloc_free() while frames allocated from it
+// are still referenced.
+struct mp_frame_arena *mp_frame_arena_create(void *ta_parent, bool hugepages)
+{
+    struct mp_frame_arena *arena = talloc_ptrtype(ta_parent, arena);
+    struct arena_state *st = talloc_ptrtype(NULL, st);
+    *st = (struct arena_state){ .refcount = 1, .hugepages = hugepages };
+    pthread_mutex_init(&st->lock, NULL);
+    *arena = (struct mp_frame_arena){ .state = st };
+    talloc_set_destructor(arena, arena_destructor);
+    return arena;
+}
+
+// Allocate a frame; compatible with mp_image_allocator. Falls back to a normal
+// allocation if a new chunk could not be mapped.
+struct mp_image *mp_frame_arena_alloc(void *ctx, int fmt, int w, int h)
+{
+    struct mp_frame_arena *arena = ctx;
+    struct arena_state *st = arena->state;
+    size_t size = mp_image_get_alloc_size(fmt, w, h, FRAME_ALIGN);
+    size = MP_ALIGN_UP(MPMAX(size, 1), FRAME_ALIGN);
+
+    pthread_mutex_lock(&st->lock);
+    if (st->cur_slot_size != size) {
+        st->cur_slot_size = size;
+        gc_chunks(st);
+    }
+    struct slot *slot = NULL;
+    for (int n = 0; n < st->num_chunks && !slot; n++) {
+        struct chunk *c = st->chunks[n];
+        if (c->slot_size != size || c->num_used == SLOTS_PER_CHUNK)
+            continue;
+        for (int i = 0; i < SLOTS_PER_CHUNK; i++) {
+            if (!c->slots[i].used) {
+                slot = &c->slots[i];
+                break;
+            }
+        }
+    }
+    if (!slot) {
+        struct chunk *c = new_chunk(st, size);
+        if (!c) {
+            pthread_mutex_unlock(&st->lock);
+            return mp_image_alloc(fmt, w, h);
+        }
+        MP_TARRAY_APPEND(st, st->chunks, st->num_chunks, c);
+        slot = &c->slots[0];
+    }
+    slot->used = true;
+    slot->chunk->num_used++;
+    st->refcount++;
+    pthread_mutex_unlock(&st->lock);
+
+    return mp_image_from_buffer(fmt, w, h, FRAME_ALIGN, slot->data, size,
+                                slot, free_frame);
+}
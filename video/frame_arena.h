@@ -0,0 +1,11 @@
+#ifndef MPV_FRAME_ARENA_H
+#define MPV_FRAME_ARENA_H
+
+#include <stdbool.h>
+
+struct mp_frame_arena;
+
+struct mp_frame_arena *mp_frame_arena_create(void *ta_parent, bool hugepages);
+struct mp_image *mp_frame_arena_alloc(void *arena, int fmt, int w, int h);
+
+#endif
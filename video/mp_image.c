@@ -117,19 +117,19 @@ static bool m_refcount_is_unique(struct m_refcount *ref)
     return true;
 }
 
-static void mp_image_alloc_planes(struct mp_image *mpi)
+// Set the strides for a newly allocated image, and return the size of each
+// plane in plane_size[]. Returns the total size.
+static size_t mp_image_plane_sizes(struct mp_image *mpi, int stride_align,
+                                   size_t plane_size[MP_MAX_PLANES])
 {
-    assert(!mpi->planes[0]);
-
     // Note: for non-mod-2 4:2:0 YUV frames, we have to allocate an additional
     //       top/right border. This is needed for correct handling of such
     //       images in filter and VO code (e.g. vo_vdpau or vo_opengl).
 
-    size_t plane_size[MP_MAX_PLANES];
     for (int n = 0; n < MP_MAX_PLANES; n++) {
         int alloc_h = MP_ALIGN_UP(mpi->h, 32) >> mpi->fmt.ys[n];
         int line_bytes = (mpi->plane_w[n] * mpi->fmt.bpp[n] + 7) / 8;
-        mpi->stride[n] = FFALIGN(line_bytes, SWS_MIN_BYTE_ALIGN);
+        mpi->stride[n] = FFALIGN(line_bytes, stride_align);
         plane_size[n] = mpi->stride[n] * alloc_h;
     }
     if (mpi->fmt.flags & MP_IMGFLAG_PAL)
@@ -138,17 +138,32 @@ static void mp_image_alloc_planes(struct mp_image *mpi)
     size_t sum = 0;
     for (int n = 0; n < MP_MAX_PLANES; n++)
         sum += plane_size[n];
+    return sum;
+}
 
-    uint8_t *data = av_malloc(FFMAX(sum, 1));
-    if (!data)
-        abort(); //out of memory
-
+static void mp_image_set_planes(struct mp_image *mpi, uint8_t *data,
+                                size_t plane_size[MP_MAX_PLANES])
+{
     for (int n = 0; n < MP_MAX_PLANES; n++) {
         mpi->planes[n] = plane_size[n] ? data : NULL;
         data += plane_size[n];
     }
 }
 
+static void mp_image_alloc_planes(struct mp_image *mpi)
+{
+    assert(!mpi->planes[0]);
+
+    size_t plane_size[MP_MAX_PLANES];
+    size_t sum = mp_image_plane_sizes(mpi, SWS_MIN_BYTE_ALIGN, plane_size);
+
+    uint8_t *data = av_malloc(FFMAX(sum, 1));
+    if (!data)
+        abort(); //out of memory
+
+    mp_image_set_planes(mpi, data, plane_size);
+}
+
 void mp_image_setfmt(struct mp_image *mpi, int out_fmt)
 {
     struct mp_imgfmt_desc fmt = mp_imgfmt_get_desc(out_fmt);
@@ -213,6 +228,40 @@ struct mp_image *mp_image_alloc(int imgfmt, int w, int h)
     return mpi;
 }
 
+// Return the buffer size mp_image_from_buffer() needs for the given format.
+// stride_align must be a power of 2, and at least SWS_MIN_BYTE_ALIGN.
+size_t mp_image_get_alloc_size(int imgfmt, int w, int h, int stride_align)
+{
+    struct mp_image mpi = {0};
+    mp_image_set_size(&mpi, w, h);
+    mp_image_setfmt(&mpi, imgfmt);
+    size_t plane_size[MP_MAX_PLANES];
+    return mp_image_plane_sizes(&mpi, stride_align, plane_size);
+}
+
+// Like mp_image_alloc(), but use the given buffer for the image data. The
+// buffer must have the size returned by mp_image_get_alloc_size(), and
+// free(free_arg) is called when the last reference to the image is gone.
+// The planes are aligned to stride_align if the buffer is.
+struct mp_image *mp_image_from_buffer(int imgfmt, int w, int h, int stride_align,
+                                      uint8_t *buffer, size_t buffer_size,
+                                      void *free_arg, void (*free)(void *arg))
+{
+    struct mp_image *mpi = talloc_zero(NULL, struct mp_image);
+    talloc_set_destructor(mpi, mp_image_destructor);
+    mp_image_set_size(mpi, w, h);
+    mp_image_setfmt(mpi, imgfmt);
+    size_t plane_size[MP_MAX_PLANES];
+    size_t sum = mp_image_plane_sizes(mpi, stride_align, plane_size);
+    assert(buffer_size >= sum);
+    mp_image_set_planes(mpi, buffer, plane_size);
+
+    mpi->refcount = m_refcount_new();
+    mpi->refcount->free = free;
+    mpi->refcount->arg = free_arg;
+    return mpi;
+}
+
 struct mp_image *mp_image_new_copy(struct mp_image *img)
 {
     struct mp_image *new = mp_image_alloc(img->imgfmt, img->w, img->h);
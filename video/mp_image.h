@@ -109,6 +109,10 @@ typedef struct mp_image {
 } mp_image_t;
 
 struct mp_image *mp_image_alloc(int fmt, int w, int h);
+size_t mp_image_get_alloc_size(int imgfmt, int w, int h, int stride_align);
+struct mp_image *mp_image_from_buffer(int imgfmt, int w, int h, int stride_align,
+                                      uint8_t *buffer, size_t buffer_size,
+                                      void *free_arg, void (*free)(void *arg));
 void mp_image_copy(struct mp_image *dmpi, struct mp_image *mpi);
 void mp_image_copy_attributes(struct mp_image *dmpi, struct mp_image *mpi);
 struct mp_image *mp_image_new_copy(struct mp_image *img);
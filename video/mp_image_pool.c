@@ -30,40 +30,74 @@
 
 #include "mp_image_pool.h"
 
-static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define pool_lock() pthread_mutex_lock(&pool_mutex)
-#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
-
 // Thread-safety: the pool itself is not thread-safe, but pool-allocated images
 // can be referenced and unreferenced from other threads. (As long as the image
 // destructors are thread-safe.)
 
+// State shared between a pool and the images allocated from it. Images can be
+// unreferenced from any thread, and possibly after the pool was destroyed, so
+// this has its own lock and is refcounted (by the pool and each image).
+struct pool_shared {
+    pthread_mutex_t lock;
+    // --- the following fields are protected by lock
+    int refcount;
+    // Images not referenced outside of the pool, in the order they were
+    // released (oldest first).
+    struct mp_image **free_images;
+    int num_free;
+};
+
 struct mp_image_pool {
     int max_count;
 
     struct mp_image **images;
     int num_images;
 
+    struct pool_shared *shared;
+
     mp_image_allocator allocator;
     void *allocator_ctx;
 
     bool use_lru;
-    unsigned int lru_counter;
+
+    struct mp_image_pool_stats stats;
 };
 
 // Used to gracefully handle the case when the pool is freed while image
 // references allocated from the image pool are still held by someone.
 struct image_flags {
+    struct pool_shared *shared;
+    // --- the following fields are protected by shared->lock
     // If both of these are false, the image must be freed.
     bool referenced;            // outside mp_image reference exists
     bool pool_alive;            // the mp_image_pool references this
-    unsigned int order;         // for LRU allocation (basically a timestamp)
 };
 
+static void shared_unref(struct pool_shared *shared)
+{
+    pthread_mutex_lock(&shared->lock);
+    bool last = --shared->refcount == 0;
+    pthread_mutex_unlock(&shared->lock);
+    if (last) {
+        assert(!shared->num_free);
+        pthread_mutex_destroy(&shared->lock);
+        talloc_free(shared);
+    }
+}
+
+static void free_image(struct mp_image *img)
+{
+    struct image_flags *it = img->priv;
+    struct pool_shared *shared = it->shared;
+    talloc_free(img);
+    shared_unref(shared);
+}
+
 static void image_pool_destructor(void *ptr)
 {
     struct mp_image_pool *pool = ptr;
     mp_image_pool_clear(pool);
+    shared_unref(pool->shared);
 }
 
 struct mp_image_pool *mp_image_pool_new(int max_count)
@@ -72,23 +106,31 @@ struct mp_image_pool *mp_image_pool_new(int max_count)
     talloc_set_destructor(pool, image_pool_destructor);
     *pool = (struct mp_image_pool) {
         .max_count = max_count,
+        .shared = talloc_ptrtype(NULL, pool->shared),
     };
+    *pool->shared = (struct pool_shared) { .refcount = 1 };
+    pthread_mutex_init(&pool->shared->lock, NULL);
     return pool;
 }
 
 void mp_image_pool_clear(struct mp_image_pool *pool)
 {
+    struct pool_shared *shared = pool->shared;
+    pthread_mutex_lock(&shared->lock);
+    shared->num_free = 0;
     for (int n = 0; n < pool->num_images; n++) {
         struct mp_image *img = pool->images[n];
         struct image_flags *it = img->priv;
-        bool referenced;
-        pool_lock();
         assert(it->pool_alive);
         it->pool_alive = false;
-        referenced = it->referenced;
-        pool_unlock();
-        if (!referenced)
-            talloc_free(img);
+        // Unreferenced images are freed below; mark the others by NULL.
+        if (it->referenced)
+            pool->images[n] = NULL;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    for (int n = 0; n < pool->num_images; n++) {
+        if (pool->images[n])
+            free_image(pool->images[n]);
     }
     pool->num_images = 0;
 }
@@ -99,14 +141,25 @@ static void unref_image(void *ptr)
 {
     struct mp_image *img = ptr;
     struct image_flags *it = img->priv;
+    struct pool_shared *shared = it->shared;
     bool alive;
-    pool_lock();
+    pthread_mutex_lock(&shared->lock);
     assert(it->referenced);
     it->referenced = false;
     alive = it->pool_alive;
-    pool_unlock();
+    if (alive)
+        MP_TARRAY_APPEND(shared, shared->free_images, shared->num_free, img);
+    pthread_mutex_unlock(&shared->lock);
     if (!alive)
-        talloc_free(img);
+        free_image(img);
+}
+
+static struct mp_image *ref_image(struct mp_image *img)
+{
+    struct image_flags *it = img->priv;
+    assert(!it->referenced && it->pool_alive);
+    it->referenced = true;
+    return mp_image_new_custom_ref(img, img, unref_image);
 }
 
 // Return a new image of given format/size. Unlike mp_image_pool_get(), this
@@ -114,33 +167,28 @@ static void unref_image(void *ptr)
 struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
                                             int w, int h)
 {
+    struct pool_shared *shared = pool->shared;
     struct mp_image *new = NULL;
-    pool_lock();
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
-        struct image_flags *img_it = img->priv;
-        assert(img_it->pool_alive);
-        if (!img_it->referenced) {
-            if (img->imgfmt == fmt && img->w == w && img->h == h) {
-                if (pool->use_lru) {
-                    struct image_flags *new_it = new ? new->priv : NULL;
-                    if (!new_it || new_it->order > img_it->order)
-                        new = img;
-                } else {
-                    new = img;
-                    break;
-                }
-            }
+    pthread_mutex_lock(&shared->lock);
+    // Usually all images have the same format, so the first candidate
+    // matches. In LRU mode take the image released longest ago, otherwise
+    // the most recently released one (more likely to be in the CPU cache).
+    for (int i = 0; i < shared->num_free; i++) {
+        int n = pool->use_lru ? i : shared->num_free - 1 - i;
+        struct mp_image *img = shared->free_images[n];
+        if (img->imgfmt == fmt && img->w == w && img->h == h) {
+            MP_TARRAY_REMOVE_AT(shared->free_images, shared->num_free, n);
+            new = ref_image(img);
+            break;
         }
     }
-    pool_unlock();
-    if (!new)
-        return NULL;
-    struct image_flags *it = new->priv;
-    assert(!it->referenced && it->pool_alive);
-    it->referenced = true;
-    it->order = ++pool->lru_counter;
-    return mp_image_new_custom_ref(new, new, unref_image);
+    pthread_mutex_unlock(&shared->lock);
+    if (new) {
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    return new;
 }
 
 // Return a new image of given format/size. The only difference to
@@ -154,22 +202,36 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
     if (!new) {
         if (pool->num_images >= pool->max_count)
             mp_image_pool_clear(pool);
+        struct mp_image *img;
         if (pool->allocator) {
-            new = pool->allocator(pool->allocator_ctx, fmt, w, h);
+            img = pool->allocator(pool->allocator_ctx, fmt, w, h);
         } else {
-            new = mp_image_alloc(fmt, w, h);
+            img = mp_image_alloc(fmt, w, h);
         }
-        if (!new)
+        if (!img)
             return NULL;
-        struct image_flags *it = talloc_ptrtype(new, it);
-        *it = (struct image_flags) { .pool_alive = true };
-        new->priv = it;
-        MP_TARRAY_APPEND(pool, pool->images, pool->num_images, new);
-        new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
+        struct pool_shared *shared = pool->shared;
+        struct image_flags *it = talloc_ptrtype(img, it);
+        *it = (struct image_flags) { .shared = shared, .pool_alive = true };
+        img->priv = it;
+        MP_TARRAY_APPEND(pool, pool->images, pool->num_images, img);
+        pool->stats.allocs++;
+        pthread_mutex_lock(&shared->lock);
+        shared->refcount++;
+        new = ref_image(img);
+        pthread_mutex_unlock(&shared->lock);
     }
     return new;
 }
 
+// Return the hit/miss/allocation counters, e.g. for profiling.
+void mp_image_pool_get_stats(struct mp_image_pool *pool,
+                             struct mp_image_pool_stats *stats)
+{
+    *stats = pool->stats;
+    stats->num_images = pool->num_images;
+}
+
 // Like mp_image_new_copy(), but allocate the image out of the pool.
 struct mp_image *mp_image_pool_new_copy(struct mp_image_pool *pool,
                                         struct mp_image *img)
@@ -3,12 +3,21 @@
 
 struct mp_image_pool;
 
+struct mp_image_pool_stats {
+    long long hits;         // images reused from the pool
+    long long misses;       // no free image of the requested format/size
+    long long allocs;       // newly allocated images
+    int num_images;         // images currently owned by the pool
+};
+
 struct mp_image_pool *mp_image_pool_new(int max_count);
 struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
                                    int w, int h);
 void mp_image_pool_clear(struct mp_image_pool *pool);
 
 void mp_image_pool_set_lru(struct mp_image_pool *pool);
+void mp_image_pool_get_stats(struct mp_image_pool *pool,
+                             struct mp_image_pool_stats *stats);
 
 struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
                                             int w, int h);
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <libavutil/common.h>
 
@@ -33,12 +34,23 @@
 
 #define IS_POWER_OF_2(x) (((x) > 0) && !(((x) - 1) & (x)))
 
+// Repack everything if more than this fraction of the area allocated since the
+// last full packing is used by bitmaps which went away.
+#define COMPACT_THRESHOLD 0.5
+
+struct packer_entry {
+    struct pos size;        // as in packer->in
+    uint64_t hash;
+    struct pos pos;
+};
+
 void packer_reset(struct bitmap_packer *packer)
 {
     struct bitmap_packer old = *packer;
     *packer = (struct bitmap_packer) {
         .w_max = old.w_max,
         .h_max = old.h_max,
+        .incremental = old.incremental,
     };
     talloc_free_children(packer);
 }
@@ -187,11 +199,161 @@ void packer_set_size(struct bitmap_packer *packer, int size)
     packer->asize = FFMAX(packer->asize * 2, size);
     talloc_free(packer->result);
     talloc_free(packer->scratch);
+    talloc_free(packer->changed);
     packer->in = talloc_realloc(packer, packer->in, struct pos, packer->asize);
     packer->result = talloc_array_ptrtype(packer, packer->result,
                                           packer->asize);
     packer->scratch = talloc_array_ptrtype(packer, packer->scratch,
                                            packer->asize + 16);
+    packer->changed = talloc_array_ptrtype(packer, packer->changed,
+                                           packer->asize);
+}
+
+static int get_bytes_per_pixel(int format)
+{
+    switch (format) {
+    case SUBBITMAP_LIBASS:  return 1;
+    case SUBBITMAP_RGBA:    return 4;
+    default:                return 0;
+    }
+}
+
+static uint64_t hash_bitmap(struct sub_bitmap *s, int bpp)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int len = s->w * bpp;
+    for (int y = 0; y < s->h; y++) {
+        uint8_t *line = (uint8_t *)s->bitmap + y * s->stride;
+        int x = 0;
+        for (; x + 8 <= len; x += 8) {
+            uint64_t v;
+            memcpy(&v, line + x, 8);
+            hash = (hash ^ v) * 1099511628211ULL;
+            hash ^= hash >> 32;
+        }
+        for (; x < len; x++)
+            hash = (hash ^ line[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Place a new rectangle below or right of everything placed so far.
+static bool place_rectangle(struct bitmap_packer *packer, struct pos size,
+                            struct pos *out)
+{
+    int w = packer->w + packer->padding;
+    int h = packer->h + packer->padding;
+    if (packer->shelf_x + size.x > w) {
+        packer->shelf_y += packer->shelf_h;
+        packer->shelf_x = 0;
+        packer->shelf_h = 0;
+    }
+    if (size.x > w || packer->shelf_y + size.y > h)
+        return false;
+    *out = (struct pos){packer->shelf_x, packer->shelf_y};
+    packer->shelf_x += size.x;
+    packer->shelf_h = FFMAX(packer->shelf_h, size.y);
+    packer->used_width = FFMAX(packer->used_width,
+                               FFMIN(out->x + size.x, packer->w));
+    packer->used_height = FFMAX(packer->used_height,
+                                FFMIN(out->y + size.y, packer->h));
+    packer->alloc_area += (int64_t)size.x * size.y;
+    return true;
+}
+
+static int find_entry(struct bitmap_packer *packer, struct packer_entry *e,
+                      bool *taken, int start)
+{
+    for (int n = 0; n < packer->num_entries; n++) {
+        int i = (start + n) % packer->num_entries;
+        struct packer_entry *o = &packer->entries[i];
+        if (!taken[i] && o->hash == e->hash && o->size.x == e->size.x &&
+            o->size.y == e->size.y)
+            return i;
+    }
+    return -1;
+}
+
+// Try to reuse the positions from the previous call. Returns false if
+// everything needs to be packed again.
+static bool pack_incremental(struct bitmap_packer *packer,
+                             struct packer_entry *entries)
+{
+    bool *taken = talloc_zero_array(NULL, bool, packer->num_entries);
+    for (int i = 0; i < packer->count; i++) {
+        packer->changed[i] = true;
+        if (!entries[i].size.x) {
+            packer->result[i] = (struct pos){0};
+            packer->changed[i] = false;
+            continue;
+        }
+        // Usually the bitmaps come in the same order as before.
+        int n = find_entry(packer, &entries[i], taken, i);
+        if (n >= 0) {
+            taken[n] = true;
+            packer->result[i] = packer->entries[n].pos;
+            packer->changed[i] = false;
+        }
+    }
+    for (int n = 0; n < packer->num_entries; n++) {
+        struct pos size = packer->entries[n].size;
+        if (!taken[n])
+            packer->dead_area += (int64_t)size.x * size.y;
+    }
+    talloc_free(taken);
+
+    if (packer->dead_area > packer->alloc_area * COMPACT_THRESHOLD)
+        return false;
+
+    for (int i = 0; i < packer->count; i++) {
+        if (packer->changed[i] &&
+            !place_rectangle(packer, packer->in[i], &packer->result[i]))
+            return false;
+    }
+    return true;
+}
+
+static int pack_subbitmaps_incremental(struct bitmap_packer *packer,
+                                       struct sub_bitmaps *b)
+{
+    int bpp = get_bytes_per_pixel(b->format);
+    struct packer_entry *entries =
+        talloc_array(packer, struct packer_entry, packer->count);
+    for (int i = 0; i < packer->count; i++) {
+        struct pos size = packer->in[i];
+        if (size.x <= packer->padding || size.y <= packer->padding)
+            size = (struct pos){0, 0};
+        entries[i] = (struct packer_entry){
+            .size = size,
+            .hash = size.x && bpp ? hash_bitmap(&b->parts[i], bpp) : 0,
+        };
+    }
+
+    int r = 0;
+    packer->repacked = !bpp || !packer->num_entries ||
+                       b->format != packer->prev_format ||
+                       packer->padding != packer->prev_padding ||
+                       !pack_incremental(packer, entries);
+    if (packer->repacked) {
+        r = packer_pack(packer);
+        for (int i = 0; i < packer->count; i++)
+            packer->changed[i] = true;
+        // Add new bitmaps below the packed ones.
+        packer->shelf_x = packer->shelf_h = 0;
+        packer->shelf_y = packer->used_height;
+        packer->alloc_area = packer->dead_area = 0;
+        for (int i = 0; i < packer->count; i++)
+            packer->alloc_area += (int64_t)entries[i].size.x * entries[i].size.y;
+    }
+
+    talloc_free(packer->entries);
+    packer->entries = entries;
+    packer->num_entries = r < 0 || !bpp ? 0 : packer->count;
+    for (int i = 0; i < packer->num_entries; i++)
+        entries[i].pos = packer->result[i];
+    packer->prev_format = b->format;
+    packer->prev_padding = packer->padding;
+    return r;
 }
 
 int packer_pack_from_subbitmaps(struct bitmap_packer *packer,
@@ -204,13 +366,45 @@ int packer_pack_from_subbitmaps(struct bitmap_packer *packer,
     int a = packer->padding;
     for (int i = 0; i < b->num_parts; i++)
         packer->in[i] = (struct pos){b->parts[i].w + a, b->parts[i].h + a};
+    if (packer->incremental)
+        return pack_subbitmaps_incremental(packer, b);
     return packer_pack(packer);
 }
 
+void packer_get_clear_rect(struct bitmap_packer *packer, int n,
+                           struct pos out[2])
+{
+    struct pos p = packer->result[n];
+    int a = packer->padding;
+    out[0] = (struct pos){FFMAX(p.x - a, 0), FFMAX(p.y - a, 0)};
+    out[1] = (struct pos){FFMIN(p.x + packer->in[n].x, packer->w),
+                          FFMIN(p.y + packer->in[n].y, packer->h)};
+}
+
 void packer_copy_subbitmaps(struct bitmap_packer *packer, struct sub_bitmaps *b,
                             void *data, int pixel_stride, int stride)
 {
     assert(packer->count == b->num_parts);
+    if (packer->incremental && !packer->repacked) {
+        for (int n = 0; n < packer->count; n++) {
+            if (!packer->changed[n])
+                continue;
+            struct sub_bitmap *s = &b->parts[n];
+            struct pos p = packer->result[n];
+            if (packer->padding) {
+                struct pos rc[2];
+                packer_get_clear_rect(packer, n, rc);
+                void *cdata = (uint8_t *)data + rc[0].y * stride +
+                              rc[0].x * pixel_stride;
+                memset_pic(cdata, 0, (rc[1].x - rc[0].x) * pixel_stride,
+                           rc[1].y - rc[0].y, stride);
+            }
+            void *pdata = (uint8_t *)data + p.y * stride + p.x * pixel_stride;
+            memcpy_pic(pdata, s->bitmap, s->w * pixel_stride, s->h,
+                       stride, s->stride);
+        }
+        return;
+    }
     if (packer->padding) {
         struct pos bb[2];
         packer_get_bb(packer, bb);
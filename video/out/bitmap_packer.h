@@ -1,6 +1,9 @@
 #ifndef MPLAYER_PACK_RECTANGLES_H
 #define MPLAYER_PACK_RECTANGLES_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 struct pos {
     int x;
     int y;
@@ -17,16 +20,29 @@ struct bitmap_packer {
     struct pos *result;
     int used_width;
     int used_height;
+    // If set, packer_pack_from_subbitmaps() keeps the positions of bitmaps
+    // which were already packed by the previous call, and only places new
+    // ones. changed[i] is then set if bitmap i has to be copied again.
+    bool incremental;
+    bool *changed;
+    // Set if the last call packed everything again (all bitmaps changed).
+    bool repacked;
 
     // internal
     int *scratch;
     int asize;
+    struct packer_entry *entries;
+    int num_entries;
+    int prev_format, prev_padding;
+    int shelf_x, shelf_y, shelf_h;
+    int64_t alloc_area, dead_area;
 };
 
 struct ass_image;
 struct sub_bitmaps;
 
-// Clear all internal state. Leave the following fields: w_max, h_max
+// Clear all internal state. Leave the following fields: w_max, h_max,
+// incremental
 void packer_reset(struct bitmap_packer *packer);
 
 // Get the bounding box used for bitmap data (including padding).
@@ -52,16 +68,27 @@ int packer_pack(struct bitmap_packer *packer);
 /* Like above, but packer->count will be automatically set and
  * packer->in will be reallocated if needed and filled from the
  * given image list.
+ * With packer->incremental set, bitmaps with the same size and contents as
+ * one from the previous call keep their position, and new bitmaps are added
+ * to the free space. Everything is repacked if they don't fit, or if too much
+ * space is wasted by bitmaps which went away.
  */
 int packer_pack_from_subbitmaps(struct bitmap_packer *packer,
                                 struct sub_bitmaps *b);
 
+// In incremental mode, get the area which has to be cleared before bitmap n is
+// copied, if padding is used. This includes padding on all sides.
+void packer_get_clear_rect(struct bitmap_packer *packer, int n,
+                           struct pos out[2]);
+
 // Copy the (already packed) sub-bitmaps from b to the image in data.
 // data must point to an image that is at least (packer->w, packer->h) big.
 // The image has the given stride (bytes between (x, y) to (x, y + 1)), and the
 // pixel format used by both the sub-bitmaps and the image uses pixel_stride
 // bytes per pixel (bytes between (x, y) to (x + 1, y)).
 // If packer->padding is set, the padding borders are cleared with 0.
+// In incremental mode, only bitmaps with packer->changed[i] set are copied,
+// and data must contain what was copied into it the previous time.
 void packer_copy_subbitmaps(struct bitmap_packer *packer, struct sub_bitmaps *b,
                             void *data, int pixel_stride, int stride);
 
@@ -66,6 +66,7 @@ struct mpgl_osd *mpgl_osd_init(GL *gl, struct mp_log *log, bool legacy)
             .packer = talloc_struct(p, struct bitmap_packer, {
                 .w_max = max_texture_size,
                 .h_max = max_texture_size,
+                .incremental = true,
             }),
         };
         ctx->parts[n] = p;
@@ -135,7 +136,8 @@ static void upload_tex(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
                        struct sub_bitmaps *imgs)
 {
     struct osd_fmt_entry fmt = ctx->fmt_table[imgs->format];
-    if (osd->packer->padding) {
+    bool all = !osd->packer->incremental || osd->packer->repacked;
+    if (osd->packer->padding && all) {
         struct pos bb[2];
         packer_get_bb(osd->packer, bb);
         glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
@@ -146,6 +148,19 @@ static void upload_tex(struct mpgl_osd *ctx, struct mpgl_osd_part *osd,
         struct sub_bitmap *s = &imgs->parts[n];
         struct pos p = osd->packer->result[n];
 
+        if (!all) {
+            // Unchanged bitmaps are still in the texture.
+            if (!osd->packer->changed[n])
+                continue;
+            if (osd->packer->padding) {
+                struct pos rc[2];
+                packer_get_clear_rect(osd->packer, n, rc);
+                glClearTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
+                           rc[0].x, rc[0].y, rc[1].x - rc[0].x,
+                           rc[1].y - rc[0].y, 0, &ctx->scratch);
+            }
+        }
+
         glUploadTex(ctx->gl, GL_TEXTURE_2D, fmt.format, fmt.type,
                     s->bitmap, s->stride, p.x, p.y, s->w, s->h, 0);
     }
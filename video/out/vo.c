@@ -25,6 +25,7 @@
 #include <stdbool.h>
 
 #include <unistd.h>
+#include <pthread.h>
 
 #include <libavutil/common.h>
 
@@ -32,6 +33,8 @@
 
 #include "config.h"
 #include "osdep/timer.h"
+#include "osdep/threads.h"
+#include "misc/dispatch.h"
 #include "options/options.h"
 #include "bstr/bstr.h"
 #include "vo.h"
@@ -112,7 +115,163 @@ const struct vo_driver *video_out_drivers[] =
         NULL
 };
 
+// How far in advance frames are passed to the VO thread (in seconds).
+#define VO_THREAD_QUEUE_AHEAD 0.050
+
+/* With --vo-thread, all driver functions run on a separate thread, which
+ * also owns the window. vo_flip_page() only hands the frame to this thread,
+ * which draws it right away and flips it at the requested time, so the
+ * playback thread can decode the next frame in the meantime. Only one frame
+ * is in flight at a time; all other calls wait until it has been flipped.
+ * Without --vo-thread, dispatch is NULL and the driver is called directly. */
+struct vo_internal {
+    pthread_t thread;
+    struct mp_dispatch_queue *dispatch;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // --- protected by lock
+    bool terminate;
+    bool frame_queued;      // frame submitted, but not flipped yet
+    bool flip_pending;      // frame drawn, waiting for flip_pts
+    int64_t flip_pts;
+    int flip_duration;
+    double flip_delay;      // how late the last frame was flipped
+    bool check_events;      // VOCTRL_CHECK_EVENTS requested
+    bool want_redraw;       // vo->want_redraw, as seen by the playback thread
+
+    // --- playback thread only
+    struct mp_image *frame_image;   // set by vo_new_frame_imminent()
+    struct osd_state *frame_osd;    // set by vo_draw_osd()
+};
+
+struct frame_job {
+    struct vo *vo;
+    struct mp_image *image;
+    struct osd_state *osd;
+    int64_t pts_us;
+    int duration;
+};
+
 static void forget_frames(struct vo *vo);
+static void *vo_thread(void *ptr);
+
+static bool on_vo_thread(struct vo *vo)
+{
+    return !vo->in->dispatch || pthread_equal(pthread_self(), vo->in->thread);
+}
+
+// Wait until the frame submitted with vo_flip_page() was flipped.
+static void wait_frame_done(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    pthread_mutex_lock(&in->lock);
+    while (in->frame_queued)
+        pthread_cond_wait(&in->wakeup, &in->lock);
+    pthread_mutex_unlock(&in->lock);
+}
+
+// Run fn(data) on the VO thread (or directly if there's none), after the
+// frame in flight has been flipped.
+static void vo_run(struct vo *vo, mp_dispatch_fn fn, void *data)
+{
+    if (on_vo_thread(vo)) {
+        fn(data);
+    } else {
+        wait_frame_done(vo);
+        mp_dispatch_run(vo->in->dispatch, fn, data);
+    }
+}
+
+static void run_preinit(void *p)
+{
+    void **pp = p;
+    struct vo *vo = pp[0];
+    *(int *)pp[1] = vo->driver->preinit(vo);
+}
+
+static void run_uninit(void *p)
+{
+    struct vo *vo = p;
+    vo->driver->uninit(vo);
+}
+
+static void run_query_format(void *p)
+{
+    void **pp = p;
+    struct vo *vo = pp[0];
+    *(int *)pp[2] = vo->driver->query_format(vo, *(uint32_t *)pp[1]);
+}
+
+static void run_reconfig(void *p)
+{
+    void **pp = p;
+    struct vo *vo = pp[0];
+    *(int *)pp[3] = vo->driver->reconfig(vo, pp[1], *(int *)pp[2]);
+}
+
+static void run_control(void *p)
+{
+    void **pp = p;
+    struct vo *vo = pp[0];
+    *(int *)pp[3] = vo->driver->control(vo, *(uint32_t *)pp[1], pp[2]);
+}
+
+static void run_filter_image(void *p)
+{
+    void **pp = p;
+    struct vo *vo = pp[0];
+    pp[1] = vo->driver->filter_image(vo, pp[1]);
+}
+
+static void run_forget_frames(void *p)
+{
+    struct vo *vo = p;
+    struct vo_internal *in = vo->in;
+    for (int n = 0; n < vo->num_video_queue; n++)
+        talloc_free(vo->video_queue[n]);
+    vo->num_video_queue = 0;
+    talloc_free(in->frame_image);
+    in->frame_image = NULL;
+    in->frame_osd = NULL;
+}
+
+static void dummy_fn(void *p)
+{
+}
+
+static void start_vo_thread(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    in->dispatch = mp_dispatch_create(in);
+    if (pthread_create(&in->thread, NULL, vo_thread, vo)) {
+        MP_ERR(vo, "Could not create VO thread.\n");
+        talloc_free(in->dispatch);
+        in->dispatch = NULL;
+    }
+}
+
+static void stop_vo_thread(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    if (!in->dispatch)
+        return;
+    pthread_mutex_lock(&in->lock);
+    in->terminate = true;
+    pthread_mutex_unlock(&in->lock);
+    mp_dispatch_enqueue(in->dispatch, dummy_fn, NULL);
+    pthread_join(in->thread, NULL);
+    talloc_free(in->dispatch);
+    in->dispatch = NULL;
+}
+
+static void vo_internal_dtor(void *p)
+{
+    struct vo_internal *in = p;
+    pthread_cond_destroy(&in->wakeup);
+    pthread_mutex_destroy(&in->lock);
+}
 
 static bool get_desc(struct m_obj_desc *dst, int index)
 {
@@ -174,7 +333,11 @@ static struct vo *vo_create(struct mpv_global *global,
         .event_fd = -1,
         .monitor_par = 1,
         .max_video_queue = 1,
+        .in = talloc_zero(vo, struct vo_internal),
     };
+    pthread_mutex_init(&vo->in->lock, NULL);
+    pthread_cond_init(&vo->in->wakeup, NULL);
+    talloc_set_destructor(vo->in, vo_internal_dtor);
     talloc_steal(vo, log);
     if (vo->driver->encode != !!vo->encode_lavc_ctx)
         goto error;
@@ -184,14 +347,23 @@ static struct vo *vo_create(struct mpv_global *global,
     if (m_config_set_obj_params(config, args) < 0)
         goto error;
     vo->priv = config->optstruct;
-    if (vo->driver->preinit(vo))
+    if (vo->opts->threaded && !vo->driver->encode)
+        start_vo_thread(vo);
+    int r = 0;
+    vo_run(vo, run_preinit, (void *[]){vo, &r});
+    if (r)
         goto error;
+    if (vo->in->dispatch) {
+        vo->flip_queue_offset = MPMAX(vo->flip_queue_offset,
+                                      VO_THREAD_QUEUE_AHEAD);
+    }
     if (vo->event_fd != -1) {
         mp_input_add_fd(vo->input_ctx, vo->event_fd, 1, NULL, event_fd_callback,
                         NULL, vo);
     }
     return vo;
 error:
+    stop_vo_thread(vo);
     talloc_free(vo);
     return NULL;
 }
@@ -230,7 +402,8 @@ void vo_destroy(struct vo *vo)
     if (vo->event_fd != -1)
         mp_input_rm_key_fd(vo->input_ctx, vo->event_fd);
     forget_frames(vo);
-    vo->driver->uninit(vo);
+    vo_run(vo, run_uninit, vo);
+    stop_vo_thread(vo);
     talloc_free(vo);
 }
 
@@ -254,7 +427,12 @@ int vo_reconfig(struct vo *vo, struct mp_image_params *params, int flags)
     talloc_free(vo->params);
     vo->params = talloc_memdup(vo, params, sizeof(*params));
 
-    int ret = vo->driver->reconfig(vo, vo->params, flags);
+    int ret = 0;
+    vo_run(vo, run_reconfig, (void *[]){vo, vo->params, &flags, &ret});
+    if (vo->in->dispatch) {
+        vo->flip_queue_offset = MPMAX(vo->flip_queue_offset,
+                                      VO_THREAD_QUEUE_AHEAD);
+    }
     vo->config_ok = ret >= 0;
     if (vo->config_ok) {
         check_vo_caps(vo);
@@ -269,14 +447,23 @@ int vo_reconfig(struct vo *vo, struct mp_image_params *params, int flags)
 
 int vo_control(struct vo *vo, uint32_t request, void *data)
 {
-    return vo->driver->control(vo, request, data);
+    int ret = 0;
+    vo_run(vo, run_control, (void *[]){vo, &request, data, &ret});
+    return ret;
+}
+
+// Return whether the given IMGFMT_* is supported (see vo_driver.query_format).
+int vo_query_format(struct vo *vo, uint32_t format)
+{
+    int ret = 0;
+    vo_run(vo, run_query_format, (void *[]){vo, &format, &ret});
+    return ret;
 }
 
+// Images may belong to the driver, so free them on the VO thread.
 static void forget_frames(struct vo *vo)
 {
-    for (int n = 0; n < vo->num_video_queue; n++)
-        talloc_free(vo->video_queue[n]);
-    vo->num_video_queue = 0;
+    vo_run(vo, run_forget_frames, vo);
 }
 
 void vo_queue_image(struct vo *vo, struct mp_image *mpi)
@@ -286,8 +473,11 @@ void vo_queue_image(struct vo *vo, struct mp_image *mpi)
         return;
     assert(mp_image_params_equals(vo->params, &mpi->params));
     mpi = mp_image_new_ref(mpi);
-    if (vo->driver->filter_image)
-        mpi = vo->driver->filter_image(vo, mpi);
+    if (vo->driver->filter_image) {
+        void *pp[] = {vo, mpi};
+        vo_run(vo, run_filter_image, pp);
+        mpi = pp[1];
+    }
     if (!mpi) {
         MP_ERR(vo, "Could not upload image.\n");
         return;
@@ -325,12 +515,35 @@ double vo_get_next_pts(struct vo *vo, int index)
     return vo->video_queue[index]->pts;
 }
 
+// Move a redraw request set by the driver to in->want_redraw. Called on the
+// VO thread.
+static void update_want_redraw(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    if (!vo->want_redraw)
+        return;
+    vo->want_redraw = false;
+    pthread_mutex_lock(&in->lock);
+    in->want_redraw = true;
+    pthread_mutex_unlock(&in->lock);
+}
+
+static void reset_want_redraw(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    if (on_vo_thread(vo))
+        vo->want_redraw = false;
+    pthread_mutex_lock(&in->lock);
+    in->want_redraw = false;
+    pthread_mutex_unlock(&in->lock);
+}
+
 int vo_redraw_frame(struct vo *vo)
 {
     if (!vo->config_ok)
         return -1;
     if (vo_control(vo, VOCTRL_REDRAW_FRAME, NULL) == true) {
-        vo->want_redraw = false;
+        reset_want_redraw(vo);
         return 0;
     }
     return -1;
@@ -338,9 +551,15 @@ int vo_redraw_frame(struct vo *vo)
 
 bool vo_get_want_redraw(struct vo *vo)
 {
+    struct vo_internal *in = vo->in;
     if (!vo->config_ok)
         return false;
-    return vo->want_redraw;
+    if (on_vo_thread(vo))
+        update_want_redraw(vo);
+    pthread_mutex_lock(&in->lock);
+    bool r = in->want_redraw;
+    pthread_mutex_unlock(&in->lock);
+    return r;
 }
 
 // Remove vo->video_queue[0]
@@ -356,33 +575,169 @@ static void shift_queue(struct vo *vo)
 
 void vo_new_frame_imminent(struct vo *vo)
 {
+    struct vo_internal *in = vo->in;
     assert(vo->num_video_queue > 0);
-    vo->driver->draw_image(vo, vo->video_queue[0]);
-    shift_queue(vo);
+    if (on_vo_thread(vo)) {
+        vo->driver->draw_image(vo, vo->video_queue[0]);
+        shift_queue(vo);
+    } else {
+        // Drawn by the VO thread once vo_flip_page() is called.
+        wait_frame_done(vo);
+        talloc_free(in->frame_image);
+        in->frame_image = vo->video_queue[0];
+        vo->video_queue[0] = NULL;
+        shift_queue(vo);
+    }
 }
 
 void vo_draw_osd(struct vo *vo, struct osd_state *osd)
 {
-    if (vo->config_ok && vo->driver->draw_osd)
+    if (!vo->config_ok || !vo->driver->draw_osd)
+        return;
+    if (on_vo_thread(vo)) {
         vo->driver->draw_osd(vo, osd);
+    } else {
+        vo->in->frame_osd = osd;
+    }
 }
 
-void vo_flip_page(struct vo *vo, int64_t pts_us, int duration)
+// Called on the VO thread.
+static void draw_frame_job(void *p)
 {
-    if (!vo->config_ok)
-        return;
-    vo->want_redraw = false;
+    struct frame_job *job = p;
+    struct vo *vo = job->vo;
+    struct vo_internal *in = vo->in;
+    if (job->image)
+        vo->driver->draw_image(vo, job->image);
+    if (job->osd)
+        vo->driver->draw_osd(vo, job->osd);
+    pthread_mutex_lock(&in->lock);
+    in->flip_pending = true;
+    in->flip_pts = job->pts_us;
+    in->flip_duration = job->duration;
+    pthread_mutex_unlock(&in->lock);
+}
+
+// Called on the VO thread.
+static void flip_frame(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    pthread_mutex_lock(&in->lock);
+    int64_t pts_us = in->flip_pts;
+    int duration = in->flip_duration;
+    pthread_mutex_unlock(&in->lock);
+
     if (vo->driver->flip_page_timed)
         vo->driver->flip_page_timed(vo, pts_us, duration);
     else
         vo->driver->flip_page(vo);
+
+    int64_t now = mp_time_us();
+    pthread_mutex_lock(&in->lock);
+    in->flip_delay = pts_us ? MPMAX(now - pts_us, 0) / 1e6 : 0;
+    in->flip_pending = false;
+    in->frame_queued = false;
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
+}
+
+static void *vo_thread(void *ptr)
+{
+    struct vo *vo = ptr;
+    struct vo_internal *in = vo->in;
+    while (1) {
+        double timeout = 1000;
+        bool flip = false, check_events = false;
+        update_want_redraw(vo);
+        pthread_mutex_lock(&in->lock);
+        if (in->terminate) {
+            pthread_mutex_unlock(&in->lock);
+            break;
+        }
+        if (in->flip_pending) {
+            int64_t wait = in->flip_pts - mp_time_us();
+            if (!in->flip_pts || vo->driver->flip_page_timed || wait <= 0) {
+                flip = true;
+            } else {
+                timeout = wait / 1e6;
+            }
+        } else {
+            // Don't let event handling touch a drawn, but unflipped frame.
+            check_events = in->check_events;
+            in->check_events = false;
+        }
+        pthread_mutex_unlock(&in->lock);
+        if (flip) {
+            flip_frame(vo);
+            continue;
+        }
+        if (check_events && vo->config_ok)
+            vo->driver->control(vo, VOCTRL_CHECK_EVENTS, NULL);
+        mp_dispatch_queue_process(in->dispatch, timeout);
+    }
+    return NULL;
+}
+
+void vo_flip_page(struct vo *vo, int64_t pts_us, int duration)
+{
+    struct vo_internal *in = vo->in;
+    if (!vo->config_ok)
+        return;
+    reset_want_redraw(vo);
+    if (on_vo_thread(vo)) {
+        if (vo->driver->flip_page_timed)
+            vo->driver->flip_page_timed(vo, pts_us, duration);
+        else
+            vo->driver->flip_page(vo);
+    } else {
+        wait_frame_done(vo);
+        struct frame_job *job = talloc_ptrtype(NULL, job);
+        *job = (struct frame_job){
+            .vo = vo,
+            .image = talloc_steal(job, in->frame_image),
+            .osd = in->frame_osd,
+            .pts_us = pts_us,
+            .duration = duration,
+        };
+        in->frame_image = NULL;
+        in->frame_osd = NULL;
+        pthread_mutex_lock(&in->lock);
+        in->frame_queued = true;
+        pthread_mutex_unlock(&in->lock);
+        mp_dispatch_enqueue_autofree(in->dispatch, draw_frame_job, job);
+    }
     vo->hasframe = true;
 }
 
+// Whether vo_flip_page() returns before the frame is shown, and the frame
+// is presented at the requested time by the VO itself.
+bool vo_has_timed_flip(struct vo *vo)
+{
+    return vo->driver->flip_page_timed || vo->in->dispatch;
+}
+
+// How late the last frame was actually flipped, compared to the pts_us value
+// passed to vo_flip_page(). Only known with a VO thread; 0 otherwise.
+double vo_get_flip_delay(struct vo *vo)
+{
+    pthread_mutex_lock(&vo->in->lock);
+    double r = vo->in->flip_delay;
+    pthread_mutex_unlock(&vo->in->lock);
+    return r;
+}
+
 void vo_check_events(struct vo *vo)
 {
-    if (vo->config_ok) {
+    if (!vo->config_ok)
+        return;
+    if (on_vo_thread(vo)) {
         vo_control(vo, VOCTRL_CHECK_EVENTS, NULL);
+    } else {
+        // Done by the VO thread when it's idle; don't block playback.
+        pthread_mutex_lock(&vo->in->lock);
+        vo->in->check_events = true;
+        pthread_mutex_unlock(&vo->in->lock);
+        mp_dispatch_enqueue(vo->in->dispatch, dummy_fn, NULL);
     }
 }
 
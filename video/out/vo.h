@@ -235,7 +235,9 @@ struct vo {
 
     bool untimed;       // non-interactive, don't do sleep calls in playloop
 
-    bool want_redraw;   // visible frame wrong (window resize), needs refresh
+    // Visible frame wrong (window resize), needs refresh. Set by the driver,
+    // and only accessed on the VO thread; see vo_get_want_redraw().
+    bool want_redraw;
     bool hasframe;      // >= 1 frame has been drawn, so redraw is possible
     double wakeup_period; // if > 0, this sets the maximum wakeup period for event polling
 
@@ -248,6 +250,7 @@ struct vo {
 
     const struct vo_driver *driver;
     void *priv;
+    struct vo_internal *in;
     struct mp_vo_opts *opts;
     struct mpv_global *global;
     struct vo_x11_state *x11;
@@ -282,6 +285,9 @@ bool vo_needs_new_image(struct vo *vo);
 void vo_new_frame_imminent(struct vo *vo);
 void vo_draw_osd(struct vo *vo, struct osd_state *osd);
 void vo_flip_page(struct vo *vo, int64_t pts_us, int duration);
+bool vo_has_timed_flip(struct vo *vo);
+double vo_get_flip_delay(struct vo *vo);
+int vo_query_format(struct vo *vo, uint32_t format);
 void vo_check_events(struct vo *vo);
 void vo_seek_reset(struct vo *vo);
 void vo_destroy(struct vo *vo);
@@ -17,6 +17,8 @@
  */
 
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 
 #include <libswscale/swscale.h>
 #include <libavcodec/avcodec.h>
@@ -32,6 +34,8 @@
 #include "fmt-conversion.h"
 #include "csputils.h"
 #include "common/msg.h"
+#include "misc/thread_pool.h"
+#include "osdep/numcores.h"
 #include "video/filter/vf.h"
 
 //global sws_flags from the command line
@@ -43,6 +47,7 @@ int sws_chr_vshift = 0;
 int sws_chr_hshift = 0;
 float sws_chr_sharpen = 0.0;
 float sws_lum_sharpen = 0.0;
+int sws_threads = 1;
 
 // Highest quality, but also slowest.
 const int mp_sws_hq_flags = SWS_LANCZOS | SWS_FULL_CHR_H_INT |
@@ -56,10 +61,19 @@ const int mp_sws_fast_flags = SWS_BILINEAR;
 void mp_sws_set_from_cmdline(struct mp_sws_context *ctx)
 {
     sws_freeFilter(ctx->src_filter);
-    ctx->src_filter = sws_getDefaultFilter(sws_lum_gblur, sws_chr_gblur,
-                                           sws_lum_sharpen, sws_chr_sharpen,
-                                           sws_chr_hshift, sws_chr_vshift, 0);
+    ctx->src_filter = NULL;
+    // sws_getDefaultFilter() returns an identity filter even if all parameters
+    // are 0; leave it unset then, so that slice threading can be used.
+    if (sws_lum_gblur || sws_chr_gblur || sws_lum_sharpen || sws_chr_sharpen ||
+        sws_chr_hshift || sws_chr_vshift)
+    {
+        ctx->src_filter = sws_getDefaultFilter(sws_lum_gblur, sws_chr_gblur,
+                                               sws_lum_sharpen, sws_chr_sharpen,
+                                               sws_chr_hshift, sws_chr_vshift,
+                                               0);
+    }
     ctx->force_reload = true;
+    ctx->threads = sws_threads;
 
     ctx->flags = SWS_PRINT_INFO;
 
@@ -105,6 +119,7 @@ static bool cache_valid(struct mp_sws_context *ctx)
     return mp_image_params_equals(&ctx->src, &old->src) &&
            mp_image_params_equals(&ctx->dst, &old->dst) &&
            ctx->flags == old->flags &&
+           ctx->threads == old->threads &&
            ctx->brightness == old->brightness &&
            ctx->contrast == old->contrast &&
            ctx->saturation == old->saturation;
@@ -126,6 +141,7 @@ struct mp_sws_context *mp_sws_alloc(void *talloc_ctx)
     *ctx = (struct mp_sws_context) {
         .log = mp_null_log,
         .flags = SWS_BILINEAR,
+        .threads = 1,
         .contrast = 1 << 16,    // 1.0 in 16.16 fixed point
         .saturation = 1 << 16,
         .force_reload = true,
@@ -136,6 +152,178 @@ struct mp_sws_context *mp_sws_alloc(void *talloc_ctx)
     return ctx;
 }
 
+// Slice threading: the destination image is split into horizontal slices,
+// each scaled by its own SwsContext on a worker thread. A slice is scaled
+// from a source band extended by a margin, so that the vertical filters see
+// the same source rows as when scaling the whole image. The destination rows
+// computed for the margin are thrown away.
+
+// Margin in source rows (when not downscaling). This is larger than the
+// vertical filter support of all libswscale scalers.
+#define SLICE_MARGIN 16
+// Minimum number of destination rows per slice.
+#define MIN_SLICE_ROWS 32
+
+struct sws_slice {
+    struct mp_sws_slices *owner;
+    struct mp_sws_context *sws;
+    int y0, y1;             // destination rows written by this slice
+    int e0, e1;             // destination rows scaled (y0/y1 plus margin)
+    int s0, s1;             // source rows corresponding to e0/e1
+    struct mp_image *temp;  // rows e0..e1, if they're not the same as y0..y1
+};
+
+struct mp_sws_slices {
+    struct mp_thread_pool *pool;
+    struct sws_slice *slices;
+    int num_slices;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int pending;
+    struct mp_image *src, *dst; // images of the current mp_sws_scale() call
+};
+
+static void destroy_slices(void *p)
+{
+    struct mp_sws_slices *s = p;
+    talloc_free(s->pool);
+    pthread_cond_destroy(&s->wakeup);
+    pthread_mutex_destroy(&s->lock);
+}
+
+// Return the distance between possible slice borders in destination rows, or
+// 0 if there is none <= max_step. A border must map to a whole source row (so
+// that the slices use the same filter phases as the unsliced image), and be
+// aligned to the chroma subsampling of both images, and to the 8 row dither
+// pattern of libswscale.
+static int get_slice_step(struct mp_image_params *src,
+                          struct mp_image_params *dst, int max_step)
+{
+    int src_align = mp_imgfmt_get_desc(src->imgfmt).align_y;
+    int dst_align = MPMAX(mp_imgfmt_get_desc(dst->imgfmt).align_y, 8);
+    for (int k = dst_align; k <= max_step; k += dst_align) {
+        int64_t s = (int64_t)k * src->h;
+        if (s % dst->h == 0 && (s / dst->h) % src_align == 0)
+            return k;
+    }
+    return 0;
+}
+
+static void setup_slices(struct mp_sws_context *ctx)
+{
+    struct mp_image_params *src = &ctx->src;
+    struct mp_image_params *dst = &ctx->dst;
+
+    int threads = ctx->threads > 0 ? ctx->threads : default_thread_count();
+    int num_slices = MPMIN(threads, dst->h / MIN_SLICE_ROWS);
+    // The filters can't be shared between the slice contexts.
+    if (num_slices < 2 || ctx->src_filter || ctx->dst_filter)
+        return;
+    int step = get_slice_step(src, dst, dst->h / num_slices);
+    if (!step)
+        return;
+    double ratio = src->h / (double)dst->h;
+    int margin = ceil(SLICE_MARGIN * MPMAX(ratio, 1.0) / ratio);
+    margin = (margin + step - 1) / step * step;
+
+    struct mp_sws_slices *s = talloc_zero(ctx, struct mp_sws_slices);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+    talloc_set_destructor(s, destroy_slices);
+    s->pool = mp_thread_pool_create(NULL, num_slices - 1);
+    if (!s->pool)
+        goto fail;
+    s->slices = talloc_zero_array(s, struct sws_slice, num_slices);
+    s->num_slices = num_slices;
+
+    for (int n = 0; n < num_slices; n++) {
+        struct sws_slice *sl = &s->slices[n];
+        sl->owner = s;
+        sl->y0 = (int64_t)n * dst->h / num_slices / step * step;
+        sl->y1 = n + 1 == num_slices ? dst->h
+               : (int64_t)(n + 1) * dst->h / num_slices / step * step;
+        sl->e0 = MPMAX(sl->y0 - margin, 0);
+        sl->e1 = MPMIN(sl->y1 + margin, dst->h);
+        sl->s0 = (int64_t)sl->e0 * src->h / dst->h;
+        sl->s1 = (int64_t)sl->e1 * src->h / dst->h;
+
+        struct mp_sws_context *c = mp_sws_alloc(s);
+        c->log = ctx->log;
+        c->flags = ctx->flags;
+        c->brightness = ctx->brightness;
+        c->contrast = ctx->contrast;
+        c->saturation = ctx->saturation;
+        c->params[0] = ctx->params[0];
+        c->params[1] = ctx->params[1];
+        c->src = *src;
+        c->src.h = sl->s1 - sl->s0;
+        c->dst = *dst;
+        c->dst.h = sl->e1 - sl->e0;
+        sl->sws = c;
+        if (mp_sws_reinit(c) < 0)
+            goto fail;
+
+        if (sl->e0 != sl->y0 || sl->e1 != sl->y1) {
+            sl->temp = mp_image_alloc(dst->imgfmt, dst->w, sl->e1 - sl->e0);
+            if (!sl->temp)
+                goto fail;
+            talloc_steal(s, sl->temp);
+            sl->temp->params = c->dst;
+        }
+    }
+
+    MP_VERBOSE(ctx, "Scaling in %d slices.\n", num_slices);
+    ctx->slices = s;
+    return;
+
+fail:
+    MP_WARN(ctx, "Could not set up slice threading.\n");
+    talloc_free(s);
+}
+
+static void scale_slice(struct sws_slice *sl)
+{
+    struct mp_sws_slices *s = sl->owner;
+    struct mp_image src = *s->src;
+    mp_image_crop(&src, 0, sl->s0, src.w, sl->s1);
+    struct mp_image dst = *s->dst;
+    mp_image_crop(&dst, 0, sl->y0, dst.w, sl->y1);
+    if (sl->temp) {
+        mp_sws_scale(sl->sws, sl->temp, &src);
+        struct mp_image rows = *sl->temp;
+        mp_image_crop(&rows, 0, sl->y0 - sl->e0, rows.w, sl->y1 - sl->e0);
+        mp_image_copy(&dst, &rows);
+    } else {
+        mp_sws_scale(sl->sws, &dst, &src);
+    }
+}
+
+static void slice_worker(void *ctx)
+{
+    struct sws_slice *sl = ctx;
+    struct mp_sws_slices *s = sl->owner;
+    scale_slice(sl);
+    pthread_mutex_lock(&s->lock);
+    s->pending--;
+    pthread_cond_signal(&s->wakeup);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void scale_slices(struct mp_sws_slices *s, struct mp_image *dst,
+                         struct mp_image *src)
+{
+    s->src = src;
+    s->dst = dst;
+    s->pending = s->num_slices - 1;
+    for (int n = 1; n < s->num_slices; n++)
+        mp_thread_pool_queue(s->pool, slice_worker, &s->slices[n]);
+    scale_slice(&s->slices[0]);
+    pthread_mutex_lock(&s->lock);
+    while (s->pending)
+        pthread_cond_wait(&s->wakeup, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
 // Reinitialize (if needed) - return error code.
 // Optional, but possibly useful to avoid having to handle mp_sws_scale errors.
 int mp_sws_reinit(struct mp_sws_context *ctx)
@@ -148,17 +336,21 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
     src->d_h = dst->d_h = 0;
     src->outputlevels = dst->outputlevels = MP_CSP_LEVELS_AUTO;
 
+    // Before cache_valid(), so that the sanitized parameters are compared.
+    mp_image_params_guess_csp(src); // sanitize colorspace/colorlevels
+    mp_image_params_guess_csp(dst);
+
     if (cache_valid(ctx))
         return 0;
 
+    talloc_free(ctx->slices);
+    ctx->slices = NULL;
+
     sws_freeContext(ctx->sws);
     ctx->sws = sws_alloc_context();
     if (!ctx->sws)
         return -1;
 
-    mp_image_params_guess_csp(src); // sanitize colorspace/colorlevels
-    mp_image_params_guess_csp(dst);
-
     struct mp_imgfmt_desc src_fmt = mp_imgfmt_get_desc(src->imgfmt);
     struct mp_imgfmt_desc dst_fmt = mp_imgfmt_get_desc(dst->imgfmt);
     if (!src_fmt.id || !dst_fmt.id)
@@ -226,6 +418,9 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
     if (sws_init_context(ctx->sws, ctx->src_filter, ctx->dst_filter) < 0)
         return -1;
 
+    if (ctx->threads != 1)
+        setup_slices(ctx);
+
     ctx->force_reload = false;
     *ctx->cached = *ctx;
     return 1;
@@ -246,29 +441,121 @@ int mp_sws_scale(struct mp_sws_context *ctx, struct mp_image *dst,
         return r;
     }
 
+    if (ctx->slices) {
+        scale_slices(ctx->slices, dst, src);
+        return 0;
+    }
+
     sws_scale(ctx->sws, (const uint8_t *const *) src->planes, src->stride,
               0, src->h, dst->planes, dst->stride);
     return 0;
 }
 
+// Initialized contexts used by mp_image_swscale() and mp_image_sw_blur_scale().
+// Initializing a context is often much more expensive than the conversion
+// itself (e.g. for small subtitle bitmaps). A context is removed from the
+// cache while it's in use, so concurrent callers never share one.
+#define SWS_CACHE_SIZE 8
+
+struct sws_cache_entry {
+    struct mp_sws_context *ctx;
+    float gblur;
+};
+
+static pthread_mutex_t sws_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sws_cache_entry sws_cache[SWS_CACHE_SIZE]; // most recent first
+static int sws_cache_num;
+static struct mp_sws_cache_stats sws_cache_stats;
+
+static struct sws_cache_entry get_cached_sws(struct mp_image *dst,
+                                             struct mp_image *src,
+                                             int flags, float gblur)
+{
+    // Same parameters as the ones mp_sws_reinit() stores in ctx->cached.
+    struct mp_image_params p_src, p_dst;
+    mp_image_params_from_image(&p_src, src);
+    mp_image_params_from_image(&p_dst, dst);
+    p_src.d_w = p_dst.d_w = p_src.d_h = p_dst.d_h = 0;
+    p_src.outputlevels = p_dst.outputlevels = MP_CSP_LEVELS_AUTO;
+    mp_image_params_guess_csp(&p_src);
+    mp_image_params_guess_csp(&p_dst);
+
+    pthread_mutex_lock(&sws_cache_lock);
+    for (int n = 0; n < sws_cache_num; n++) {
+        struct sws_cache_entry e = sws_cache[n];
+        struct mp_sws_context *old = e.ctx->cached;
+        if (e.gblur == gblur && old->flags == flags &&
+            mp_image_params_equals(&old->src, &p_src) &&
+            mp_image_params_equals(&old->dst, &p_dst))
+        {
+            MP_TARRAY_REMOVE_AT(sws_cache, sws_cache_num, n);
+            sws_cache_stats.hits++;
+            pthread_mutex_unlock(&sws_cache_lock);
+            return e;
+        }
+    }
+    sws_cache_stats.misses++;
+    pthread_mutex_unlock(&sws_cache_lock);
+
+    struct sws_cache_entry e = {mp_sws_alloc(NULL), gblur};
+    e.ctx->flags = flags;
+    e.ctx->threads = sws_threads;
+    if (gblur)
+        e.ctx->src_filter = sws_getDefaultFilter(gblur, gblur, 0, 0, 0, 0, 0);
+    return e;
+}
+
+static void put_cached_sws(struct sws_cache_entry e)
+{
+    struct mp_sws_context *drop = NULL;
+    pthread_mutex_lock(&sws_cache_lock);
+    if (sws_cache_num == SWS_CACHE_SIZE)
+        drop = sws_cache[--sws_cache_num].ctx;
+    memmove(&sws_cache[1], &sws_cache[0], sws_cache_num * sizeof(sws_cache[0]));
+    sws_cache[0] = e;
+    sws_cache_num++;
+    pthread_mutex_unlock(&sws_cache_lock);
+    talloc_free(drop);
+}
+
+static void scale_cached(struct mp_image *dst, struct mp_image *src,
+                         int flags, float gblur)
+{
+    struct sws_cache_entry e = get_cached_sws(dst, src, flags, gblur);
+    if (mp_sws_scale(e.ctx, dst, src) < 0) {
+        talloc_free(e.ctx);
+        return;
+    }
+    put_cached_sws(e);
+}
+
 void mp_image_swscale(struct mp_image *dst, struct mp_image *src,
                       int my_sws_flags)
 {
-    struct mp_sws_context *ctx = mp_sws_alloc(NULL);
-    ctx->flags = my_sws_flags;
-    mp_sws_scale(ctx, dst, src);
-    talloc_free(ctx);
+    scale_cached(dst, src, my_sws_flags, 0);
 }
 
 void mp_image_sw_blur_scale(struct mp_image *dst, struct mp_image *src,
                             float gblur)
 {
-    struct mp_sws_context *ctx = mp_sws_alloc(NULL);
-    ctx->flags = mp_sws_hq_flags;
-    ctx->src_filter = sws_getDefaultFilter(gblur, gblur, 0, 0, 0, 0, 0);
-    ctx->force_reload = true;
-    mp_sws_scale(ctx, dst, src);
-    talloc_free(ctx);
+    scale_cached(dst, src, mp_sws_hq_flags, gblur);
+}
+
+void mp_sws_get_cache_stats(struct mp_sws_cache_stats *stats)
+{
+    pthread_mutex_lock(&sws_cache_lock);
+    *stats = sws_cache_stats;
+    pthread_mutex_unlock(&sws_cache_lock);
+}
+
+// Free the contexts cached by mp_image_swscale() (contexts currently in use
+// are not affected).
+void mp_sws_flush_cache(void)
+{
+    pthread_mutex_lock(&sws_cache_lock);
+    while (sws_cache_num > 0)
+        talloc_free(sws_cache[--sws_cache_num].ctx);
+    pthread_mutex_unlock(&sws_cache_lock);
 }
 
 int mp_sws_get_vf_equalizer(struct mp_sws_context *sws, struct vf_seteq *eq)
@@ -24,12 +24,23 @@ void mp_image_swscale(struct mp_image *dst, struct mp_image *src,
 void mp_image_sw_blur_scale(struct mp_image *dst, struct mp_image *src,
                             float gblur);
 
+// Statistics of the context cache used by the two functions above.
+struct mp_sws_cache_stats {
+    long long hits, misses;
+};
+
+void mp_sws_get_cache_stats(struct mp_sws_cache_stats *stats);
+void mp_sws_flush_cache(void);
+
 struct mp_sws_context {
     // Can be set for verbose error printing.
     struct mp_log *log;
     // User configuration. These can be changed freely, at any time.
     // mp_sws_scale() will handle the changes transparently.
     int flags;
+    // Number of slice threads; 1 disables slice threading, 0 picks the number
+    // of CPU cores.
+    int threads;
     int brightness, contrast, saturation;
     bool force_reload;
     // These are also implicitly set by mp_sws_scale(), and thus optional.
@@ -47,6 +58,9 @@ struct mp_sws_context {
 
     // Contains parameters for which sws is valid
     struct mp_sws_context *cached;
+
+    // Slice threading state (if any)
+    struct mp_sws_slices *slices;
 };
 
 struct mp_sws_context *mp_sws_alloc(void *talloc_ctx);
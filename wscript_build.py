@@ -185,6 +185,7 @@ def build(ctx):
         ( "input/cmd_parse.c" ),
         ( "input/event.c" ),
         ( "input/input.c" ),
+        ( "input/ipc.c",                         "unix-sockets" ),
         ( "input/keycodes.c" ),
         ( "input/joystick.c",                    "joystick" ),
         ( "input/lirc.c",                        "lirc" ),
@@ -192,7 +193,9 @@ def build(ctx):
         ## Misc
         ( "misc/charset_conv.c" ),
         ( "misc/dispatch.c" ),
+        ( "misc/json.c" ),
         ( "misc/ring.c" ),
+        ( "misc/thread_pool.c" ),
 
         ## Options
         ( "options/m_config.c" ),
@@ -278,6 +281,7 @@ def build(ctx):
         ## Video
         ( "video/csputils.c" ),
         ( "video/fmt-conversion.c" ),
+        ( "video/frame_arena.c" ),
         ( "video/image_writer.c" ),
         ( "video/img_format.c" ),
         ( "video/mp_image.c" ),